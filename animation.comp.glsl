@@ -41,14 +41,14 @@ layout(binding=ANIM_SSBO_MATRIXORIG, std430) restrict buffer matricesOrigBuffer
   MatrixData original[];
 };
 
-void main()
+layout(binding=ANIM_SSBO_DEQUANT, std430) restrict readonly buffer dequantNodesBuffer {
+  uint dequantNodes[];
+};
+
+// the movement of a node, derived from its index and original position
+vec3 getNodeDelta(int node)
 {
-  int self = int(gl_GlobalInvocationID.x);
-  if (gl_GlobalInvocationID.x >= anim.numMatrices){
-    return;
-  }
-  
-  float s = 1-(float(self)/float(anim.numMatrices));
+  float s = 1-(float(node)/float(anim.numNodes));
   float movement = 4;             // time until all objects done with moving (<= sequence*0.5)
   float sequence = movement*2+3;  // time for sequence
   
@@ -57,12 +57,11 @@ void main()
   
   float scale         = smoothstep(0,1,time);
   
-  mat4 matrixOrig     = original[self].worldMatrix;
-  vec3 pos  = matrixOrig[3].xyz;
+  vec3 pos  = original[node].worldMatrix[3].xyz;
   vec3 away = (pos - anim.sceneCenter );
   
-  float diridx  = float(self % 3);
-  float sidx    = float(self % 6);
+  float diridx  = float(node % 3);
+  float sidx    = float(node % 6);
 
   vec3 delta;
   #if 1
@@ -80,7 +79,22 @@ void main()
   delta *= sign(dot(away,delta));
   
   delta = normalize(delta);
-  pos += delta * scale * anim.sceneDimension;
+  return delta * scale * anim.sceneDimension;
+}
+
+void main()
+{
+  int self = int(gl_GlobalInvocationID.x);
+  if (gl_GlobalInvocationID.x >= anim.numMatrices){
+    return;
+  }
+
+  // Matrices with the dequantization folded in are node * dequant. The animation only
+  // moves the translation, so they move exactly like their node.
+  int node = self < int(anim.numNodes) ? self : int(dequantNodes[self - int(anim.numNodes)]);
+
+  mat4 matrixOrig = original[self].worldMatrix;
+  vec3 pos        = matrixOrig[3].xyz + getNodeDelta(node);
   
   animated[self].worldMatrix = mat4(matrixOrig[0], matrixOrig[1], matrixOrig[2], vec4(pos,1));
 }
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#version 460 core
+/**/
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
+
+#include "common.h"
+
+// Placeholder edges of an object whose geometry is not resident yet,
+// 12 lines from gl_VertexIndex, one instance per copy.
+
+///////////////////////////////////////////////////////////
+// Bindings
+
+layout(set=0, binding=DRAW_UBO_SCENE, scalar) uniform sceneBuffer {
+  SceneData   scene;
+};
+
+layout(set=0, binding=DRAW_SSBO_MATRIX, scalar) buffer matrixBuffer {
+  MatrixData    matrices[];
+};
+
+layout(set=0, binding=DRAW_SSBO_COPIES, scalar) readonly buffer copiesBuffer {
+  CopyData    copies[];
+};
+
+layout(push_constant, scalar) uniform pushConstants {
+  BBoxPushData  push;
+};
+
+///////////////////////////////////////////////////////////
+
+// corner bits x = 1, y = 2, z = 4, two corners per edge
+const uint s_edgeCorners[24] = uint[24](0,1, 2,3, 4,5, 6,7,
+                                        0,2, 1,3, 4,6, 5,7,
+                                        0,4, 1,5, 2,6, 3,7);
+
+void main()
+{
+  uint corner = s_edgeCorners[gl_VertexIndex];
+  vec3 oPos   = vec3((corner & 1) != 0 ? push.bboxMax.x : push.bboxMin.x,
+                     (corner & 2) != 0 ? push.bboxMax.y : push.bboxMin.y,
+                     (corner & 4) != 0 ? push.bboxMax.z : push.bboxMin.z);
+
+  vec3 wPos   = (matrices[push.matrixIndex].worldMatrix * vec4(oPos,1)).xyz + copies[gl_InstanceIndex].shift;
+
+  gl_Position = scene.viewProjMatrix * vec4(wPos,1);
+}
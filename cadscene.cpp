@@ -23,9 +23,11 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-
-#define USE_CACHECOMBINE 1
+#include <map>
+#include <unordered_map>
 
 
 glm::vec4 randomVector(float from, float to)
@@ -104,7 +106,852 @@ inline glm::vec3 float32x3_to_octn_precise(glm::vec3 v, const int n)
   return bestRepresentation;
 }
 
-bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
+//////////////////////////////////////////////////////////////////////////
+// load-time welding and deduplication
+
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+  // FNV-1a
+  const uint8_t* bytes = (const uint8_t*)data;
+  for(size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// merges vertices with identical position and normal, returns the number of removed vertices
+static uint32_t weldVertices(CSFGeometry* csfgeom)
+{
+  uint32_t numVertices = uint32_t(csfgeom->numVertices);
+
+  auto getHash = [&](uint32_t v) {
+    uint64_t hash = hashBytes(&csfgeom->vertex[v * 3], sizeof(float) * 3);
+    return csfgeom->normal ? hashBytes(&csfgeom->normal[v * 3], sizeof(float) * 3, hash) : hash;
+  };
+  auto isEqual = [&](uint32_t a, uint32_t b) {
+    return memcmp(&csfgeom->vertex[a * 3], &csfgeom->vertex[b * 3], sizeof(float) * 3) == 0
+           && (!csfgeom->normal || memcmp(&csfgeom->normal[a * 3], &csfgeom->normal[b * 3], sizeof(float) * 3) == 0);
+  };
+  auto move = [&](uint32_t dst, uint32_t src) {
+    memcpy(&csfgeom->vertex[dst * 3], &csfgeom->vertex[src * 3], sizeof(float) * 3);
+    if(csfgeom->normal)
+      memcpy(&csfgeom->normal[dst * 3], &csfgeom->normal[src * 3], sizeof(float) * 3);
+    if(csfgeom->tex)
+      memcpy(&csfgeom->tex[dst * 2], &csfgeom->tex[src * 2], sizeof(float) * 2);
+  };
+
+  // unique vertices are compacted in place, they only ever move to lower indices
+  std::unordered_multimap<uint64_t, uint32_t> unique;
+  std::vector<uint32_t>                       remap(numVertices);
+  uint32_t                                    numUnique = 0;
+  unique.reserve(numVertices);
+  for(uint32_t v = 0; v < numVertices; v++)
+  {
+    uint64_t hash  = getHash(v);
+    auto     range = unique.equal_range(hash);
+    auto     it    = range.first;
+    while(it != range.second && !isEqual(it->second, v))
+    {
+      ++it;
+    }
+
+    if(it != range.second)
+    {
+      remap[v] = it->second;
+    }
+    else
+    {
+      move(numUnique, v);
+      unique.insert({hash, numUnique});
+      remap[v] = numUnique++;
+    }
+  }
+
+  if(numUnique == numVertices)
+  {
+    return 0;
+  }
+
+  for(int i = 0; i < csfgeom->numIndexSolid; i++)
+  {
+    csfgeom->indexSolid[i] = remap[csfgeom->indexSolid[i]];
+  }
+  for(int i = 0; i < csfgeom->numIndexWire; i++)
+  {
+    csfgeom->indexWire[i] = remap[csfgeom->indexWire[i]];
+  }
+  csfgeom->numVertices = int(numUnique);
+
+  return numVertices - numUnique;
+}
+
+// only compares what the scene uses, wire indices and texture coordinates are ignored
+static uint64_t hashGeometry(const CSFGeometry* csfgeom)
+{
+  uint64_t hash = hashBytes(&csfgeom->numVertices, sizeof(int));
+  hash          = hashBytes(&csfgeom->numIndexSolid, sizeof(int), hash);
+  hash          = hashBytes(&csfgeom->numParts, sizeof(int), hash);
+  hash          = hashBytes(csfgeom->vertex, sizeof(float) * 3 * csfgeom->numVertices, hash);
+  hash          = hashBytes(csfgeom->indexSolid, sizeof(uint32_t) * csfgeom->numIndexSolid, hash);
+  if(csfgeom->normal)
+  {
+    hash = hashBytes(csfgeom->normal, sizeof(float) * 3 * csfgeom->numVertices, hash);
+  }
+  for(int p = 0; p < csfgeom->numParts; p++)
+  {
+    hash = hashBytes(&csfgeom->parts[p].numIndexSolid, sizeof(int), hash);
+  }
+  return hash;
+}
+
+static bool isEqualGeometry(const CSFGeometry* a, const CSFGeometry* b)
+{
+  if(a->numVertices != b->numVertices || a->numIndexSolid != b->numIndexSolid || a->numParts != b->numParts
+     || (a->normal == nullptr) != (b->normal == nullptr))
+  {
+    return false;
+  }
+  for(int p = 0; p < a->numParts; p++)
+  {
+    if(a->parts[p].numIndexSolid != b->parts[p].numIndexSolid)
+      return false;
+  }
+  return memcmp(a->vertex, b->vertex, sizeof(float) * 3 * a->numVertices) == 0
+         && memcmp(a->indexSolid, b->indexSolid, sizeof(uint32_t) * a->numIndexSolid) == 0
+         && (!a->normal || memcmp(a->normal, b->normal, sizeof(float) * 3 * a->numVertices) == 0);
+}
+
+// approximates the device memory of a geometry, see CadSceneVK
+static size_t getGeometrySize(const CSFGeometry* csfgeom)
+{
+  return sizeof(CadScene::Vertex) * csfgeom->numVertices + sizeof(uint32_t) * csfgeom->numIndexSolid
+         + sizeof(uint32_t) * (csfgeom->numIndexSolid / 3) + sizeof(uint32_t) * 2 * csfgeom->numParts;
+}
+
+// Welds the vertices of every geometry, then merges identical geometries. The geometry
+// array is compacted and the nodes are remapped, they keep their parts and therefore
+// the objects keep their unique part ranges.
+static void deduplicateGeometries(CSFile* csf, uint32_t& weldedVertices, uint32_t& mergedGeometries, size_t& savedSize)
+{
+  weldedVertices   = 0;
+  mergedGeometries = 0;
+  savedSize        = 0;
+
+  std::unordered_multimap<uint64_t, int> unique;
+  std::vector<int>                       remap(csf->numGeometries);
+  int                                    numUnique = 0;
+  for(int g = 0; g < csf->numGeometries; g++)
+  {
+    CSFGeometry* csfgeom = &csf->geometries[g];
+
+    size_t size = getGeometrySize(csfgeom);
+    weldedVertices += weldVertices(csfgeom);
+
+    uint64_t hash  = hashGeometry(csfgeom);
+    auto     range = unique.equal_range(hash);
+    auto     it    = range.first;
+    while(it != range.second && !isEqualGeometry(&csf->geometries[it->second], csfgeom))
+    {
+      ++it;
+    }
+
+    if(it != range.second)
+    {
+      remap[g] = it->second;
+      mergedGeometries++;
+      savedSize += size;
+    }
+    else
+    {
+      savedSize += size - getGeometrySize(csfgeom);
+      // the arrays stay owned by the file's memory, only the struct moves
+      csf->geometries[numUnique] = *csfgeom;
+      unique.insert({hash, numUnique});
+      remap[g] = numUnique++;
+    }
+  }
+  csf->numGeometries = numUnique;
+
+  for(int n = 0; n < csf->numNodes; n++)
+  {
+    if(csf->nodes[n].geometryIDX >= 0)
+    {
+      csf->nodes[n].geometryIDX = remap[csf->nodes[n].geometryIDX];
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// load-time part vertex splitting
+
+// Duplicates every vertex that is referenced by more than one part, so that each vertex
+// belongs to exactly one part and can carry its part index. The first part keeps the
+// original vertex, the copies are appended. The grown arrays live in storage, as the
+// file's memory cannot be resized, returns the number of added vertices.
+static uint32_t splitPartVertices(CSFGeometry* csfgeom, std::vector<std::vector<float>>& storage)
+{
+  uint32_t numVertices = uint32_t(csfgeom->numVertices);
+
+  // the part that owns the vertex, and the copy of the vertex for the current part
+  std::vector<int32_t>  vertexPart(numVertices, -1);
+  std::vector<int32_t>  copyPart(numVertices, -1);
+  std::vector<uint32_t> copyIndex(numVertices);
+  std::vector<uint32_t> copies;
+
+  uint32_t* indices = csfgeom->indexSolid;
+  for(int32_t p = 0; p < csfgeom->numParts; p++)
+  {
+    for(int i = 0; i < csfgeom->parts[p].numIndexSolid; i++)
+    {
+      uint32_t v = indices[i];
+      if(vertexPart[v] == -1)
+      {
+        vertexPart[v] = p;
+      }
+      else if(vertexPart[v] != p)
+      {
+        if(copyPart[v] != p)
+        {
+          copyPart[v]  = p;
+          copyIndex[v] = numVertices + uint32_t(copies.size());
+          copies.push_back(v);
+        }
+        indices[i] = copyIndex[v];
+      }
+    }
+    indices += csfgeom->parts[p].numIndexSolid;
+  }
+
+  if(copies.empty())
+  {
+    return 0;
+  }
+
+  auto grow = [&](float*& data, uint32_t components) {
+    if(!data)
+      return;
+    storage.emplace_back(size_t(numVertices + copies.size()) * components);
+    std::vector<float>& grown = storage.back();
+    memcpy(grown.data(), data, sizeof(float) * components * numVertices);
+    for(size_t c = 0; c < copies.size(); c++)
+    {
+      memcpy(&grown[(numVertices + c) * components], &data[copies[c] * components], sizeof(float) * components);
+    }
+    data = grown.data();
+  };
+  grow(csfgeom->vertex, 3);
+  grow(csfgeom->normal, 3);
+  grow(csfgeom->tex, 2);
+  csfgeom->numVertices = int(numVertices + copies.size());
+
+  return uint32_t(copies.size());
+}
+
+//////////////////////////////////////////////////////////////////////////
+// load-time index optimization
+
+// simulated FIFO post-transform cache, used for the ACMR statistics and by the optimizer
+static const uint32_t VERTEX_CACHE_SIZE = 32;
+
+// returns the number of cache misses, the ACMR is misses per triangle
+static size_t countCacheMisses(const uint32_t* indices, size_t numIndices, uint32_t numVertices)
+{
+  // the miss count at which a vertex entered the cache, 0 if never
+  std::vector<size_t> loadedAt(numVertices, 0);
+  size_t              misses = 0;
+  for(size_t i = 0; i < numIndices; i++)
+  {
+    uint32_t v = indices[i];
+    if(!loadedAt[v] || misses - loadedAt[v] >= VERTEX_CACHE_SIZE)
+    {
+      misses++;
+      loadedAt[v] = misses;
+    }
+  }
+  return misses;
+}
+
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+static float forsythVertexScore(int cachePos, uint32_t remainingTris)
+{
+  if(!remainingTris)
+  {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if(cachePos >= 0)
+  {
+    // the last triangle's vertices are scored equally, so its winding direction does not matter
+    score = cachePos < 3 ? 0.75f : powf(1.0f - float(cachePos - 3) / float(VERTEX_CACHE_SIZE - 3), 1.5f);
+  }
+  // vertices with few triangles left are finished first
+  return score + 2.0f / sqrtf(float(remainingTris));
+}
+
+// reorders the triangles of indices in place, localIndex must hold -1 for all vertices
+// and is restored before returning
+static void optimizeVertexCache(uint32_t* indices, size_t numIndices, std::vector<int32_t>& localIndex)
+{
+  uint32_t numTris = uint32_t(numIndices / 3);
+  if(numTris < 2)
+  {
+    return;
+  }
+
+  // compact the referenced vertices
+  std::vector<uint32_t> vertices;
+  std::vector<uint32_t> triVertices(numTris * 3);
+  for(size_t i = 0; i < numTris * 3; i++)
+  {
+    if(localIndex[indices[i]] < 0)
+    {
+      localIndex[indices[i]] = int32_t(vertices.size());
+      vertices.push_back(indices[i]);
+    }
+    triVertices[i] = uint32_t(localIndex[indices[i]]);
+  }
+  for(uint32_t v : vertices)
+  {
+    localIndex[v] = -1;
+  }
+
+  // per vertex, the not yet emitted triangles are kept at the front of its adjacency range
+  uint32_t              numVertices = uint32_t(vertices.size());
+  std::vector<uint32_t> remaining(numVertices, 0);
+  std::vector<uint32_t> adjOffsets(numVertices + 1, 0);
+  for(uint32_t v : triVertices)
+  {
+    remaining[v]++;
+  }
+  for(uint32_t v = 0; v < numVertices; v++)
+  {
+    adjOffsets[v + 1] = adjOffsets[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(triVertices.size());
+  {
+    std::vector<uint32_t> fill(adjOffsets.begin(), adjOffsets.end() - 1);
+    for(uint32_t t = 0; t < numTris; t++)
+    {
+      for(uint32_t k = 0; k < 3; k++)
+      {
+        adjacency[fill[triVertices[t * 3 + k]]++] = t;
+      }
+    }
+  }
+
+  std::vector<int32_t> cachePos(numVertices, -1);
+  std::vector<float>   vertexScores(numVertices);
+  for(uint32_t v = 0; v < numVertices; v++)
+  {
+    vertexScores[v] = forsythVertexScore(-1, remaining[v]);
+  }
+
+  std::vector<float> triScores(numTris);
+  std::vector<bool>  emitted(numTris, false);
+  uint32_t           bestTri = 0;
+  for(uint32_t t = 0; t < numTris; t++)
+  {
+    triScores[t] = vertexScores[triVertices[t * 3 + 0]] + vertexScores[triVertices[t * 3 + 1]] + vertexScores[triVertices[t * 3 + 2]];
+    if(triScores[t] > triScores[bestTri])
+    {
+      bestTri = t;
+    }
+  }
+
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> newCache;
+  std::vector<uint32_t> output;
+  output.reserve(numTris * 3);
+  uint32_t nextUnemitted = 0;
+
+  for(uint32_t n = 0; n < numTris; n++)
+  {
+    if(bestTri == ~0u)
+    {
+      // nothing adjacent to the cache left, continue with the first remaining triangle
+      while(emitted[nextUnemitted])
+      {
+        nextUnemitted++;
+      }
+      bestTri = nextUnemitted;
+    }
+
+    const uint32_t* tri = &triVertices[bestTri * 3];
+    emitted[bestTri]    = true;
+    for(uint32_t k = 0; k < 3; k++)
+    {
+      uint32_t v = tri[k];
+      output.push_back(vertices[v]);
+
+      // move the triangle behind the vertex's remaining ones
+      uint32_t* adj = &adjacency[adjOffsets[v]];
+      for(uint32_t a = 0; a < remaining[v]; a++)
+      {
+        if(adj[a] == bestTri)
+        {
+          std::swap(adj[a], adj[remaining[v] - 1]);
+          break;
+        }
+      }
+      remaining[v]--;
+    }
+
+    // the triangle's vertices move to the front of the cache
+    newCache.assign(tri, tri + 3);
+    for(uint32_t v : cache)
+    {
+      if(v != tri[0] && v != tri[1] && v != tri[2])
+      {
+        newCache.push_back(v);
+      }
+    }
+    for(size_t i = VERTEX_CACHE_SIZE; i < newCache.size(); i++)
+    {
+      cachePos[newCache[i]]     = -1;
+      vertexScores[newCache[i]] = forsythVertexScore(-1, remaining[newCache[i]]);
+    }
+    newCache.resize(std::min(newCache.size(), size_t(VERTEX_CACHE_SIZE)));
+    std::swap(cache, newCache);
+
+    for(size_t i = 0; i < cache.size(); i++)
+    {
+      cachePos[cache[i]]     = int32_t(i);
+      vertexScores[cache[i]] = forsythVertexScore(int32_t(i), remaining[cache[i]]);
+    }
+
+    // only triangles touching the cache changed their score
+    bestTri         = ~0u;
+    float bestScore = -1.0f;
+    for(uint32_t v : cache)
+    {
+      const uint32_t* adj = &adjacency[adjOffsets[v]];
+      for(uint32_t a = 0; a < remaining[v]; a++)
+      {
+        uint32_t        t        = adj[a];
+        const uint32_t* triVerts = &triVertices[t * 3];
+        triScores[t]             = vertexScores[triVerts[0]] + vertexScores[triVerts[1]] + vertexScores[triVerts[2]];
+        if(triScores[t] > bestScore)
+        {
+          bestScore = triScores[t];
+          bestTri   = t;
+        }
+      }
+    }
+  }
+
+  memcpy(indices, output.data(), sizeof(uint32_t) * output.size());
+}
+
+// Orders the parts of a geometry so the ones facing outwards are drawn first and occlude
+// the inner ones, in the spirit of meshoptimizer's overdraw optimization, where the
+// sort key is the part's offset from the geometry's centroid along its average normal.
+static void sortPartsForOverdraw(const CSFGeometry* csfgeom, std::vector<uint32_t>& partOrder)
+{
+  uint32_t numParts = uint32_t(csfgeom->numParts);
+
+  std::vector<glm::vec3> centroids(numParts, glm::vec3(0));
+  std::vector<glm::vec3> normals(numParts, glm::vec3(0));
+  std::vector<float>     areas(numParts, 0.0f);
+  glm::vec3              centroid(0);
+  float                  area = 0;
+
+  const uint32_t* indices = csfgeom->indexSolid;
+  for(uint32_t p = 0; p < numParts; p++)
+  {
+    for(int i = 0; i < csfgeom->parts[p].numIndexSolid; i += 3)
+    {
+      glm::vec3 a = glm::make_vec3(&csfgeom->vertex[indices[i + 0] * 3]);
+      glm::vec3 b = glm::make_vec3(&csfgeom->vertex[indices[i + 1] * 3]);
+      glm::vec3 c = glm::make_vec3(&csfgeom->vertex[indices[i + 2] * 3]);
+
+      // the cross product's length is twice the area, weights centroids and normals alike
+      glm::vec3 n      = glm::cross(b - a, c - a);
+      float     weight = glm::length(n);
+      centroids[p] += (a + b + c) * (weight / 3.0f);
+      normals[p] += n;
+      areas[p] += weight;
+    }
+    centroid += centroids[p];
+    area += areas[p];
+    indices += csfgeom->parts[p].numIndexSolid;
+  }
+  if(area > 0)
+  {
+    centroid /= area;
+  }
+
+  std::vector<float> keys(numParts, 0.0f);
+  for(uint32_t p = 0; p < numParts; p++)
+  {
+    float normalLength = glm::length(normals[p]);
+    if(areas[p] > 0 && normalLength > 0)
+    {
+      keys[p] = glm::dot(centroids[p] / areas[p] - centroid, normals[p] / normalLength);
+    }
+  }
+
+  partOrder.resize(numParts);
+  for(uint32_t p = 0; p < numParts; p++)
+  {
+    partOrder[p] = p;
+  }
+  std::stable_sort(partOrder.begin(), partOrder.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+}
+
+// Reorders the parts of every geometry for overdraw and the triangles within each part
+// for the vertex cache. Parts stay contiguous, but their indices follow the new order,
+// the parts of the nodes are permuted accordingly.
+static void optimizeGeometries(CSFile* csf)
+{
+  std::vector<std::vector<uint32_t>> partOrders(csf->numGeometries);
+  std::vector<uint32_t>              indices;
+  std::vector<CSFGeometryPart>       parts;
+
+  for(int g = 0; g < csf->numGeometries; g++)
+  {
+    CSFGeometry*           csfgeom  = &csf->geometries[g];
+    std::vector<uint32_t>& order    = partOrders[g];
+    uint32_t               numParts = uint32_t(csfgeom->numParts);
+
+    sortPartsForOverdraw(csfgeom, order);
+
+    std::vector<size_t> partOffsets(numParts + 1, 0);
+    for(uint32_t p = 0; p < numParts; p++)
+    {
+      partOffsets[p + 1] = partOffsets[p] + csfgeom->parts[p].numIndexSolid;
+    }
+
+    indices.clear();
+    parts.resize(numParts);
+    for(uint32_t p = 0; p < numParts; p++)
+    {
+      const CSFGeometryPart& part = csfgeom->parts[order[p]];
+      indices.insert(indices.end(), csfgeom->indexSolid + partOffsets[order[p]],
+                     csfgeom->indexSolid + partOffsets[order[p]] + part.numIndexSolid);
+      parts[p] = part;
+    }
+    memcpy(csfgeom->parts, parts.data(), sizeof(CSFGeometryPart) * numParts);
+    memcpy(csfgeom->indexSolid, indices.data(), sizeof(uint32_t) * indices.size());
+
+    std::vector<int32_t> localIndex(csfgeom->numVertices, -1);
+    uint32_t*            partIndices = csfgeom->indexSolid;
+    for(uint32_t p = 0; p < numParts; p++)
+    {
+      optimizeVertexCache(partIndices, csfgeom->parts[p].numIndexSolid, localIndex);
+      partIndices += csfgeom->parts[p].numIndexSolid;
+    }
+  }
+
+  std::vector<CSFNodePart> nodeParts;
+  for(int n = 0; n < csf->numNodes; n++)
+  {
+    CSFNode* csfnode = &csf->nodes[n];
+    if(csfnode->geometryIDX < 0)
+      continue;
+
+    const std::vector<uint32_t>& order = partOrders[csfnode->geometryIDX];
+    assert(order.size() == size_t(csfnode->numParts));
+
+    nodeParts.resize(order.size());
+    for(size_t p = 0; p < order.size(); p++)
+    {
+      nodeParts[p] = csfnode->parts[order[p]];
+    }
+    memcpy(csfnode->parts, nodeParts.data(), sizeof(CSFNodePart) * nodeParts.size());
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// load-time level of detail generation
+
+// grid resolution across the bbox diagonal of the first coarser level, halved for each further level
+static const int LOD_GRID_RESOLUTION = 64;
+
+struct LodLevel
+{
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> partIndexCounts;
+};
+
+// Simplifies each part by vertex clustering, every vertex moves to the first vertex of the
+// part within the same grid cell. The triangles of a part only ever reference vertices of
+// that part, and vertices shared by several parts stay in place, so no edge is collapsed
+// across a part boundary and the per-part ids of the coarser levels stay exact.
+static void buildLods(const CSFGeometry* csfgeom, const CadScene::BBox& bbox, int numLods, bool optimize, std::vector<LodLevel>& levels)
+{
+  levels.clear();
+
+  glm::vec3 bboxMin  = glm::vec3(bbox.min);
+  float     diagonal = glm::length(glm::vec3(bbox.max) - bboxMin);
+  if(numLods < 2 || !csfgeom->numIndexSolid || !(diagonal > 0))
+  {
+    return;
+  }
+
+  uint32_t numParts    = uint32_t(csfgeom->numParts);
+  uint32_t numVertices = uint32_t(csfgeom->numVertices);
+
+  // -1 unused, -2 shared by several parts
+  std::vector<int32_t> vertexPart(numVertices, -1);
+  {
+    const uint32_t* indices = csfgeom->indexSolid;
+    for(uint32_t p = 0; p < numParts; p++)
+    {
+      for(int i = 0; i < csfgeom->parts[p].numIndexSolid; i++)
+      {
+        int32_t& part = vertexPart[indices[i]];
+        part          = part == -1 || part == int32_t(p) ? int32_t(p) : -2;
+      }
+      indices += csfgeom->parts[p].numIndexSolid;
+    }
+  }
+
+  std::unordered_map<uint32_t, uint32_t> cells;
+  std::vector<int32_t>                   localIndex(numVertices, -1);
+
+  const uint32_t*       prevIndices = csfgeom->indexSolid;
+  std::vector<uint32_t> prevCounts(numParts);
+  size_t                prevTotal = size_t(csfgeom->numIndexSolid);
+  for(uint32_t p = 0; p < numParts; p++)
+  {
+    prevCounts[p] = uint32_t(csfgeom->parts[p].numIndexSolid);
+  }
+
+  for(int l = 1; l < numLods; l++)
+  {
+    float cellSize = diagonal / float(LOD_GRID_RESOLUTION >> (l - 1));
+
+    auto clusterVertex = [&](uint32_t v) {
+      if(vertexPart[v] == -2)
+      {
+        return v;
+      }
+      glm::vec3 cell = (glm::make_vec3(&csfgeom->vertex[v * 3]) - bboxMin) / cellSize;
+      uint32_t  key  = 0;
+      for(int c = 0; c < 3; c++)
+      {
+        key |= uint32_t(std::min(1023.0f, std::max(0.0f, cell[c]))) << (c * 10);
+      }
+      return cells.insert({key, v}).first->second;
+    };
+
+    LodLevel level;
+    level.partIndexCounts.resize(numParts);
+    level.indices.reserve(prevTotal);
+
+    const uint32_t* partIndices = prevIndices;
+    for(uint32_t p = 0; p < numParts; p++)
+    {
+      size_t begin = level.indices.size();
+
+      cells.clear();
+      for(uint32_t i = 0; i + 2 < prevCounts[p]; i += 3)
+      {
+        uint32_t a = clusterVertex(partIndices[i + 0]);
+        uint32_t b = clusterVertex(partIndices[i + 1]);
+        uint32_t c = clusterVertex(partIndices[i + 2]);
+        if(a != b && b != c && c != a)
+        {
+          level.indices.push_back(a);
+          level.indices.push_back(b);
+          level.indices.push_back(c);
+        }
+      }
+
+      if(level.indices.size() == begin)
+      {
+        // keep small parts visible rather than dropping them entirely
+        level.indices.insert(level.indices.end(), partIndices, partIndices + prevCounts[p]);
+      }
+      else if(optimize)
+      {
+        optimizeVertexCache(level.indices.data() + begin, level.indices.size() - begin, localIndex);
+      }
+
+      level.partIndexCounts[p] = uint32_t(level.indices.size() - begin);
+      partIndices += prevCounts[p];
+    }
+
+    // further levels are not worth their memory once the reduction is small
+    if(level.indices.size() * 4 > prevTotal * 3)
+    {
+      break;
+    }
+
+    levels.push_back(std::move(level));
+    prevIndices = levels.back().indices.data();
+    prevCounts  = levels.back().partIndexCounts;
+    prevTotal   = levels.back().indices.size();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// load-time meshlet generation
+
+// Bounding sphere around the bbox center, and the cone of the triangle normals as in
+// meshoptimizer. The meshlet faces away from any viewpoint with
+// dot(center - viewPos, axis) >= cutoff * length(center - viewPos) + radius.
+static void computeMeshletBounds(const CadScene::Vertex*      vertices,
+                                 const std::vector<uint32_t>& meshletVertices,
+                                 const std::vector<uint32_t>& meshletTriangles,
+                                 CadScene::Meshlet&           meshlet)
+{
+  CadScene::BBox bbox;
+  for(uint32_t v : meshletVertices)
+  {
+    bbox.merge(glm::vec4(vertices[v].position, 1.0f));
+  }
+
+  glm::vec3 center = glm::vec3(bbox.min + bbox.max) * 0.5f;
+  float     radius = 0;
+  for(uint32_t v : meshletVertices)
+  {
+    radius = std::max(radius, glm::length(vertices[v].position - center));
+  }
+  meshlet.sphere = glm::vec4(center, radius);
+
+  std::vector<glm::vec3> normals;
+  normals.reserve(meshletTriangles.size());
+  glm::vec3 axis(0);
+  for(uint32_t packed : meshletTriangles)
+  {
+    glm::vec3 a = vertices[meshletVertices[(packed >> 0) & 0xFF]].position;
+    glm::vec3 b = vertices[meshletVertices[(packed >> 8) & 0xFF]].position;
+    glm::vec3 c = vertices[meshletVertices[(packed >> 16) & 0xFF]].position;
+
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    float     length = glm::length(normal);
+    if(length > 0)
+    {
+      normals.push_back(normal / length);
+      axis += normals.back();
+    }
+  }
+
+  float minDot = -1.0f;
+  if(glm::length(axis) > 0)
+  {
+    axis   = glm::normalize(axis);
+    minDot = 1.0f;
+    for(const glm::vec3& normal : normals)
+    {
+      minDot = std::min(minDot, glm::dot(axis, normal));
+    }
+  }
+
+  // the cutoff grows by the error of the 8-bit axis, 127 never culls
+  int8_t axis8[3];
+  float  axisError = 0;
+  for(int c = 0; c < 3; c++)
+  {
+    axis8[c] = int8_t(std::min(127.0f, std::max(-127.0f, roundf(axis[c] * 127.0f))));
+    axisError += fabsf(float(axis8[c]) / 127.0f - axis[c]);
+  }
+  int cutoff8 = 127;
+  if(minDot > 0.1f)
+  {
+    cutoff8 = std::min(127, int(127.0f * (sqrtf(1.0f - minDot * minDot) + axisError) + 1.0f));
+  }
+
+  meshlet.cone = uint32_t(uint8_t(axis8[0])) | (uint32_t(uint8_t(axis8[1])) << 8) | (uint32_t(uint8_t(axis8[2])) << 16)
+                 | (uint32_t(cutoff8) << 24);
+}
+
+// Greedily fills meshlets with the triangles of each part in index order, a new meshlet
+// starts once the vertex or triangle limit is hit, or at the next part. The triangle
+// order of an optimized geometry is kept, it is already vertex cache friendly.
+static void buildMeshlets(CadScene::Geometry& geom, std::vector<CadScene::Meshlet>& meshlets, std::vector<uint32_t>& meshletIndices)
+{
+  meshlets.clear();
+  meshletIndices.clear();
+
+  const uint8_t         UNUSED = 0xFF;
+  std::vector<uint8_t>  localIndex(geom.numVertices, UNUSED);
+  std::vector<uint32_t> vertices;
+  std::vector<uint32_t> triangles;
+
+  auto emitMeshlet = [&](uint32_t partIndex) {
+    if(triangles.empty())
+    {
+      return;
+    }
+
+    CadScene::Meshlet meshlet;
+    meshlet.dataOffset   = uint32_t(meshletIndices.size());
+    meshlet.numVertices  = uint16_t(vertices.size());
+    meshlet.numTriangles = uint16_t(triangles.size());
+    meshlet.partIndex    = partIndex;
+    computeMeshletBounds(geom.vboData, vertices, triangles, meshlet);
+    meshlets.push_back(meshlet);
+
+    meshletIndices.insert(meshletIndices.end(), vertices.begin(), vertices.end());
+    meshletIndices.insert(meshletIndices.end(), triangles.begin(), triangles.end());
+
+    for(uint32_t v : vertices)
+    {
+      localIndex[v] = UNUSED;
+    }
+    vertices.clear();
+    triangles.clear();
+  };
+
+  for(size_t p = 0; p < geom.parts.size(); p++)
+  {
+    CadScene::GeometryPart& part    = geom.parts[p];
+    const uint32_t*         indices = geom.iboData + part.indexSolid.offset / sizeof(uint32_t);
+
+    part.meshletOffset = uint32_t(meshlets.size());
+    for(int i = 0; i + 2 < part.indexSolid.count; i += 3)
+    {
+      uint32_t newVertices = 0;
+      for(int k = 0; k < 3; k++)
+      {
+        newVertices += localIndex[indices[i + k]] == UNUSED ? 1 : 0;
+      }
+      if(vertices.size() + newVertices > CadScene::MESHLET_MAX_VERTICES || triangles.size() == CadScene::MESHLET_MAX_TRIANGLES)
+      {
+        emitMeshlet(uint32_t(p));
+      }
+
+      uint32_t packed = 0;
+      for(int k = 0; k < 3; k++)
+      {
+        uint32_t v = indices[i + k];
+        if(localIndex[v] == UNUSED)
+        {
+          localIndex[v] = uint8_t(vertices.size());
+          vertices.push_back(v);
+        }
+        packed |= uint32_t(localIndex[v]) << (k * 8);
+      }
+      triangles.push_back(packed);
+    }
+    // never across the part boundary
+    emitMeshlet(uint32_t(p));
+    part.meshletCount = uint32_t(meshlets.size()) - part.meshletOffset;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+static float computeACMR(const CSFile* csf)
+{
+  size_t misses    = 0;
+  size_t triangles = 0;
+  for(int g = 0; g < csf->numGeometries; g++)
+  {
+    const CSFGeometry* csfgeom = &csf->geometries[g];
+    misses += countCacheMisses(csfgeom->indexSolid, csfgeom->numIndexSolid, csfgeom->numVertices);
+    triangles += csfgeom->numIndexSolid / 3;
+  }
+  return triangles ? float(misses) / float(triangles) : 0.0f;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis, bool instancedCopies, bool optimize, bool quantize, bool deduplicate, int lods, bool meshlets, bool splitVertices)
 {
   CSFile*         csf;
   CSFileMemoryPTR mem = CSFileMemory_new();
@@ -115,9 +962,43 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
   }
 
   int copies = clones + 1;
+  // instanced copies share geometry, nodes and objects, only the shift differs
+  int sceneCopies = instancedCopies ? 1 : copies;
 
   CSFile_transform(csf);
 
+  m_weldedVertices   = 0;
+  m_mergedGeometries = 0;
+  m_dedupSavedSize   = 0;
+  if(deduplicate)
+  {
+    deduplicateGeometries(csf, m_weldedVertices, m_mergedGeometries, m_dedupSavedSize);
+  }
+
+  // before the cache statistics, the split vertices are part of the cost
+  std::vector<std::vector<float>> splitStorage;
+  m_splitVertices = 0;
+  m_numVertices   = 0;
+  if(splitVertices)
+  {
+    for(int g = 0; g < csf->numGeometries; g++)
+    {
+      m_splitVertices += splitPartVertices(&csf->geometries[g], splitStorage);
+    }
+  }
+  for(int g = 0; g < csf->numGeometries; g++)
+  {
+    m_numVertices += uint32_t(csf->geometries[g].numVertices);
+  }
+
+  m_acmrOriginal  = computeACMR(csf);
+  m_acmrOptimized = m_acmrOriginal;
+  if(optimize)
+  {
+    optimizeGeometries(csf);
+    m_acmrOptimized = computeACMR(csf);
+  }
+
   srand(234525);
 
 
@@ -140,10 +1021,30 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
 
   // geometry
   int numGeoms = csf->numGeometries;
-  m_geometry.resize(csf->numGeometries * copies);
-  m_geometryBboxes.resize(csf->numGeometries * copies);
+  m_geometry.resize(csf->numGeometries * sceneCopies);
+  m_geometryBboxes.resize(csf->numGeometries * sceneCopies);
   m_trianglePartIdsSize = 0;
   m_partTriCountsSize   = 0;
+  m_indexSize           = 0;
+  m_indexSavedSize      = 0;
+  m_vertexSize          = 0;
+  m_lodIndexSize        = 0;
+  m_numLods             = 1;
+  m_numMeshlets         = 0;
+  m_meshletSize         = 0;
+  m_vertexPartIdsSize   = 0;
+  m_geometryReleased    = false;
+
+  std::vector<LodLevel> lodLevels;
+  std::vector<Meshlet>  meshletList;
+  std::vector<uint32_t> meshletIndices;
+  size_t                meshletVertices  = 0;
+  size_t                meshletTriangles = 0;
+
+  m_quantizedVertices         = quantize;
+  m_vertexStride              = quantize ? sizeof(VertexQuantized) : sizeof(Vertex);
+  m_quantizationErrorMax      = 0;
+  m_quantizationErrorRelative = 0;
 
   for(int n = 0; n < csf->numGeometries; n++)
   {
@@ -154,7 +1055,12 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
     geom.numVertices   = csfgeom->numVertices;
     geom.numIndexSolid = csfgeom->numIndexSolid;
 
-    Vertex* vertices = new Vertex[csfgeom->numVertices];
+    Vertex*                vertices = new Vertex[csfgeom->numVertices];
+    std::vector<glm::vec3> octNormals8;
+    if(quantize)
+    {
+      octNormals8.resize(csfgeom->numVertices);
+    }
     for(uint32_t i = 0; i < uint32_t(csfgeom->numVertices); i++)
     {
       vertices[i].position[0] = csfgeom->vertex[3 * i + 0];
@@ -176,6 +1082,10 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
       glm::vec3 packed       = float32x3_to_octn_precise(normal, 16);
       vertices[i].normalOctX = std::min(32767, std::max(-32767, int32_t(packed.x * 32767.0f)));
       vertices[i].normalOctY = std::min(32767, std::max(-32767, int32_t(packed.y * 32767.0f)));
+      if(quantize)
+      {
+        octNormals8[i] = float32x3_to_octn_precise(normal, 8);
+      }
 
       m_geometryBboxes[n].merge(glm::vec4(vertices[i].position, 1.f));
     }
@@ -183,50 +1093,174 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
     geom.vboData = vertices;
     geom.vboSize = sizeof(Vertex) * csfgeom->numVertices;
 
+    geom.vboQuantizedData = nullptr;
+    geom.vboQuantizedSize = 0;
+    if(quantize)
+    {
+      // positions become unorm16 within the bbox, the matrices dequantize them
+      glm::vec3 bboxMin  = glm::vec3(m_geometryBboxes[n].min);
+      glm::vec3 bboxSize = glm::vec3(m_geometryBboxes[n].max) - bboxMin;
+      float     diagonal = glm::length(bboxSize);
+
+      VertexQuantized* quantized = new VertexQuantized[csfgeom->numVertices];
+      for(uint32_t i = 0; i < uint32_t(csfgeom->numVertices); i++)
+      {
+        glm::vec3 dequantized;
+        for(int c = 0; c < 3; c++)
+        {
+          float unorm = bboxSize[c] > 0 ? (vertices[i].position[c] - bboxMin[c]) / bboxSize[c] : 0.0f;
+          quantized[i].position[c] = uint16_t(std::min(65535.0f, std::max(0.0f, roundf(unorm * 65535.0f))));
+          dequantized[c]           = bboxMin[c] + (float(quantized[i].position[c]) / 65535.0f) * bboxSize[c];
+        }
+        quantized[i].normalOctX = int8_t(std::min(127, std::max(-127, int32_t(octNormals8[i].x * 127.0f))));
+        quantized[i].normalOctY = int8_t(std::min(127, std::max(-127, int32_t(octNormals8[i].y * 127.0f))));
+
+        float error            = glm::length(dequantized - vertices[i].position);
+        m_quantizationErrorMax = std::max(m_quantizationErrorMax, error);
+        if(diagonal > 0)
+        {
+          m_quantizationErrorRelative = std::max(m_quantizationErrorRelative, error / diagonal);
+        }
+      }
+
+      geom.vboQuantizedData = quantized;
+      geom.vboQuantizedSize = sizeof(VertexQuantized) * csfgeom->numVertices;
+    }
+    m_vertexSize += geom.vboQuantizedData ? geom.vboQuantizedSize : geom.vboSize;
+
 
-    uint32_t* indices = new uint32_t[csfgeom->numIndexSolid];
+    buildLods(csfgeom, m_geometryBboxes[n], std::min(lods, int(MAX_LODS)), optimize, lodLevels);
+    m_numLods = std::max(m_numLods, int(lodLevels.size()) + 1);
+
+    // the coarser levels follow the full detail in all index and id streams
+    uint32_t numLevels  = uint32_t(lodLevels.size()) + 1;
+    size_t   numIndices = size_t(csfgeom->numIndexSolid);
+    for(const LodLevel& level : lodLevels)
+    {
+      numIndices += level.indices.size();
+    }
+
+    uint32_t* indices = new uint32_t[numIndices];
     memcpy(&indices[0], csfgeom->indexSolid, sizeof(unsigned int) * csfgeom->numIndexSolid);
+    {
+      size_t offset = size_t(csfgeom->numIndexSolid);
+      for(const LodLevel& level : lodLevels)
+      {
+        memcpy(&indices[offset], level.indices.data(), sizeof(uint32_t) * level.indices.size());
+        offset += level.indices.size();
+      }
+    }
 
     geom.iboData = indices;
-    geom.iboSize = sizeof(uint32_t) * (csfgeom->numIndexSolid);
+    geom.iboSize = sizeof(uint32_t) * numIndices;
+
+    geom.ibo16Data = nullptr;
+    geom.ibo16Size = 0;
+    if(csfgeom->numVertices <= MAX_INDEX16_VERTICES)
+    {
+      uint16_t* indices16 = new uint16_t[numIndices];
+      for(size_t i = 0; i < numIndices; i++)
+      {
+        indices16[i] = uint16_t(indices[i]);
+      }
+      geom.ibo16Data = indices16;
+      geom.ibo16Size = sizeof(uint16_t) * numIndices;
+
+      m_indexSavedSize += geom.iboSize - geom.ibo16Size;
+    }
+    m_indexSize += geom.ibo16Data ? geom.ibo16Size : geom.iboSize;
+    m_lodIndexSize += (numIndices - csfgeom->numIndexSolid) * (geom.ibo16Data ? sizeof(uint16_t) : sizeof(uint32_t));
 
-    geom.trianglePartIdsData = new uint32_t[csfgeom->numIndexSolid / 3];
-    geom.trianglePartIdsSize = sizeof(uint32_t) * (csfgeom->numIndexSolid / 3);
+    // the per-triangle ids are expanded from the counts and offsets on the device
+    geom.trianglePartIdsSize = sizeof(uint32_t) * (numIndices / 3);
 
-    geom.partTriCountsData = new uint32_t[csfgeom->numParts];
-    geom.partTriCountsSize = sizeof(uint32_t) * (csfgeom->numParts);
+    geom.partTriCountsData = new uint32_t[csfgeom->numParts * numLevels];
+    geom.partTriCountsSize = sizeof(uint32_t) * (csfgeom->numParts * numLevels);
 
-    geom.partTriOffsetsData = new uint32_t[csfgeom->numParts];
-    geom.partTriOffsetsSize = sizeof(uint32_t) * (csfgeom->numParts);
+    geom.partTriOffsetsData = new uint32_t[csfgeom->numParts * numLevels];
+    geom.partTriOffsetsSize = sizeof(uint32_t) * (csfgeom->numParts * numLevels);
 
     m_trianglePartIdsSize += geom.trianglePartIdsSize;
     m_partTriCountsSize += geom.partTriCountsSize;
 
-    geom.parts.resize(csfgeom->numParts);
+    geom.lods.resize(lodLevels.size());
 
-    size_t   offsetSolid = 0;
-    uint32_t offsetIds   = 0;
-    for(uint32_t p = 0; p < uint32_t(csfgeom->numParts); p++)
+    size_t offsetSolid = 0;
+    for(uint32_t l = 0; l < numLevels; l++)
     {
-      geom.parts[p].indexSolid.count  = csfgeom->parts[p].numIndexSolid;
-      geom.parts[p].indexSolid.offset = offsetSolid;
+      std::vector<GeometryPart>& parts          = l ? geom.lods[l - 1].parts : geom.parts;
+      uint32_t*                  partTriCounts  = geom.partTriCountsData + csfgeom->numParts * l;
+      uint32_t*                  partTriOffsets = geom.partTriOffsetsData + csfgeom->numParts * l;
 
-      geom.partTriCountsData[p] = csfgeom->parts[p].numIndexSolid / 3;
+      parts.resize(csfgeom->numParts);
+      for(uint32_t p = 0; p < uint32_t(csfgeom->numParts); p++)
+      {
+        int numIndexSolid = l ? int(lodLevels[l - 1].partIndexCounts[p]) : csfgeom->parts[p].numIndexSolid;
 
-      // Prefix sum of geom.partTriCountsData
-      geom.partTriOffsetsData[p] = p > 0 ? geom.partTriOffsetsData[p - 1] + geom.partTriCountsData[p - 1] : 0;
+        parts[p].indexSolid.count  = numIndexSolid;
+        parts[p].indexSolid.offset = offsetSolid;
 
-      offsetSolid += csfgeom->parts[p].numIndexSolid * sizeof(uint32_t);
+        partTriCounts[p] = numIndexSolid / 3;
 
-      for(uint32_t i = 0; i < uint32_t(csfgeom->parts[p].numIndexSolid / 3); i++)
+        // Prefix sum of partTriCounts, relative to the level
+        partTriOffsets[p] = p > 0 ? partTriOffsets[p - 1] + partTriCounts[p - 1] : 0;
+
+        offsetSolid += numIndexSolid * sizeof(uint32_t);
+      }
+    }
+
+    geom.vertexPartIdsData = nullptr;
+    geom.vertexPartIdsSize = 0;
+    if(splitVertices)
+    {
+      // every vertex belongs to a single part, the coarser levels only reference
+      // vertices of the same part, so the full detail defines all of them
+      geom.vertexPartIdsData = new uint32_t[csfgeom->numVertices];
+      geom.vertexPartIdsSize = sizeof(uint32_t) * csfgeom->numVertices;
+      memset(geom.vertexPartIdsData, 0, geom.vertexPartIdsSize);
+
+      const uint32_t* partIndices = csfgeom->indexSolid;
+      for(uint32_t p = 0; p < uint32_t(csfgeom->numParts); p++)
       {
-        geom.trianglePartIdsData[i + offsetIds] = p;
+        for(int i = 0; i < csfgeom->parts[p].numIndexSolid; i++)
+        {
+          geom.vertexPartIdsData[partIndices[i]] = p;
+        }
+        partIndices += csfgeom->parts[p].numIndexSolid;
       }
 
-      offsetIds += csfgeom->parts[p].numIndexSolid / 3;
+      m_vertexPartIdsSize += geom.vertexPartIdsSize;
+    }
+
+    geom.meshletsData       = nullptr;
+    geom.meshletsSize       = 0;
+    geom.meshletIndicesData = nullptr;
+    geom.meshletIndicesSize = 0;
+    if(meshlets)
+    {
+      buildMeshlets(geom, meshletList, meshletIndices);
+
+      geom.meshletsData = new Meshlet[meshletList.size()];
+      geom.meshletsSize = sizeof(Meshlet) * meshletList.size();
+      memcpy(geom.meshletsData, meshletList.data(), geom.meshletsSize);
+
+      geom.meshletIndicesData = new uint32_t[meshletIndices.size()];
+      geom.meshletIndicesSize = sizeof(uint32_t) * meshletIndices.size();
+      memcpy(geom.meshletIndicesData, meshletIndices.data(), geom.meshletIndicesSize);
+
+      m_numMeshlets += uint32_t(meshletList.size());
+      m_meshletSize += geom.meshletsSize + geom.meshletIndicesSize;
+      for(const Meshlet& meshlet : meshletList)
+      {
+        meshletVertices += meshlet.numVertices;
+        meshletTriangles += meshlet.numTriangles;
+      }
     }
   }
-  for(int c = 1; c <= clones; c++)
+  m_meshletVertexFill   = m_numMeshlets ? float(meshletVertices) / float(size_t(m_numMeshlets) * MESHLET_MAX_VERTICES) : 0.0f;
+  m_meshletTriangleFill = m_numMeshlets ? float(meshletTriangles) / float(size_t(m_numMeshlets) * MESHLET_MAX_TRIANGLES) : 0.0f;
+
+  for(int c = 1; c < sceneCopies; c++)
   {
     for(int n = 0; n < numGeoms; n++)
     {
@@ -243,7 +1277,7 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
 
   // nodes
   int numObjects = 0;
-  m_matrices.resize(csf->numNodes * copies);
+  m_matrices.resize(csf->numNodes * sceneCopies);
 
   for(int n = 0; n < csf->numNodes; n++)
   {
@@ -260,7 +1294,7 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
 
 
   // objects
-  m_objects.resize(numObjects * copies);
+  m_objects.resize(numObjects * sceneCopies);
   numObjects       = 0;
   m_numObjectParts = 0;
   for(int n = 0; n < csf->numNodes; n++)
@@ -330,6 +1364,12 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
       break;
   }
 
+  m_copies.resize(instancedCopies ? copies : 1);
+  for(size_t c = 0; c < m_copies.size(); c++)
+  {
+    m_copies[c].shift      = glm::vec3(0);
+    m_copies[c].partOffset = uint32_t(c) * m_numObjectParts;
+  }
 
   for(int c = 1; c <= clones; c++)
   {
@@ -394,6 +1434,12 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
 
     shift.w = 0;
 
+    if(instancedCopies)
+    {
+      m_copies[c].shift = glm::vec3(shift);
+      continue;
+    }
+
     // move all world matrices
     for(int n = 0; n < numNodes; n++)
     {
@@ -421,104 +1467,144 @@ bool CadScene::loadCSF(const char* filename, int clones, int cloneaxis)
     }
   }
 
+  // every clone has its own range of unique part indices
+  m_numObjectParts *= copies;
+
+  m_numNodeMatrices = uint32_t(m_matrices.size());
+  if(quantize)
+  {
+    // Each part gets a matrix with the dequantization of its geometry folded in. Parts of
+    // the same geometry and node share it. The original matrices stay in place for the
+    // clone indexing and the objects' matrixIndex, only the normals keep using their
+    // inverse transpose, as they are not quantized.
+    std::map<std::pair<int, int>, int> dequantMatrices;
+    for(size_t o = 0; o < m_objects.size(); o++)
+    {
+      Object& object = m_objects[o];
+      for(size_t i = 0; i < object.parts.size(); i++)
+      {
+        ObjectPart&         part = object.parts[i];
+        std::pair<int, int> key(part.matrixIndex, object.geometryIndex);
+
+        auto it = dequantMatrices.find(key);
+        if(it == dequantMatrices.end())
+        {
+          const BBox& bbox    = m_geometryBboxes[object.geometryIndex];
+          glm::mat4   dequant = glm::translate(glm::mat4(1), glm::vec3(bbox.min))
+                              * glm::scale(glm::mat4(1), glm::vec3(bbox.max - bbox.min));
+
+          MatrixNode node  = m_matrices[part.matrixIndex];
+          node.worldMatrix = node.worldMatrix * dequant;
+
+          it = dequantMatrices.insert({key, int(m_matrices.size())}).first;
+          m_matrices.push_back(node);
+          m_dequantNodes.push_back(uint32_t(part.matrixIndex));
+        }
+        part.matrixIndex = it->second;
+      }
+    }
+  }
+
   CSFileMemory_delete(mem);
   return true;
 }
 
 
-struct ListItem
+static void fillCache(CadScene::DrawRangeCache& cache, const CadScene::Object& obj, const CadScene::Geometry& geo)
 {
-  CadScene::DrawStateInfo state;
+  uint32_t maxCombine      = cache.maxCombine ? cache.maxCombine : 1;
+  bool     ignoreMaterials = cache.maxCombine ? cache.ignoreMaterials : false;
+
+  CadScene::DrawStateInfo state = {-1, -1};
   CadScene::DrawRange     range;
-  uint32_t                partIndex;
-};
+  uint32_t                partIndex = 0;
+  uint32_t                partCount = 0;
 
-static bool ListItem_compare(const ListItem& a, const ListItem& b)
-{
-  int diff = 0;
-  diff     = diff != 0 ? diff : (a.state.materialIndex - b.state.materialIndex);
-  diff     = diff != 0 ? diff : (a.state.matrixIndex - b.state.matrixIndex);
-  diff     = diff != 0 ? diff : int(a.range.offset - b.range.offset);
+  auto pushRange = [&]() {
+    if(!range.count)
+      return;
 
-  return diff < 0;
-}
+    if(cache.state.size() == cache.objectFirstState.back() || cache.state.back() != state)
+    {
+      cache.state.push_back(state);
+      cache.stateCount.push_back(0);
+    }
+    cache.stateCount.back()++;
+    cache.offsets.push_back(range.offset);
+    cache.counts.push_back(range.count);
+    cache.firstPart.push_back(partIndex);
+    cache.partCounts.push_back(partCount);
+  };
+
+  for(size_t p = 0; p < obj.parts.size(); p++)
+  {
+    const CadScene::ObjectPart&   part = obj.parts[p];
+    const CadScene::GeometryPart& mesh = geo.parts[p];
 
-static void fillCache(CadScene::DrawRangeCache& cache, const std::vector<ListItem>& list)
-{
-  cache = CadScene::DrawRangeCache();
+    if(!part.active)
+      continue;
 
-  if(!list.size())
-    return;
+    CadScene::DrawStateInfo partState = {ignoreMaterials ? 0 : part.materialIndex, part.matrixIndex};
 
-  CadScene::DrawStateInfo state = list[0].state;
-  CadScene::DrawRange     range = list[0].range;
+    // finish old, start new
+    if(partState != state || range.offset + range.count * sizeof(uint32_t) != mesh.indexSolid.offset || partCount == maxCombine)
+    {
+      pushRange();
 
-  int stateCount = 0;
+      state        = partState;
+      range.offset = mesh.indexSolid.offset;
+      range.count  = 0;
+      partIndex    = uint32_t(p);
+      partCount    = 0;
+    }
 
-  uint32_t partIndex = 0;
-  uint32_t partCount = 0;
+    range.count += mesh.indexSolid.count;
+    partCount += 1;
+  }
 
-  for(size_t i = 1; i < list.size() + 1; i++)
-  {
-    bool newrange = false;
-    if(i == list.size() || list[i].state != state)
-    {
-      // push range
-      if(range.count)
-      {
-        stateCount++;
-        cache.offsets.push_back(range.offset);
-        cache.counts.push_back(range.count);
-        cache.firstPart.push_back(partIndex);
-        cache.partCounts.push_back(partCount);
-      }
+  pushRange();
+}
 
-      // emit
-      if(stateCount)
-      {
-        cache.state.push_back(state);
-        cache.stateCount.push_back(stateCount);
-      }
 
-      stateCount = 0;
+void CadScene::buildDrawRangeCaches(uint32_t searchBatch, bool ignoreMaterials)
+{
+  uint32_t maxCombines[NUM_DRAW_RANGE_CACHES] = {0, ~0u, searchBatch, MAX_SEARCH_PARTS};
 
-      if(i == list.size())
-      {
-        break;
-      }
-      else
-      {
-        state        = list[i].state;
-        range.offset = list[i].range.offset;
-        range.count  = 0;
-        partIndex    = list[i].partIndex;
-        partCount    = 0;
-        newrange     = true;
-      }
-    }
+  for(int c = 0; c < NUM_DRAW_RANGE_CACHES; c++)
+  {
+    DrawRangeCache& cache = m_drawRangeCaches[c];
+    cache                 = DrawRangeCache();
+    cache.maxCombine      = maxCombines[c];
+    cache.ignoreMaterials = ignoreMaterials;
+
+    cache.objectFirstState.reserve(m_objects.size() + 1);
+    cache.objectFirstRange.reserve(m_objects.size() + 1);
+    cache.objectFirstState.push_back(0);
+    cache.objectFirstRange.push_back(0);
 
-    const CadScene::DrawRange& currange = list[i].range;
-    if(newrange || (USE_CACHECOMBINE && currange.offset == (range.offset + sizeof(unsigned int) * range.count)))
+    for(size_t i = 0; i < m_objects.size(); i++)
     {
-      // merge
-      range.count += currange.count;
-      partCount += 1;
+      fillCache(cache, m_objects[i], m_geometry[m_objects[i].geometryIndex]);
+
+      cache.objectFirstState.push_back(uint32_t(cache.state.size()));
+      cache.objectFirstRange.push_back(uint32_t(cache.offsets.size()));
     }
-    else
-    {
-      // push
-      if(range.count)
-      {
-        stateCount++;
-        cache.offsets.push_back(range.offset);
-        cache.counts.push_back(range.count);
-        cache.firstPart.push_back(partIndex);
-        cache.partCounts.push_back(partCount);
-      }
+  }
+}
 
-      range = currange;
+const CadScene::DrawRangeCache* CadScene::findDrawRangeCache(uint32_t maxCombine, bool ignoreMaterials) const
+{
+  for(int c = 0; c < NUM_DRAW_RANGE_CACHES; c++)
+  {
+    const DrawRangeCache& cache = m_drawRangeCaches[c];
+    // individual parts never ignore materials
+    if(cache.objectFirstRange.size() == m_objects.size() + 1 && cache.maxCombine == maxCombine
+       && (!maxCombine || cache.ignoreMaterials == ignoreMaterials))
+    {
+      return &cache;
     }
   }
+  return nullptr;
 }
 
 
@@ -534,15 +1620,76 @@ void CadScene::unload()
       continue;
 
     delete[] m_geometry[i].vboData;
+    delete[] m_geometry[i].vboQuantizedData;
     delete[] m_geometry[i].iboData;
-    delete[] m_geometry[i].trianglePartIdsData;
+    delete[] m_geometry[i].ibo16Data;
     delete[] m_geometry[i].partTriCountsData;
     delete[] m_geometry[i].partTriOffsetsData;
+    delete[] m_geometry[i].meshletsData;
+    delete[] m_geometry[i].meshletIndicesData;
+    delete[] m_geometry[i].vertexPartIdsData;
   }
 
   m_matrices.clear();
+  m_dequantNodes.clear();
   m_geometryBboxes.clear();
   m_geometry.clear();
   m_objects.clear();
+  m_copies.clear();
   m_geometryBboxes.clear();
+
+  for(int c = 0; c < NUM_DRAW_RANGE_CACHES; c++)
+  {
+    m_drawRangeCaches[c] = DrawRangeCache();
+  }
+}
+
+
+size_t CadScene::releaseGeometryData()
+{
+  size_t released = 0;
+
+  for(size_t i = 0; i < m_geometry.size(); i++)
+  {
+    Geometry& geom = m_geometry[i];
+
+    // clones share the data of their original
+    if(geom.cloneIdx < 0)
+    {
+      released += geom.vboData ? geom.vboSize : 0;
+      released += geom.vboQuantizedData ? geom.vboQuantizedSize : 0;
+      released += geom.iboData ? geom.iboSize : 0;
+      released += geom.ibo16Data ? geom.ibo16Size : 0;
+      released += geom.partTriCountsData ? geom.partTriCountsSize : 0;
+      released += geom.partTriOffsetsData ? geom.partTriOffsetsSize : 0;
+      released += geom.meshletsData ? geom.meshletsSize : 0;
+      released += geom.meshletIndicesData ? geom.meshletIndicesSize : 0;
+      released += geom.vertexPartIdsData ? geom.vertexPartIdsSize : 0;
+
+      delete[] geom.vboData;
+      delete[] geom.vboQuantizedData;
+      delete[] geom.iboData;
+      delete[] geom.ibo16Data;
+      delete[] geom.partTriCountsData;
+      delete[] geom.partTriOffsetsData;
+      delete[] geom.meshletsData;
+      delete[] geom.meshletIndicesData;
+      delete[] geom.vertexPartIdsData;
+    }
+
+    // the sizes stay valid, e.g. ibo16Size still tells if the device uses 16-bit indices
+    geom.vboData            = nullptr;
+    geom.vboQuantizedData   = nullptr;
+    geom.iboData            = nullptr;
+    geom.ibo16Data          = nullptr;
+    geom.partTriCountsData  = nullptr;
+    geom.partTriOffsetsData = nullptr;
+    geom.meshletsData       = nullptr;
+    geom.meshletIndicesData = nullptr;
+    geom.vertexPartIdsData  = nullptr;
+  }
+
+  m_geometryReleased = true;
+
+  return released;
 }
@@ -110,6 +110,13 @@ public:
     glm::mat4 worldMatrixIT;
   };
 
+  // must match CopyData
+  struct Copy
+  {
+    glm::vec3 shift;
+    uint32_t  partOffset;  // added to the unique part index
+  };
+
   struct Vertex
   {
     glm::vec3 position;
@@ -117,6 +124,26 @@ public:
     uint16_t      normalOctY;
   };
 
+  // must match vertices_in with USE_QUANTIZED_VERTICES, unorm position within the
+  // geometry's bbox, the dequantization is part of the parts' matrices
+  struct VertexQuantized
+  {
+    uint16_t position[3];
+    int8_t   normalOctX;
+    int8_t   normalOctY;
+  };
+
+  // must match MeshletDesc, a meshlet never crosses a part boundary
+  struct Meshlet
+  {
+    glm::vec4 sphere;        // bounding sphere in object space
+    uint32_t  dataOffset;    // into meshletIndicesData, the vertex indices followed by the triangles
+    uint16_t  numVertices;   // at most MESHLET_MAX_VERTICES
+    uint16_t  numTriangles;  // at most MESHLET_MAX_TRIANGLES
+    uint32_t  partIndex;
+    uint32_t  cone;  // snorm8 axis in xyz and cutoff in w, of the triangle normals in object space
+  };
+
   struct DrawRange
   {
     size_t offset;
@@ -145,6 +172,8 @@ public:
     }
   };
 
+  // the draw ranges of all objects for one way of combining parts, see buildDrawRangeCaches.
+  // Every state covers stateCount consecutive ranges.
   struct DrawRangeCache
   {
     std::vector<DrawStateInfo> state;
@@ -154,35 +183,84 @@ public:
     std::vector<uint32_t> partCounts;
     std::vector<size_t>   offsets;
     std::vector<int>      counts;
+
+    // per object plus one past the last, the object's first state and first range
+    std::vector<uint32_t> objectFirstState;
+    std::vector<uint32_t> objectFirstRange;
+
+    uint32_t maxCombine      = 0;  // 0 draws every part on its own
+    bool     ignoreMaterials = false;
+  };
+
+  enum DrawRangeCacheType
+  {
+    DRAW_RANGE_INDIVIDUAL,  // maxCombine 0
+    DRAW_RANGE_COMBINED,    // unlimited maxCombine
+    DRAW_RANGE_BATCH,       // maxCombine of the search batch
+    DRAW_RANGE_SEARCH,      // MAX_SEARCH_PARTS
+    NUM_DRAW_RANGE_CACHES,
   };
 
   struct GeometryPart
   {
     DrawRange indexSolid;
+
+    // only set for the full detail
+    uint32_t meshletOffset = 0;
+    uint32_t meshletCount  = 0;
+  };
+
+  // a coarser level of detail, its ranges follow the ones of the previous level in the same
+  // index buffer, and its triangle ids, part triangle counts and offsets follow as well
+  struct GeometryLod
+  {
+    std::vector<GeometryPart> parts;
   };
 
   struct Geometry
   {
     int    cloneIdx;
     size_t vboSize;
+    size_t vboQuantizedSize;
     size_t iboSize;
-    size_t trianglePartIdsSize;
+    size_t ibo16Size;
+    size_t trianglePartIdsSize;  // device only, see partTriCountsData
     size_t partTriCountsSize;
     size_t partTriOffsetsSize;
+    size_t meshletsSize;
+    size_t meshletIndicesSize;
+    size_t vertexPartIdsSize;
 
-    Vertex*   vboData;
+    Vertex*          vboData;
+    VertexQuantized* vboQuantizedData;  // replaces vboData on the device if the scene is quantized
     uint32_t* iboData;
-    uint32_t* trianglePartIdsData;
-    uint32_t* partTriCountsData;   // Per-part triangle count
+    uint16_t* ibo16Data;  // same indices, only for geometries with at most MAX_INDEX16_VERTICES
+    uint32_t* partTriCountsData;   // Per-part triangle count, expanded to the per-triangle part ids on the device
     uint32_t* partTriOffsetsData;  // Per-part triangle range start, i.e. first triangle index for each part
+    Meshlet*  meshletsData;        // only if the scene has meshlets, ordered by part
+    uint32_t* meshletIndicesData;  // per meshlet the vertex indices, then 3 x 8-bit local indices per triangle
+    uint32_t* vertexPartIdsData;   // only if the scene has split part vertices, the part index per vertex
 
     std::vector<GeometryPart> parts;
+    std::vector<GeometryLod>  lods;  // levels 1 and up, all levels share the vertices
 
     int numVertices;
     int numIndexSolid;
     int numIdsSolid;
+
+    const std::vector<GeometryPart>& getLodParts(int lod) const { return lod ? lods[lod - 1].parts : parts; }
   };
 
+  // geometries with up to this many vertices use 16-bit indices on the device
+  static const int MAX_INDEX16_VERTICES = 65536;
+  // levels of detail including the full detail one
+  static const int MAX_LODS = 4;
+  // must match MESHLET_MAX_VERTICES and MESHLET_MAX_TRIANGLES
+  static const uint32_t MESHLET_MAX_VERTICES  = 64;
+  static const uint32_t MESHLET_MAX_TRIANGLES = 126;
+  // most parts combined into one draw by the part search modes, their part count has 16 bits
+  static const uint32_t MAX_SEARCH_PARTS = 0xFFFF;
+
   struct ObjectPart
   {
     int active;
@@ -205,16 +283,87 @@ public:
   std::vector<Geometry>      m_geometry;
   std::vector<MatrixNode>    m_matrices;
   std::vector<Object>        m_objects;
+  // instances drawn per drawcall, a single unshifted entry unless
+  // model copies are instanced rather than cloned
+  std::vector<Copy>          m_copies;
+
+  DrawRangeCache m_drawRangeCaches[NUM_DRAW_RANGE_CACHES];
 
   size_t m_partTriCountsSize;
   size_t m_trianglePartIdsSize;
-
+  size_t m_indexSize;         // device index data, with 16-bit indices where possible
+  size_t m_indexSavedSize;    // saved by 16-bit indices compared to all 32-bit
+  size_t m_vertexSize;        // device vertex data
+  size_t m_lodIndexSize;      // device index data of the coarser levels, included in m_indexSize
+  int    m_numLods;           // most levels of any geometry
+
+  // vertices are VertexQuantized on the device, and the parts use matrices with the
+  // dequantization folded in. These follow the node matrices, m_dequantNodes holds
+  // the node each of them was derived from, so the animation can move them along.
+  bool                  m_quantizedVertices;
+  uint32_t              m_numNodeMatrices;
+  std::vector<uint32_t> m_dequantNodes;
+  uint32_t m_vertexStride;
+  float    m_quantizationErrorMax;       // max position error in object space
+  float    m_quantizationErrorRelative;  // max position error relative to the geometry's bbox diagonal
+
+  // total number of unique part indices (Object::uniquePartOffset + part) including clones
   uint32_t m_numObjectParts;
 
   BBox m_bbox;
 
-  bool loadCSF(const char* filename, int clones = 0, int cloneaxis = 3);
+  // removed by deduplication, the saved size approximates the device memory
+  uint32_t m_weldedVertices;
+  uint32_t m_mergedGeometries;
+  size_t   m_dedupSavedSize;
+
+  // only with meshlets, the fill is the average use of the vertex and triangle limits
+  uint32_t m_numMeshlets;
+  size_t   m_meshletSize;  // device meshlet descriptors and indices
+  float    m_meshletVertexFill;
+  float    m_meshletTriangleFill;
+
+  // only with split part vertices, every vertex belongs to a single part
+  uint32_t m_numVertices;        // all unique geometries' vertices, including the split ones
+  uint32_t m_splitVertices;      // added by splitting
+  size_t   m_vertexPartIdsSize;  // device part index per vertex
+
+  // set by releaseGeometryData, only sizes, bboxes and parts of the geometries remain
+  bool m_geometryReleased = false;
+
+  // average cache miss ratio of the indices, per triangle for a FIFO cache of 32 vertices
+  float m_acmrOriginal;
+  float m_acmrOptimized;  // same as m_acmrOriginal unless optimized
+
+  // deduplicate welds identical vertices and merges identical geometries.
+  // lods is the number of levels of detail per geometry, at most MAX_LODS.
+  // optimize reorders the triangles within each part for the vertex cache, and the parts
+  // within each geometry for overdraw. Part indices follow the new order.
+  // meshlets splits the full detail of every part into meshlets with bounds and normal cones.
+  // splitVertices duplicates the vertices shared by several parts and stores a part index per vertex.
+  bool loadCSF(const char* filename,
+               int         clones          = 0,
+               int         cloneaxis       = 3,
+               bool        instancedCopies = false,
+               bool        optimize        = false,
+               bool        quantize        = false,
+               bool        deduplicate     = false,
+               int         lods            = 1,
+               bool        meshlets        = false,
+               bool        splitVertices   = false);
   void unload();
+
+  // frees the host copies of the geometry data (vertices, indices, ids, meshlets), once the
+  // device has its own. Returns the bytes released. Only loadCSF brings them back.
+  size_t releaseGeometryData();
+  bool   hasGeometryData() const { return !m_geometryReleased; }
+
+  // combines the active parts of every object into draw ranges, the same way as
+  // Renderer::fillDrawItems would, for the individual, unlimited, search batch and search combining.
+  // Ranges are combined while matrix, material (unless ignored) and index range are contiguous.
+  void buildDrawRangeCaches(uint32_t searchBatch, bool ignoreMaterials);
+  // nullptr if no cache was built for this combination
+  const DrawRangeCache* findDrawRangeCache(uint32_t maxCombine, bool ignoreMaterials) const;
 };
 
 
@@ -31,165 +31,523 @@ static inline VkDeviceSize alignedSize(VkDeviceSize sz, VkDeviceSize align)
 }
 
 
-void GeometryMemoryVK::init(nvvk::ResourceAllocator* resAllocator, VkDeviceSize maxChunk)
+void FreeListAllocator::init(VkDeviceSize size)
 {
-  m_resAllocator = resAllocator;
-  m_alignment    = 16;
-  m_vboAlignment = 16;
+  m_ranges.clear();
+  if(size)
+  {
+    m_ranges[0] = size;
+  }
+  m_size     = size;
+  m_freeSize = size;
+}
+
+bool FreeListAllocator::alloc(VkDeviceSize size, VkDeviceSize& offset)
+{
+  if(!size)
+  {
+    offset = 0;
+    return true;
+  }
+
+  for(auto it = m_ranges.begin(); it != m_ranges.end(); ++it)
+  {
+    if(it->second >= size)
+    {
+      offset                 = it->first;
+      VkDeviceSize remaining = it->second - size;
+      m_ranges.erase(it);
+      if(remaining)
+      {
+        m_ranges[offset + size] = remaining;
+      }
+      m_freeSize -= size;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void FreeListAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+  if(!size)
+  {
+    return;
+  }
 
-  m_maxVboChunk =        maxChunk;
-  m_maxIboChunk =        maxChunk;
-  m_maxIdsChunk =        maxChunk;
-  m_maxTriOffsetsChunk = maxChunk;
+  assert(offset + size <= m_size);
+  m_freeSize += size;
+
+  auto next = m_ranges.lower_bound(offset);
+  if(next != m_ranges.begin())
+  {
+    auto prev = std::prev(next);
+    assert(prev->first + prev->second <= offset);
+    if(prev->first + prev->second == offset)
+    {
+      // merge with the preceding range
+      offset = prev->first;
+      size += prev->second;
+      m_ranges.erase(prev);
+    }
+  }
+  if(next != m_ranges.end() && offset + size == next->first)
+  {
+    size += next->second;
+    m_ranges.erase(next);
+  }
+
+  m_ranges[offset] = size;
+}
+
+void GeometryMemoryVK::init(nvvk::ResourceAllocator* resAllocator, VkDeviceSize maxChunk, const std::vector<uint32_t>& queueFamilies)
+{
+  m_resAllocator   = resAllocator;
+  m_queueFamilies  = queueFamilies;
+  m_fixedChunks    = false;
+  m_compactPending = false;
+
+  VkBufferUsageFlags usages[NUM_STREAMS] = {VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT,   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
+  {
+    StreamChunks& stream = m_streams[s];
+    stream.usage         = usages[s];
+    stream.alignment     = 16;
+    stream.maxChunk      = maxChunk;
+    stream.padding       = 0;
+    stream.reserve       = 0;
+    stream.chunks.clear();
+  }
+  // pad to allow graceful out-of-bounds access
+  m_streams[STREAM_PART_TRI_COUNTS].padding = sizeof(uint32_t) * 32;
 }
 
 void GeometryMemoryVK::deinit()
 {
-  for(size_t i = 0; i < m_chunks.size(); i++)
+  for(StreamChunks& stream : m_streams)
   {
-    Chunk& chunk = m_chunks[i];
-    destroyResBuffer(*m_resAllocator, chunk.vbo);
-    destroyResBuffer(*m_resAllocator, chunk.ibo);
-    destroyResBuffer(*m_resAllocator, chunk.trianglePartIds);
-    destroyResBuffer(*m_resAllocator, chunk.partTriCounts);
-    destroyResBuffer(*m_resAllocator, chunk.partTriOffsets);
+    for(Chunk& chunk : stream.chunks)
+    {
+      destroyResBuffer(*m_resAllocator, chunk.buffer);
+    }
+    stream.chunks = std::vector<Chunk>();
   }
-  m_chunks       = std::vector<Chunk>();
   m_resAllocator = nullptr;
 }
 
-void GeometryMemoryVK::alloc(VkDeviceSize vboSize,
-                             VkDeviceSize iboSize,
-                             VkDeviceSize trianglePartIdsSize,
-                             VkDeviceSize partTriCountsSize,
-                             VkDeviceSize triOffsetsSize,
-                             Allocation&  allocation)
+void GeometryMemoryVK::reserve(const VkDeviceSize streamTotals[NUM_STREAMS])
 {
-  vboSize             = alignedSize(vboSize, m_vboAlignment);
-  iboSize             = alignedSize(iboSize, m_alignment);
-  trianglePartIdsSize = alignedSize(trianglePartIdsSize, m_alignment);
-  partTriCountsSize   = alignedSize(partTriCountsSize, m_alignment);
-  triOffsetsSize      = alignedSize(triOffsetsSize, m_alignment);
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
+  {
+    m_streams[s].reserve = alignedSize(streamTotals[s], m_streams[s].alignment);
+  }
+}
 
-  if(m_chunks.empty() || getActiveChunk().vbo.info.range + vboSize > m_maxVboChunk || getActiveChunk().ibo.info.range + iboSize > m_maxIboChunk
-     || getActiveChunk().trianglePartIds.info.range + trianglePartIdsSize > m_maxIdsChunk
-     || getActiveChunk().partTriCounts.info.range + partTriCountsSize > m_maxIdsChunk
-     || getActiveChunk().partTriOffsets.info.range + triOffsetsSize > m_maxTriOffsetsChunk)
+void GeometryMemoryVK::initBudget(VkDeviceSize budget, const VkDeviceSize streamTotals[NUM_STREAMS])
+{
+  VkDeviceSize total = 0;
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
   {
-    finalize();
-    Chunk chunk = {};
-    m_chunks.push_back(chunk);
+    total += streamTotals[s];
   }
 
-  Chunk& chunk = getActiveChunk();
+  for(uint32_t s = 0; s < NUM_STREAMS && total; s++)
+  {
+    StreamChunks& stream = m_streams[s];
+    assert(stream.chunks.empty());
+    if(!streamTotals[s])
+    {
+      continue;
+    }
 
-  allocation.chunkIndex            = getActiveIndex();
-  allocation.vboOffset             = chunk.vbo.info.range;
-  allocation.iboOffset             = chunk.ibo.info.range;
-  allocation.trianglePartIdsOffset = chunk.trianglePartIds.info.range;
-  allocation.partTriCountsOffset   = chunk.partTriCounts.info.range;
-  allocation.triOffsetsOffset      = chunk.partTriOffsets.info.range;
+    // every stream gets its share of the budget, in as few chunks as possible
+    VkDeviceSize streamBudget = VkDeviceSize(double(budget) * double(streamTotals[s]) / double(total));
+    size_t       numChunks    = size_t(std::max((streamBudget + stream.maxChunk - 1) / stream.maxChunk, VkDeviceSize(1)));
+    VkDeviceSize chunkSize    = std::max(alignedSize(streamBudget / numChunks, stream.alignment), stream.alignment);
+    for(size_t c = 0; c < numChunks; c++)
+    {
+      addChunk(Stream(s), chunkSize);
+    }
+  }
 
-  chunk.vbo.info.range += vboSize;
-  chunk.ibo.info.range += iboSize;
-  chunk.trianglePartIds.info.range += trianglePartIdsSize;
-  chunk.partTriCounts.info.range += partTriCountsSize;
-  chunk.partTriOffsets.info.range += triOffsetsSize;
+  m_fixedChunks = true;
 }
 
-void GeometryMemoryVK::finalize()
+bool GeometryMemoryVK::alloc(const VkDeviceSize streamSizes[NUM_STREAMS], Allocation& allocation)
 {
-  if(m_chunks.empty())
+  Allocation alloc = {};
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
   {
-    return;
+    if(!allocRange(Stream(s), streamSizes[s], alloc.streams[s]))
+    {
+      // undo the streams allocated so far
+      for(uint32_t u = 0; u < s; u++)
+      {
+        if(alloc.streams[u].size)
+        {
+          m_streams[u].chunks[alloc.streams[u].chunkIndex].freeList.free(alloc.streams[u].offset, alloc.streams[u].size);
+        }
+      }
+      return false;
+    }
   }
 
-  Chunk& chunk = getActiveChunk();
+  allocation = alloc;
+  return true;
+}
 
-  chunk.vbo = createResBuffer(*m_resAllocator, chunk.vbo.info.range, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-  chunk.ibo = createResBuffer(*m_resAllocator, chunk.ibo.info.range, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-  chunk.trianglePartIds = createResBuffer(*m_resAllocator, chunk.trianglePartIds.info.range, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-  // pad to allow graceful out-of-bounds access
-  chunk.partTriCounts = createResBuffer(*m_resAllocator, chunk.partTriCounts.info.range + sizeof(uint32_t) * 32,
-                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-  chunk.partTriOffsets = createResBuffer(*m_resAllocator, chunk.partTriOffsets.info.range, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+bool GeometryMemoryVK::allocRange(Stream streamIndex, VkDeviceSize size, Range& range)
+{
+  StreamChunks& stream = m_streams[streamIndex];
+
+  range = {0, 0, alignedSize(size, stream.alignment)};
+  if(!range.size)
+  {
+    return true;
+  }
+
+  for(size_t c = 0; c < stream.chunks.size(); c++)
+  {
+    if(stream.chunks[c].freeList.alloc(range.size, range.offset))
+    {
+      range.chunkIndex = c;
+      return true;
+    }
+  }
+
+  if(m_fixedChunks)
+  {
+    return false;
+  }
+
+  // the new chunk takes as much of the reserve as allowed, oversized geometries get their own chunk
+  addChunk(streamIndex, std::max(range.size, std::min(stream.reserve, stream.maxChunk)));
+
+  range.chunkIndex = stream.chunks.size() - 1;
+  bool valid       = stream.chunks.back().freeList.alloc(range.size, range.offset);
+  assert(valid);
+  return valid;
 }
 
-void CadSceneVK::init(const CadScene& cadscene, nvvk::ResourceAllocator* resAllocator, VkQueue queue, uint32_t queueFamilyIndex)
+void GeometryMemoryVK::addChunk(Stream streamIndex, VkDeviceSize size)
+{
+  StreamChunks& stream = m_streams[streamIndex];
+
+  Chunk chunk  = {};
+  chunk.buffer = createChunkBuffer(size + stream.padding, stream.usage);
+  chunk.freeList.init(size);
+  stream.chunks.push_back(chunk);
+
+  stream.reserve -= std::min(stream.reserve, size);
+}
+
+void GeometryMemoryVK::free(const Allocation& allocation)
+{
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
+  {
+    const Range& range = allocation.streams[s];
+    if(range.size)
+    {
+      m_streams[s].chunks[range.chunkIndex].freeList.free(range.offset, range.size);
+      m_compactPending = true;
+    }
+  }
+}
+
+VkDeviceSize GeometryMemoryVK::getAllocationSize(const Allocation& allocation) const
+{
+  VkDeviceSize size = 0;
+  for(uint32_t s = 0; s < NUM_STREAMS; s++)
+  {
+    size += allocation.streams[s].size;
+  }
+  return size;
+}
+
+void GeometryMemoryVK::compact(VkCommandBuffer cmd, const std::vector<Allocation*>& allocations, VkDeviceSize maxBytes, std::vector<size_t>& moved)
+{
+  moved.clear();
+
+  struct PendingFree
+  {
+    Stream stream;
+    Range  range;
+  };
+  // The moved-from ranges are only freed after all copies were recorded, so that
+  // no copy writes a range that another copy of the same pass reads.
+  std::vector<PendingFree> pendingFrees;
+  std::vector<bool>        allocationMoved(allocations.size(), false);
+  VkDeviceSize             copiedBytes = 0;
+
+  for(uint32_t s = 0; s < NUM_STREAMS && copiedBytes < maxBytes; s++)
+  {
+    StreamChunks& stream = m_streams[s];
+
+    // the highest ranges first, they leave the largest holes behind
+    std::vector<size_t> sorted;
+    for(size_t i = 0; i < allocations.size(); i++)
+    {
+      if(allocations[i]->streams[s].size)
+      {
+        sorted.push_back(i);
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) {
+      const Range& ra = allocations[a]->streams[s];
+      const Range& rb = allocations[b]->streams[s];
+      return ra.chunkIndex != rb.chunkIndex ? ra.chunkIndex > rb.chunkIndex : ra.offset > rb.offset;
+    });
+
+    for(size_t i : sorted)
+    {
+      Range& range = allocations[i]->streams[s];
+      // over the budget, smaller ranges may still fit. The first copy of a pass may exceed
+      // it, otherwise ranges larger than maxBytes would never move.
+      if(copiedBytes && copiedBytes + range.size > maxBytes)
+      {
+        continue;
+      }
+
+      // first-fit returns the lowest free range, keep it only if it is below the current one
+      Range target = {0, 0, range.size};
+      bool  found  = false;
+      for(size_t c = 0; c <= range.chunkIndex && !found; c++)
+      {
+        found             = stream.chunks[c].freeList.alloc(range.size, target.offset);
+        target.chunkIndex = c;
+      }
+      if(found && target.chunkIndex == range.chunkIndex && target.offset > range.offset)
+      {
+        stream.chunks[target.chunkIndex].freeList.free(target.offset, target.size);
+        found = false;
+      }
+      if(!found)
+      {
+        continue;
+      }
+
+      if(copiedBytes == 0)
+      {
+        // previous frames may still read or write the geometry memory
+        VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        memBarrier.srcAccessMask   = VK_ACCESS_MEMORY_WRITE_BIT;
+        memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier, 0,
+                             nullptr, 0, nullptr);
+      }
+
+      VkBufferCopy region = {range.offset, target.offset, range.size};
+      vkCmdCopyBuffer(cmd, stream.chunks[range.chunkIndex].buffer.buffer, stream.chunks[target.chunkIndex].buffer.buffer, 1, &region);
+
+      pendingFrees.push_back({Stream(s), range});
+      range = target;
+      copiedBytes += range.size;
+
+      if(!allocationMoved[i])
+      {
+        allocationMoved[i] = true;
+        moved.push_back(i);
+      }
+    }
+  }
+
+  for(const PendingFree& pending : pendingFrees)
+  {
+    m_streams[pending.stream].chunks[pending.range.chunkIndex].freeList.free(pending.range.offset, pending.range.size);
+  }
+
+  if(copiedBytes)
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+                               | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memBarrier, 0,
+                         nullptr, 0, nullptr);
+  }
+
+  // done once a pass finds nothing left to move
+  m_compactPending = copiedBytes != 0;
+}
+
+ResBuffer GeometryMemoryVK::createChunkBuffer(VkDeviceSize size, VkBufferUsageFlags usage) const
+{
+  if(m_queueFamilies.size() <= 1)
+  {
+    return createResBuffer(*m_resAllocator, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  }
+
+  // written by the transfer queue, read by the main queue, without ownership transfers
+  VkBufferCreateInfo info    = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  info.size                  = size;
+  info.usage                 = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+  info.queueFamilyIndexCount = uint32_t(m_queueFamilies.size());
+  info.pQueueFamilyIndices   = m_queueFamilies.data();
+
+  return createResBuffer(*m_resAllocator, info);
+}
+
+static void getStreamSizes(const CadScene::Geometry& cadgeom, VkDeviceSize sizes[GeometryMemoryVK::NUM_STREAMS])
+{
+  sizes[GeometryMemoryVK::STREAM_VBO]               = cadgeom.vboQuantizedData ? cadgeom.vboQuantizedSize : cadgeom.vboSize;
+  sizes[GeometryMemoryVK::STREAM_IBO]               = cadgeom.ibo16Data ? 0 : cadgeom.iboSize;
+  sizes[GeometryMemoryVK::STREAM_IBO16]             = cadgeom.ibo16Data ? cadgeom.ibo16Size : 0;
+  sizes[GeometryMemoryVK::STREAM_TRIANGLE_PART_IDS] = cadgeom.trianglePartIdsSize;
+  sizes[GeometryMemoryVK::STREAM_PART_TRI_COUNTS]   = cadgeom.partTriCountsSize;
+  sizes[GeometryMemoryVK::STREAM_PART_TRI_OFFSETS]  = cadgeom.partTriOffsetsSize;
+  sizes[GeometryMemoryVK::STREAM_MESHLETS]          = cadgeom.meshletsSize;
+  sizes[GeometryMemoryVK::STREAM_MESHLET_INDICES]   = cadgeom.meshletIndicesSize;
+  sizes[GeometryMemoryVK::STREAM_VERTEX_PART_IDS]   = cadgeom.vertexPartIdsSize;
+}
+
+void CadSceneVK::init(const CadScene&          cadscene,
+                      nvvk::ResourceAllocator* resAllocator,
+                      VkQueue                  queue,
+                      uint32_t                 queueFamilyIndex,
+                      VkQueue                  transferQueue,
+                      uint32_t                 transferQueueFamily,
+                      VkDeviceSize             geometryBudget)
 {
   VkDeviceSize MB = 1024 * 1024;
 
+  // the uploads read the host copies, see CadScene::releaseGeometryData
+  assert(cadscene.hasGeometryData());
+
   m_resAllocator = resAllocator;
+  m_cadscene     = &cadscene;
+  m_queue        = queue;
+  m_queueFamily  = queueFamilyIndex;
+  m_residency    = Residency();
   m_geometry.resize(cadscene.m_geometry.size(), {0});
+  for(size_t g = 0; g < m_geometry.size(); g++)
+  {
+    m_geometry[g].numParts  = uint32_t(cadscene.m_geometry[g].parts.size());
+    m_geometry[g].numLevels = uint32_t(cadscene.m_geometry[g].lods.size()) + 1;
+  }
 
   if(m_geometry.empty())
     return;
 
+  // with a budget, geometries are only uploaded once requested
+  m_residency.budget = geometryBudget;
+  bool async         = transferQueue != VK_NULL_HANDLE && transferQueue != queue && !geometryBudget;
+
   {
     // allocation phase
-    m_geometryMem.init(m_resAllocator, 256 * MB);
+    std::vector<uint32_t> queueFamilies = {queueFamilyIndex};
+    if(async && transferQueueFamily != queueFamilyIndex)
+    {
+      queueFamilies.push_back(transferQueueFamily);
+    }
+    m_geometryMem.init(m_resAllocator, 256 * MB, queueFamilies);
+    // a single index buffer lets vertex pulling draw everything with one MDI,
+    // 1 GB is the minimum guaranteed maxMemoryAllocationSize
+    m_geometryMem.setMaxChunk(GeometryMemoryVK::STREAM_IBO, 1024 * MB);
+    m_geometryMem.setMaxChunk(GeometryMemoryVK::STREAM_IBO16, 1024 * MB);
 
+    VkDeviceSize totals[GeometryMemoryVK::NUM_STREAMS] = {};
     for(size_t g = 0; g < cadscene.m_geometry.size(); g++)
     {
-      const CadScene::Geometry& cadgeom = cadscene.m_geometry[g];
-      Geometry&                 geom    = m_geometry[g];
-
-      m_geometryMem.alloc(cadgeom.vboSize, cadgeom.iboSize, cadgeom.trianglePartIdsSize, cadgeom.partTriCountsSize,
-                          cadgeom.partTriOffsetsSize, geom.allocation);
+      VkDeviceSize sizes[GeometryMemoryVK::NUM_STREAMS];
+      getStreamSizes(cadscene.m_geometry[g], sizes);
+      for(uint32_t s = 0; s < GeometryMemoryVK::NUM_STREAMS; s++)
+      {
+        totals[s] += sizes[s];
+      }
     }
 
-    m_geometryMem.finalize();
+    if(geometryBudget)
+    {
+      m_geometryMem.initBudget(geometryBudget, totals);
+    }
+    else
+    {
+      m_geometryMem.reserve(totals);
+      for(size_t g = 0; g < cadscene.m_geometry.size(); g++)
+      {
+        VkDeviceSize sizes[GeometryMemoryVK::NUM_STREAMS];
+        getStreamSizes(cadscene.m_geometry[g], sizes);
+
+        bool valid = m_geometryMem.alloc(sizes, m_geometry[g].allocation);
+        assert(valid);
+      }
+    }
 
     LOGI("Size of vertex data: %11" PRId64 "\n", uint64_t(m_geometryMem.getVertexSize()));
     LOGI("Size of index data:  %11" PRId64 "\n", uint64_t(m_geometryMem.getIndexSize()));
     LOGI("Size of ids data:    %11" PRId64 "\n", uint64_t(m_geometryMem.getIdSize()));
+    LOGI("Size of meshlets:    %11" PRId64 "\n", uint64_t(m_geometryMem.getMeshletSize()));
+    LOGI("Size of vertex ids:  %11" PRId64 "\n", uint64_t(m_geometryMem.getVertexPartIdSize()));
     LOGI("Size of data:        %11" PRId64 "\n",
-         uint64_t(m_geometryMem.getVertexSize() + m_geometryMem.getIndexSize() + m_geometryMem.getIdSize()));
+         uint64_t(m_geometryMem.getVertexSize() + m_geometryMem.getIndexSize() + m_geometryMem.getIdSize()
+                  + m_geometryMem.getMeshletSize() + m_geometryMem.getVertexPartIdSize()));
     LOGI("Chunks:              %11d\n", uint32_t(m_geometryMem.getChunkCount()));
   }
 
   ScopeStaging staging(*m_resAllocator, queue, queueFamilyIndex);
 
-  for(size_t g = 0; g < cadscene.m_geometry.size(); g++)
+  // the asynchronous path only plans the copies here, uploadThread executes them
+  VkDeviceSize batchSize = 0;
+  auto         upload    = [&](const VkDescriptorBufferInfo& binding, const void* data) {
+    if(!async)
+    {
+      staging.upload(binding, data);
+      return;
+    }
+
+    for(VkDeviceSize offset = 0; data && offset < binding.range;)
+    {
+      VkDeviceSize size = std::min(binding.range - offset, UPLOAD_SLOT_SIZE);
+      if(m_uploads.batches.empty() || batchSize + alignedSize(size, 16) > UPLOAD_SLOT_SIZE)
+      {
+        m_uploads.batches.push_back({m_uploads.pieces.size(), 0});
+        batchSize = 0;
+      }
+      m_uploads.pieces.push_back({binding.buffer, binding.offset + offset, size, (const uint8_t*)data + offset});
+      m_uploads.batches.back().numPieces++;
+      batchSize += alignedSize(size, 16);
+      offset += size;
+    }
+  };
+
+  if(async)
   {
-    const CadScene::Geometry&      cadgeom = cadscene.m_geometry[g];
-    Geometry&                      geom    = m_geometry[g];
-    const GeometryMemoryVK::Chunk& chunk   = m_geometryMem.getChunk(geom.allocation);
+    m_uploads.geometryBatch.resize(cadscene.m_geometry.size());
+  }
 
-    // upload and assignment phase
-    geom.vbo.buffer = chunk.vbo.buffer;
-    geom.vbo.offset = geom.allocation.vboOffset;
-    geom.vbo.range  = cadgeom.vboSize;
-    geom.vboAddr    = chunk.vbo.addr + geom.allocation.vboOffset;
-    staging.upload(geom.vbo, cadgeom.vboData);
-
-    geom.ibo.buffer = chunk.ibo.buffer;
-    geom.ibo.offset = geom.allocation.iboOffset;
-    geom.ibo.range  = cadgeom.iboSize;
-    geom.iboAddr    = chunk.ibo.addr + geom.allocation.iboOffset;
-    staging.upload(geom.ibo, cadgeom.iboData);
-
-    geom.trianglePartIds.buffer = chunk.trianglePartIds.buffer;
-    geom.trianglePartIds.offset = geom.allocation.trianglePartIdsOffset;
-    geom.trianglePartIds.range  = cadgeom.trianglePartIdsSize;
-    geom.trianglePartIdsAddr    = chunk.trianglePartIds.addr + geom.allocation.trianglePartIdsOffset;
-    staging.upload(geom.trianglePartIds, cadgeom.trianglePartIdsData);
-
-    geom.partTriCounts.buffer = chunk.partTriCounts.buffer;
-    geom.partTriCounts.offset = geom.allocation.partTriCountsOffset;
-    geom.partTriCounts.range  = cadgeom.partTriCountsSize;
-    geom.partTriCountsAddr    = chunk.partTriCounts.addr + geom.allocation.partTriCountsOffset;
-    staging.upload(geom.partTriCounts, cadgeom.partTriCountsData);
+  for(size_t g = 0; g < cadscene.m_geometry.size() && !geometryBudget; g++)
+  {
+    const CadScene::Geometry& cadgeom = cadscene.m_geometry[g];
+    Geometry&                 geom    = m_geometry[g];
 
-    geom.partTriOffsets.buffer = chunk.partTriOffsets.buffer;
-    geom.partTriOffsets.offset = geom.allocation.triOffsetsOffset;
-    geom.partTriOffsets.range  = cadgeom.partTriOffsetsSize;
-    geom.partTriOffsetsAddr    = chunk.partTriOffsets.addr + geom.allocation.triOffsetsOffset;
-    staging.upload(geom.partTriOffsets, cadgeom.partTriOffsetsData);
+    // upload and assignment phase
+    assignGeometry(g);
+    geom.resident = true;
+
+    upload(geom.vbo, cadgeom.vboQuantizedData ? (const void*)cadgeom.vboQuantizedData : cadgeom.vboData);
+    upload(geom.ibo, cadgeom.ibo16Data ? (const void*)cadgeom.ibo16Data : cadgeom.iboData);
+    upload(geom.partTriCounts, cadgeom.partTriCountsData);
+    upload(geom.partTriOffsets, cadgeom.partTriOffsetsData);
+    upload(geom.meshlets, cadgeom.meshletsData);
+    upload(geom.meshletIndices, cadgeom.meshletIndicesData);
+    upload(geom.vertexPartIds, cadgeom.vertexPartIdsData);
+
+    if(async)
+    {
+      m_uploads.geometryBatch[g] = m_uploads.batches.empty() ? 0 : uint32_t(m_uploads.batches.size() - 1);
+    }
   }
 
   VkDeviceSize materialsSize = cadscene.m_materials.size() * sizeof(CadScene::Material);
   VkDeviceSize matricesSize  = cadscene.m_matrices.size() * sizeof(CadScene::MatrixNode);
+  VkDeviceSize copiesSize    = cadscene.m_copies.size() * sizeof(CadScene::Copy);
+  VkDeviceSize dequantSize   = std::max(cadscene.m_dequantNodes.size(), size_t(1)) * sizeof(uint32_t);
 
   m_buffers.materials =
       createResBuffer(*resAllocator, materialsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
@@ -197,21 +555,400 @@ void CadSceneVK::init(const CadScene& cadscene, nvvk::ResourceAllocator* resAllo
       createResBuffer(*resAllocator, matricesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
   m_buffers.matricesOrig =
       createResBuffer(*resAllocator, matricesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  m_buffers.copies =
+      createResBuffer(*resAllocator, copiesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  m_buffers.dequantNodes =
+      createResBuffer(*resAllocator, dequantSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 
 
   staging.upload(m_buffers.materials.info, cadscene.m_materials.data());
   staging.upload(m_buffers.matrices.info, cadscene.m_matrices.data());
   staging.upload(m_buffers.matricesOrig.info, cadscene.m_matrices.data());
+  staging.upload(m_buffers.copies.info, cadscene.m_copies.data());
+  if(!cadscene.m_dequantNodes.empty())
+  {
+    staging.upload(m_buffers.dequantNodes.info, cadscene.m_dequantNodes.data());
+  }
 
   staging.submit();
+
+  if(async && !m_uploads.batches.empty())
+  {
+    VkDevice device = m_resAllocator->getDevice();
+
+    m_uploads.queue = transferQueue;
+
+    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags                   = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex        = transferQueueFamily;
+    VkResult result                  = vkCreateCommandPool(device, &poolInfo, nullptr, &m_uploads.cmdPool);
+    assert(result == VK_SUCCESS);
+
+    VkCommandBufferAllocateInfo cmdInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cmdInfo.commandPool                 = m_uploads.cmdPool;
+    cmdInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdInfo.commandBufferCount          = UPLOAD_SLOTS;
+    result                              = vkAllocateCommandBuffers(device, &cmdInfo, m_uploads.cmds);
+    assert(result == VK_SUCCESS);
+
+    VkSemaphoreTypeCreateInfo timelineInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue              = 0;
+    VkSemaphoreCreateInfo semInfo          = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semInfo.pNext                          = &timelineInfo;
+    result                                 = vkCreateSemaphore(device, &semInfo, nullptr, &m_uploads.timeline);
+    assert(result == VK_SUCCESS);
+
+    // the allocator is not thread-safe, the thread only works with what is created here
+    for(uint32_t i = 0; i < UPLOAD_SLOTS; i++)
+    {
+      m_uploads.staging[i] = createResBuffer(*m_resAllocator, UPLOAD_SLOT_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      m_uploads.stagingMapping[i] = m_resAllocator->map(m_uploads.staging[i]);
+    }
+
+    LOGI("Upload batches:      %11d\n", uint32_t(m_uploads.batches.size()));
+
+    m_uploads.completed = 0;
+    m_uploads.abort     = false;
+    m_uploads.startTime = std::chrono::steady_clock::now();
+    m_uploads.thread    = std::thread(&CadSceneVK::uploadThread, this);
+  }
+  else
+  {
+    // nothing to wait for
+    m_uploads.geometryBatch.clear();
+  }
+}
+
+void CadSceneVK::assignGeometry(size_t geometryIndex)
+{
+  const CadScene::Geometry& cadgeom = m_cadscene->m_geometry[geometryIndex];
+  Geometry&                 geom    = m_geometry[geometryIndex];
+
+  auto assign = [&](GeometryMemoryVK::Stream stream, VkDeviceSize size, VkDescriptorBufferInfo& info, VkDeviceAddress& addr) {
+    const GeometryMemoryVK::Range& range = geom.allocation.streams[stream];
+    if(!range.size)
+    {
+      // empty streams have no chunk
+      info = {VK_NULL_HANDLE, 0, 0};
+      addr = 0;
+      return;
+    }
+
+    const ResBuffer& chunk = m_geometryMem.getChunk(stream, geom.allocation).buffer;
+    info.buffer            = chunk.buffer;
+    info.offset            = range.offset;
+    info.range             = size;
+    addr                   = chunk.addr + range.offset;
+  };
+
+  assign(GeometryMemoryVK::STREAM_VBO, cadgeom.vboQuantizedData ? cadgeom.vboQuantizedSize : cadgeom.vboSize, geom.vbo,
+         geom.vboAddr);
+  if(cadgeom.ibo16Data)
+  {
+    assign(GeometryMemoryVK::STREAM_IBO16, cadgeom.ibo16Size, geom.ibo, geom.iboAddr);
+    geom.indexType = VK_INDEX_TYPE_UINT16;
+  }
+  else
+  {
+    assign(GeometryMemoryVK::STREAM_IBO, cadgeom.iboSize, geom.ibo, geom.iboAddr);
+    geom.indexType = VK_INDEX_TYPE_UINT32;
+  }
+  assign(GeometryMemoryVK::STREAM_TRIANGLE_PART_IDS, cadgeom.trianglePartIdsSize, geom.trianglePartIds, geom.trianglePartIdsAddr);
+  assign(GeometryMemoryVK::STREAM_PART_TRI_COUNTS, cadgeom.partTriCountsSize, geom.partTriCounts, geom.partTriCountsAddr);
+  assign(GeometryMemoryVK::STREAM_PART_TRI_OFFSETS, cadgeom.partTriOffsetsSize, geom.partTriOffsets, geom.partTriOffsetsAddr);
+  assign(GeometryMemoryVK::STREAM_MESHLETS, cadgeom.meshletsSize, geom.meshlets, geom.meshletsAddr);
+  assign(GeometryMemoryVK::STREAM_MESHLET_INDICES, cadgeom.meshletIndicesSize, geom.meshletIndices, geom.meshletIndicesAddr);
+  assign(GeometryMemoryVK::STREAM_VERTEX_PART_IDS, cadgeom.vertexPartIdsSize, geom.vertexPartIds, geom.vertexPartIdsAddr);
+}
+
+bool CadSceneVK::requestGeometries(const std::vector<uint32_t>& geometryIndices)
+{
+  if(!m_residency.budget)
+  {
+    return false;
+  }
+
+  // tag all first, so none of the requested geometries gets evicted for another one
+  uint32_t request     = ++m_residency.request;
+  bool     allResident = true;
+  for(uint32_t g : geometryIndices)
+  {
+    m_geometry[g].lastRequest = request;
+    allResident               = allResident && m_geometry[g].resident;
+  }
+
+  m_residency.hits    = 0;
+  m_residency.misses  = 0;
+  m_residency.uploads = 0;
+
+  if(allResident)
+  {
+    // nothing to upload, the others stay resident until their space is needed
+    m_residency.hits = uint32_t(geometryIndices.size());
+    return false;
+  }
+
+  // eviction candidates, least recently requested first
+  std::vector<uint32_t> evictable;
+  for(size_t g = 0; g < m_geometry.size(); g++)
+  {
+    if(m_geometry[g].resident && m_geometry[g].lastRequest != request)
+    {
+      evictable.push_back(uint32_t(g));
+    }
+  }
+  std::sort(evictable.begin(), evictable.end(),
+            [&](uint32_t a, uint32_t b) { return m_geometry[a].lastRequest > m_geometry[b].lastRequest; });
+
+  ScopeStaging staging(*m_resAllocator, m_queue, m_queueFamily);
+  bool         waitedIdle = false;
+  uint32_t     evictions  = 0;
+
+  for(uint32_t g : geometryIndices)
+  {
+    const CadScene::Geometry& cadgeom = m_cadscene->m_geometry[g];
+    Geometry&                 geom    = m_geometry[g];
+
+    if(geom.resident)
+    {
+      m_residency.hits++;
+      continue;
+    }
+
+    VkDeviceSize sizes[GeometryMemoryVK::NUM_STREAMS];
+    getStreamSizes(cadgeom, sizes);
+
+    bool fits = m_geometryMem.alloc(sizes, geom.allocation);
+    while(!fits && !evictable.empty())
+    {
+      if(!waitedIdle)
+      {
+        // previously recorded frames may still read the evicted ranges
+        vkQueueWaitIdle(m_queue);
+        waitedIdle = true;
+      }
+      evictGeometry(evictable.back());
+      evictable.pop_back();
+      evictions++;
+      fits = m_geometryMem.alloc(sizes, geom.allocation);
+    }
+
+    if(!fits)
+    {
+      // beyond the budget, drawn once other geometries are no longer requested
+      m_residency.misses++;
+      continue;
+    }
+
+    assignGeometry(g);
+    staging.upload(geom.vbo, cadgeom.vboQuantizedData ? (const void*)cadgeom.vboQuantizedData : cadgeom.vboData);
+    staging.upload(geom.ibo, cadgeom.ibo16Data ? (const void*)cadgeom.ibo16Data : cadgeom.iboData);
+    staging.upload(geom.partTriCounts, cadgeom.partTriCountsData);
+    staging.upload(geom.partTriOffsets, cadgeom.partTriOffsetsData);
+    staging.upload(geom.meshlets, cadgeom.meshletsData);
+    staging.upload(geom.meshletIndices, cadgeom.meshletIndicesData);
+    staging.upload(geom.vertexPartIds, cadgeom.vertexPartIdsData);
+
+    geom.resident             = true;
+    geom.trianglePartIdsValid = false;
+    m_residency.numResident++;
+    m_residency.residentSize += m_geometryMem.getAllocationSize(geom.allocation);
+    m_residency.uploads++;
+  }
+
+  staging.submit();
+
+  if(m_residency.uploads || evictions)
+  {
+    LOGI("geometry residency: %d hits, %d misses, %d uploads, %d evictions, %d resident, %" PRId64 " of %" PRId64 " bytes\n",
+         m_residency.hits, m_residency.misses, m_residency.uploads, evictions, m_residency.numResident,
+         uint64_t(m_residency.residentSize), uint64_t(m_residency.budget));
+  }
+
+  return m_residency.uploads || evictions;
+}
+
+void CadSceneVK::evictGeometry(size_t geometryIndex)
+{
+  Geometry& geom = m_geometry[geometryIndex];
+  assert(geom.resident);
+
+  m_geometryMem.free(geom.allocation);
+
+  geom.resident             = false;
+  geom.trianglePartIdsValid = false;
+  m_residency.numResident--;
+  m_residency.residentSize -= m_geometryMem.getAllocationSize(geom.allocation);
+  m_residency.evictions++;
+}
+
+bool CadSceneVK::compactGeometry(VkCommandBuffer cmd, VkDeviceSize maxBytes)
+{
+  // the upload thread writes to fixed ranges
+  if(isUploading() || !m_geometryMem.isCompactPending())
+  {
+    return false;
+  }
+
+  std::vector<GeometryMemoryVK::Allocation*> allocations;
+  std::vector<size_t>                        geometryIndices;
+  for(size_t g = 0; g < m_geometry.size(); g++)
+  {
+    if(m_geometry[g].resident)
+    {
+      allocations.push_back(&m_geometry[g].allocation);
+      geometryIndices.push_back(g);
+    }
+  }
+
+  std::vector<size_t> moved;
+  m_geometryMem.compact(cmd, allocations, maxBytes, moved);
+
+  // address fixups
+  for(size_t i : moved)
+  {
+    assignGeometry(geometryIndices[i]);
+  }
+
+  if(!moved.empty())
+  {
+    LOGI("geometry compaction: %d geometries moved\n", uint32_t(moved.size()));
+  }
+
+  return !moved.empty();
+}
+
+void CadSceneVK::uploadThread()
+{
+  VkDevice device = m_resAllocator->getDevice();
+
+  for(size_t b = 0; b < m_uploads.batches.size() && !m_uploads.abort; b++)
+  {
+    uint32_t slot = uint32_t(b % UPLOAD_SLOTS);
+    if(b >= UPLOAD_SLOTS)
+    {
+      // the slot's staging memory and command buffer are free once its previous batch completed
+      uint64_t            waitValue = b - UPLOAD_SLOTS + 1;
+      VkSemaphoreWaitInfo waitInfo  = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+      waitInfo.semaphoreCount       = 1;
+      waitInfo.pSemaphores          = &m_uploads.timeline;
+      waitInfo.pValues              = &waitValue;
+      vkWaitSemaphores(device, &waitInfo, ~0ull);
+    }
+
+    VkCommandBuffer cmd = m_uploads.cmds[slot];
+    vkResetCommandBuffer(cmd, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    const Uploads::Batch& batch         = m_uploads.batches[b];
+    uint8_t*              mapping       = (uint8_t*)m_uploads.stagingMapping[slot];
+    VkDeviceSize          stagingOffset = 0;
+    for(size_t p = batch.firstPiece; p < batch.firstPiece + batch.numPieces; p++)
+    {
+      const Uploads::Piece& piece = m_uploads.pieces[p];
+      memcpy(mapping + stagingOffset, piece.data, piece.size);
+
+      VkBufferCopy region = {stagingOffset, piece.offset, piece.size};
+      vkCmdCopyBuffer(cmd, m_uploads.staging[slot].buffer, piece.buffer, 1, &region);
+
+      stagingOffset += alignedSize(piece.size, 16);
+    }
+
+    vkEndCommandBuffer(cmd);
+
+    uint64_t                      signalValue  = b + 1;
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount     = 1;
+    timelineInfo.pSignalSemaphoreValues        = &signalValue;
+
+    VkSubmitInfo submitInfo         = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext                = &timelineInfo;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_uploads.timeline;
+
+    // the transfer queue is used by this thread only
+    VkResult result = vkQueueSubmit(m_uploads.queue, 1, &submitInfo, VK_NULL_HANDLE);
+    assert(result == VK_SUCCESS);
+  }
+}
+
+bool CadSceneVK::updateUploads(uint64_t& waitValue)
+{
+  if(!m_uploads.timeline)
+  {
+    return false;
+  }
+
+  uint64_t value = 0;
+  vkGetSemaphoreCounterValue(m_resAllocator->getDevice(), m_uploads.timeline, &value);
+  if(value == m_uploads.completed)
+  {
+    return false;
+  }
+
+  m_uploads.completed = value;
+  waitValue           = value;
+  if(isUploadComplete())
+  {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_uploads.startTime).count();
+    LOGI("geometry upload completed: %.1f ms\n", ms);
+  }
+
+  return true;
+}
+
+void CadSceneVK::finishUploads()
+{
+  if(!m_uploads.timeline)
+  {
+    return;
+  }
+
+  VkDevice device = m_resAllocator->getDevice();
+
+  m_uploads.abort = true;
+  m_uploads.thread.join();
+  // the thread is done with the queue, wait for what it submitted
+  vkQueueWaitIdle(m_uploads.queue);
+
+  for(uint32_t i = 0; i < UPLOAD_SLOTS; i++)
+  {
+    m_resAllocator->unmap(m_uploads.staging[i]);
+    destroyResBuffer(*m_resAllocator, m_uploads.staging[i]);
+    m_uploads.stagingMapping[i] = nullptr;
+  }
+  vkDestroyCommandPool(device, m_uploads.cmdPool, nullptr);
+  vkDestroySemaphore(device, m_uploads.timeline, nullptr);
+
+  m_uploads.cmdPool  = VK_NULL_HANDLE;
+  m_uploads.timeline = VK_NULL_HANDLE;
+  m_uploads.queue    = VK_NULL_HANDLE;
+  m_uploads.pieces   = std::vector<Uploads::Piece>();
+  m_uploads.batches  = std::vector<Uploads::Batch>();
+  // all geometries are ready from now on, also if the uploads were aborted by deinit
+  m_uploads.geometryBatch.clear();
+  m_uploads.completed = 0;
 }
 
 void CadSceneVK::deinit()
 {
+  finishUploads();
+
   destroyResBuffer(*m_resAllocator, m_buffers.materials);
   destroyResBuffer(*m_resAllocator, m_buffers.matrices);
   destroyResBuffer(*m_resAllocator, m_buffers.matricesOrig);
+  destroyResBuffer(*m_resAllocator, m_buffers.dequantNodes);
+  destroyResBuffer(*m_resAllocator, m_buffers.copies);
 
   m_geometry.clear();
   m_geometryMem.deinit();
+  m_residency = Residency();
+  m_cadscene  = nullptr;
 }
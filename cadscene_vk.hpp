@@ -23,6 +23,11 @@
 #include "cadscene.hpp"
 #include "resources_base.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
 // ScopeStaging handles uploads and other staging operations.
 // not efficient because it blocks/syncs operations
 
@@ -70,98 +75,162 @@ struct ScopeStaging
 };
 
 
+// FreeListAllocator hands out ranges of [0, size) first-fit,
+// freed ranges are coalesced with their free neighbors.
+// Sizes are expected to be multiples of the required alignment.
+
+class FreeListAllocator
+{
+public:
+  void init(VkDeviceSize size);
+
+  bool alloc(VkDeviceSize size, VkDeviceSize& offset);
+  void free(VkDeviceSize offset, VkDeviceSize size);
+
+  VkDeviceSize getSize() const { return m_size; }
+  VkDeviceSize getFreeSize() const { return m_freeSize; }
+
+private:
+  std::map<VkDeviceSize, VkDeviceSize> m_ranges;  // free ranges, offset to size
+  VkDeviceSize                         m_size     = 0;
+  VkDeviceSize                         m_freeSize = 0;
+};
+
+
 // GeometryMemoryVK manages vbo/ibo etc. in chunks
-// allows to reduce number of bindings and be more memory efficient
+// allows to reduce number of bindings and be more memory efficient.
+// Every stream has its own chunks and free lists, so the streams of a geometry
+// may live in different chunks and empty streams take no memory.
+// Chunks are created on demand, or with a budget all up front (initBudget).
+// Freed ranges are coalesced, and compact moves allocations down into free
+// ranges on the device to undo the fragmentation left by frees.
 
 struct GeometryMemoryVK
 {
   typedef size_t Index;
 
+  enum Stream
+  {
+    STREAM_VBO,
+    STREAM_IBO,
+    STREAM_IBO16,  // 16-bit indices of small geometries, which have no STREAM_IBO data
+    STREAM_TRIANGLE_PART_IDS,
+    STREAM_PART_TRI_COUNTS,
+    STREAM_PART_TRI_OFFSETS,
+    STREAM_MESHLETS,         // only if the scene has meshlets
+    STREAM_MESHLET_INDICES,
+    STREAM_VERTEX_PART_IDS,  // only if the scene has split part vertices
+    NUM_STREAMS,
+  };
 
-  struct Allocation
+  struct Range
   {
     Index        chunkIndex;
-    VkDeviceSize vboOffset;
-    VkDeviceSize iboOffset;
-    VkDeviceSize trianglePartIdsOffset;
-    VkDeviceSize partTriCountsOffset;
-    VkDeviceSize triOffsetsOffset;
+    VkDeviceSize offset;
+    VkDeviceSize size;  // aligned, 0 for empty streams which have no chunk
+  };
+
+  struct Allocation
+  {
+    Range streams[NUM_STREAMS];
   };
 
   struct Chunk
   {
-    ResBuffer vbo;
-    ResBuffer ibo;
-    ResBuffer trianglePartIds;
-    ResBuffer partTriCounts;
-    ResBuffer partTriOffsets;
+    ResBuffer         buffer;
+    FreeListAllocator freeList;
   };
 
   nvvk::ResourceAllocator* m_resAllocator;
-  std::vector<Chunk>       m_chunks;
+  std::vector<uint32_t>    m_queueFamilies;  // more than one makes the chunks shared concurrently
 
-  void init(nvvk::ResourceAllocator* resAllocator, VkDeviceSize maxChunk);
+  void init(nvvk::ResourceAllocator* resAllocator, VkDeviceSize maxChunk, const std::vector<uint32_t>& queueFamilies);
   void deinit();
-  void alloc(VkDeviceSize vboSize,
-             VkDeviceSize iboSize,
-             VkDeviceSize trianglePartIdsSize,
-             VkDeviceSize partTriCountsSize,
-             VkDeviceSize triOffsetsSize,
-             Allocation&  allocation);
-  void finalize();
-
-  const Chunk& getChunk(const Allocation& allocation) const { return m_chunks[allocation.chunkIndex]; }
 
-  const Chunk& getChunk(Index index) const { return m_chunks[index]; }
+  // overrides the maxChunk of init for one stream, before any allocation
+  void setMaxChunk(Stream stream, VkDeviceSize maxChunk) { m_streams[stream].maxChunk = maxChunk; }
+  // optional, sizes the chunks created by alloc for the expected totals
+  void reserve(const VkDeviceSize streamTotals[NUM_STREAMS]);
+  // creates chunks totaling budget bytes, split across the streams in proportion to the totals.
+  // No further chunks are created afterwards.
+  void initBudget(VkDeviceSize budget, const VkDeviceSize streamTotals[NUM_STREAMS]);
+
+  // returns false if all streams can not be placed, only possible with a budget
+  bool alloc(const VkDeviceSize streamSizes[NUM_STREAMS], Allocation& allocation);
+  void free(const Allocation& allocation);
+
+  VkDeviceSize getAllocationSize(const Allocation& allocation) const;
+
+  // true if frees happened since the last compact that moved nothing
+  bool isCompactPending() const { return m_compactPending; }
+  // Moves allocations to lower free ranges, up to maxBytes of copies, and returns the
+  // indices of the moved allocations, which are updated in place.
+  // The copies are enclosed by barriers against all previous and later device accesses.
+  // The moved-from ranges become free right away, so cmd must be submitted before
+  // any later writes to the geometry memory.
+  void compact(VkCommandBuffer cmd, const std::vector<Allocation*>& allocations, VkDeviceSize maxBytes, std::vector<size_t>& moved);
+
+  const Chunk& getChunk(Stream stream, Index index) const { return m_streams[stream].chunks[index]; }
+  const Chunk& getChunk(Stream stream, const Allocation& allocation) const
+  {
+    return m_streams[stream].chunks[allocation.streams[stream].chunkIndex];
+  }
 
-  VkDeviceSize getVertexSize() const
+  VkDeviceSize getStreamSize(Stream stream) const
   {
     VkDeviceSize size = 0;
-    for(size_t i = 0; i < m_chunks.size(); i++)
+    for(const Chunk& chunk : m_streams[stream].chunks)
     {
-      size += m_chunks[i].vbo.info.range;
+      size += chunk.freeList.getSize();
     }
     return size;
   }
 
-  VkDeviceSize getIndexSize() const
+  VkDeviceSize getStreamFreeSize(Stream stream) const
   {
     VkDeviceSize size = 0;
-    for(size_t i = 0; i < m_chunks.size(); i++)
+    for(const Chunk& chunk : m_streams[stream].chunks)
     {
-      size += m_chunks[i].ibo.info.range;
+      size += chunk.freeList.getFreeSize();
     }
     return size;
   }
 
-  VkDeviceSize getIdSize() const
+  VkDeviceSize getVertexSize() const { return getStreamSize(STREAM_VBO); }
+  VkDeviceSize getIndexSize() const { return getStreamSize(STREAM_IBO) + getStreamSize(STREAM_IBO16); }
+  VkDeviceSize getIdSize() const { return getStreamSize(STREAM_TRIANGLE_PART_IDS) + getStreamSize(STREAM_PART_TRI_COUNTS); }
+  VkDeviceSize getMeshletSize() const { return getStreamSize(STREAM_MESHLETS) + getStreamSize(STREAM_MESHLET_INDICES); }
+  VkDeviceSize getVertexPartIdSize() const { return getStreamSize(STREAM_VERTEX_PART_IDS); }
+
+  VkDeviceSize getChunkCount() const
   {
-    VkDeviceSize size = 0;
-    for(size_t i = 0; i < m_chunks.size(); i++)
+    VkDeviceSize count = 0;
+    for(const StreamChunks& streamChunks : m_streams)
     {
-      size += m_chunks[i].trianglePartIds.info.range;
-      size += m_chunks[i].partTriCounts.info.range;
+      count += streamChunks.chunks.size();
     }
-    return size;
+    return count;
   }
 
-  VkDeviceSize getChunkCount() const { return m_chunks.size(); }
-
 private:
-  VkDeviceSize m_alignment;
-  VkDeviceSize m_vboAlignment;
-  VkDeviceSize m_maxVboChunk;
-  VkDeviceSize m_maxIboChunk;
-  VkDeviceSize m_maxIdsChunk;
-  VkDeviceSize m_maxTriOffsetsChunk;
+  struct StreamChunks
+  {
+    VkBufferUsageFlags usage;
+    VkDeviceSize       alignment;
+    VkDeviceSize       maxChunk;
+    VkDeviceSize       padding;  // extra bytes behind every chunk
+    VkDeviceSize       reserve;  // bytes still expected by reserve
+    std::vector<Chunk> chunks;
+  };
 
-  Index getActiveIndex() { return (m_chunks.size() - 1); }
+  StreamChunks m_streams[NUM_STREAMS];
+  bool         m_fixedChunks    = false;
+  bool         m_compactPending = false;
 
-  Chunk& getActiveChunk()
-  {
-    assert(!m_chunks.empty());
-    return m_chunks[getActiveIndex()];
-  }
+  bool allocRange(Stream stream, VkDeviceSize size, Range& range);
+  void addChunk(Stream stream, VkDeviceSize size);
+
+  ResBuffer createChunkBuffer(VkDeviceSize size, VkBufferUsageFlags usage) const;
 };
 
 
@@ -173,16 +242,48 @@ public:
     GeometryMemoryVK::Allocation allocation;
 
     VkDescriptorBufferInfo vbo;
-    VkDescriptorBufferInfo ibo;
-    VkDescriptorBufferInfo trianglePartIds;
+    VkDescriptorBufferInfo ibo;  // 16-bit indices if indexType is VK_INDEX_TYPE_UINT16
+    VkDescriptorBufferInfo trianglePartIds;  // expanded on the device, see trianglePartIdsValid
     VkDescriptorBufferInfo partTriCounts;
     VkDescriptorBufferInfo partTriOffsets;
+    VkDescriptorBufferInfo meshlets;
+    VkDescriptorBufferInfo meshletIndices;
+    VkDescriptorBufferInfo vertexPartIds;
 
     VkDeviceAddress vboAddr;
     VkDeviceAddress iboAddr;
     VkDeviceAddress trianglePartIdsAddr;
     VkDeviceAddress partTriCountsAddr;
     VkDeviceAddress partTriOffsetsAddr;
+    VkDeviceAddress meshletsAddr;
+    VkDeviceAddress meshletIndicesAddr;
+    VkDeviceAddress vertexPartIdsAddr;
+
+    VkIndexType indexType;
+
+    uint32_t numParts;
+    uint32_t numLevels;
+
+    bool     resident;              // allocation is valid and the data was uploaded
+    bool     trianglePartIdsValid;  // expanded from partTriCounts, only once a renderer needs them
+    uint32_t lastRequest;           // Residency::request that last asked for the geometry
+  };
+
+  // only used with a geometry budget
+  struct Residency
+  {
+    VkDeviceSize budget       = 0;
+    VkDeviceSize residentSize = 0;
+    uint32_t     numResident  = 0;
+    uint32_t     request      = 0;
+
+    // of the last requestGeometries
+    uint32_t hits    = 0;
+    uint32_t misses  = 0;
+    uint32_t uploads = 0;
+
+    // since init
+    uint32_t evictions = 0;
   };
 
   struct Buffers
@@ -190,6 +291,8 @@ public:
     ResBuffer materials;
     ResBuffer matrices;
     ResBuffer matricesOrig;
+    ResBuffer dequantNodes;  // CadScene::m_dequantNodes, at least one entry
+    ResBuffer copies;
   };
 
   nvvk::ResourceAllocator* m_resAllocator = nullptr;
@@ -198,7 +301,92 @@ public:
 
   std::vector<Geometry> m_geometry;
   GeometryMemoryVK      m_geometryMem;
-
-  void init(const CadScene& cadscene, nvvk::ResourceAllocator* resAllocator, VkQueue queue, uint32_t queueFamilyIndex);
+  Residency             m_residency;
+
+  // With a transfer queue the geometry data is uploaded by a background thread,
+  // otherwise synchronously on the main queue.
+  // A non-zero geometryBudget limits the geometry memory, see requestGeometries.
+  void init(const CadScene&          cadscene,
+            nvvk::ResourceAllocator* resAllocator,
+            VkQueue                  queue,
+            uint32_t                 queueFamilyIndex,
+            VkQueue                  transferQueue       = VK_NULL_HANDLE,
+            uint32_t                 transferQueueFamily = ~0u,
+            VkDeviceSize             geometryBudget      = 0);
   void deinit();
+
+  // With a budget, geometries only become resident when requested, typically the visible
+  // ones every frame. Uploads as many of the given geometries as the budget allows, evicting
+  // the least recently requested others, and waits for the device idle before evicting.
+  // Returns true if geometries became resident or were evicted.
+  bool requestGeometries(const std::vector<uint32_t>& geometryIndices);
+
+  // Moves resident geometries down into the free ranges left by evictions, up to maxBytes
+  // of copies recorded into cmd, see GeometryMemoryVK::compact. Returns true if geometries
+  // moved, the command buffers using them must then be re-recorded.
+  // Does nothing while uploading or if no geometry was freed since the last pass.
+  bool compactGeometry(VkCommandBuffer cmd, VkDeviceSize maxBytes);
+
+  // polls the background upload, returns true if more geometries became ready. Their data
+  // must be made visible by a memory barrier, in a submission that waits for
+  // getUploadTimeline() to reach waitValue. Once the upload is complete, finishUploads
+  // ends it after that submission finished.
+  bool        updateUploads(uint64_t& waitValue);
+  VkSemaphore getUploadTimeline() const { return m_uploads.timeline; }
+  bool isUploadComplete() const { return m_uploads.timeline && m_uploads.completed == m_uploads.batches.size(); }
+  void finishUploads();
+  bool isUploading() const { return m_uploads.timeline != VK_NULL_HANDLE; }
+  bool isGeometryReady(size_t geometryIndex) const
+  {
+    return m_geometry[geometryIndex].resident
+           && (m_uploads.geometryBatch.empty() || m_uploads.geometryBatch[geometryIndex] < m_uploads.completed);
+  }
+
+private:
+  static const uint32_t     UPLOAD_SLOTS     = 2;
+  static const VkDeviceSize UPLOAD_SLOT_SIZE = 32 * 1024 * 1024;
+
+  // copies into the geometry chunks, batched to fit one staging slot each
+  struct Uploads
+  {
+    struct Piece
+    {
+      VkBuffer     buffer;
+      VkDeviceSize offset;
+      VkDeviceSize size;
+      const void*  data;
+    };
+    struct Batch
+    {
+      size_t firstPiece;
+      size_t numPieces;
+    };
+
+    std::vector<Piece>    pieces;
+    std::vector<Batch>    batches;
+    std::vector<uint32_t> geometryBatch;  // a geometry is ready once its last batch completed
+
+    VkQueue         queue    = VK_NULL_HANDLE;
+    VkCommandPool   cmdPool  = VK_NULL_HANDLE;
+    VkSemaphore     timeline = VK_NULL_HANDLE;  // counts the completed batches
+    VkCommandBuffer cmds[UPLOAD_SLOTS]           = {};
+    ResBuffer       staging[UPLOAD_SLOTS]        = {};
+    void*           stagingMapping[UPLOAD_SLOTS] = {};
+
+    std::thread       thread;
+    std::atomic<bool> abort{false};
+    uint64_t          completed = 0;  // last timeline value seen by the main thread
+
+    std::chrono::steady_clock::time_point startTime;
+  };
+
+  Uploads m_uploads;
+
+  const CadScene* m_cadscene   = nullptr;
+  VkQueue         m_queue       = VK_NULL_HANDLE;
+  uint32_t        m_queueFamily = 0;
+
+  void assignGeometry(size_t geometryIndex);
+  void evictGeometry(size_t geometryIndex);
+  void uploadThread();
 };
@@ -37,20 +37,123 @@
 #define DRAW_SSBO_MATERIAL  2
 #define DRAW_SSBO_RAY       3
 #define DRAW_SSBO_PER_DRAW  4
+#define DRAW_SSBO_SELECTION       5
+#define DRAW_SSBO_SELECTION_SET   6
+#define DRAW_SSBO_SELECTION_MASK  7
+#define DRAW_SSBO_PART_OVERRIDE   8
+#define DRAW_SSBO_PART_COVERAGE   9
+#define DRAW_SSBO_COPIES          10
+
+// set 1, only used by UNIFORMS_TECHNIQUE == UNIFORMS_MULTISETSDYNAMIC
+#define DRAW_UBO_PER_DRAW   0
 
 #define ANIM_UBO              0
 #define ANIM_SSBO_MATRIXOUT   1
 #define ANIM_SSBO_MATRIXORIG  2
+#define ANIM_SSBO_DEQUANT     3
 
 #define ANIMATION_WORKGROUPSIZE 256
 
+// hierarchical-z build, see hiz.comp.glsl
+#define HIZ_TEX_DEPTH   0
+#define HIZ_IMG_SRC     1
+#define HIZ_IMG_DST     2
+
+#define HIZ_WORKGROUPSIZE 8
+#define HIZ_MAX_LEVELS    16
+
+// occlusion culling of the MDI drawcalls, see occlusion_cull.comp.glsl
+#define CULL_SSBO_MATRIX    0
+#define CULL_SSBO_BBOX      1
+#define CULL_SSBO_DRAWINFO  2
+#define CULL_SSBO_INDIRECT  3
+#define CULL_SSBO_DRAWN     4
+#define CULL_SSBO_STATS     5
+#define CULL_TEX_HIZ        6
+#define CULL_SSBO_COPIES    7
+
+#define CULL_WORKGROUPSIZE  64
+
+// early pass tests against last frame's HiZ,
+// late pass tests the remaining draws against the HiZ of the early pass
+#define CULL_PASS_EARLY     0
+#define CULL_PASS_LATE      1
+
+// CullStats indices
+#define CULL_STAT_EARLY     0
+#define CULL_STAT_LATE      1
+#define CULL_STAT_CULLED    2
+#define CULL_STATS_NUM      4
+
+// meshlets of MODE_PER_MESHLET_ID_MS, limits must match CadScene
+#define MESHLET_MAX_VERTICES    64
+#define MESHLET_MAX_TRIANGLES   126
+#define MESHLET_WORKGROUPSIZE   32
+
+// expansion of the per-triangle part ids, one workgroup per part and level
+#define EXPAND_IDS_WORKGROUPSIZE 64
+
+// region selection, see SceneData::selectMode
+#define SELECTION_MODE_NONE   0
+#define SELECTION_MODE_RECT   1
+#define SELECTION_MODE_LASSO  2
+
+// the lasso mask is updated via vkCmdUpdateBuffer, which limits its size
+#define SELECTION_MASK_MAX_BYTES 65536
+
+// PartOverride::flags
+#define PART_OVERRIDE_HIDDEN     1
+#define PART_OVERRIDE_GHOST      2
+#define PART_OVERRIDE_HIGHLIGHT  4
+#define PART_OVERRIDE_COLOR      8
+
+#ifndef USE_PART_OVERRIDES
+#define USE_PART_OVERRIDES 0
+#endif
+
+// some parts are hidden or ghosted, variant picked when recording, see PartOverrides::numCutouts
+#ifndef USE_PART_CUTOUTS
+#define USE_PART_CUTOUTS 0
+#endif
+
+#ifndef USE_PART_COVERAGE
+#define USE_PART_COVERAGE 0
+#endif
+
+// depth-equal pass after the scene that counts the visible pixels per part,
+// with part cutouts it also picks the parts (see drawid_shading.glsl)
+#ifndef PART_COVERAGE_PASS
+#define PART_COVERAGE_PASS 0
+#endif
+
+// model copies drawn as instances of each drawcall, see CadScene::m_copies
+#ifndef USE_INSTANCED_COPIES
+#define USE_INSTANCED_COPIES 0
+#endif
+
+// vertices are fetched from DrawPushData::vboAddr rather than a vertex buffer binding
+#ifndef USE_VERTEX_PULLING
+#define USE_VERTEX_PULLING 0
+#endif
+
+// the mesh shader renderer, also reads DrawPushData::meshletIndicesAddr
+#ifndef MODE_PER_MESHLET_ID_MS
+#define MODE_PER_MESHLET_ID_MS 0
+#endif
+
+// vertices are CadScene::VertexQuantized, see getVertexPosNormal()
+#ifndef USE_QUANTIZED_VERTICES
+#define USE_QUANTIZED_VERTICES 0
+#endif
+
 #ifndef SHADER_PERMUTATION
 #define SHADER_PERMUTATION 1
 #endif
 
 //////////////////////////////////////////////////////////////////////////
 
-// see resources_vk.hpp
+// how the per-draw data is bound when not indexed from a buffer,
+// UNIFORMS_MULTISETSDYNAMIC is used by Renderer::PER_DRAW_UBO_DYNAMIC
 
 #ifndef UNIFORMS_MULTISETSDYNAMIC
 #define UNIFORMS_MULTISETSDYNAMIC 0
@@ -74,6 +177,20 @@ namespace idraster {
 layout(buffer_reference, buffer_reference_align=4) buffer readonly uints_in {
   uint d[];
 };
+layout(buffer_reference, buffer_reference_align=4) buffer writeonly uints_out {
+  uint d[];
+};
+#if USE_QUANTIZED_VERTICES
+// must match CadScene::VertexQuantized, unorm16 position and snorm8 oct-encoded normal
+layout(buffer_reference, buffer_reference_align=8) buffer readonly vertices_in {
+  uvec2 d[];
+};
+#else
+// must match CadScene::Vertex, position and oct-encoded normal bits in w
+layout(buffer_reference, buffer_reference_align=16) buffer readonly vertices_in {
+  vec4 d[];
+};
+#endif
 #endif
 
 struct SceneData {
@@ -91,7 +208,10 @@ struct SceneData {
   float partWeight;
   
   ivec2 mousePos;
-  uvec2 _pad;
+  uint  selectMode;       // SELECTION_MODE_* only set for the frame that performs the selection
+  uint  selectMaskShift;  // lasso mask cells are (1 << selectMaskShift) pixels wide and high
+
+  ivec4 selectRect;       // xy inclusive min, zw exclusive max, in pixels
 };
 
 // poor man's raytraced picking ;)
@@ -120,10 +240,73 @@ struct MaterialData {
   MaterialSide sides[2];
 };
 
+// per unique part index (Object::uniquePartOffset + part), see drawid_shading.glsl
+struct PartOverride {
+  uint  color;  // packUnorm4x8, replaces the diffuse color if PART_OVERRIDE_COLOR is set
+  uint  flags;  // PART_OVERRIDE_*
+};
+
+struct HiZPushData {
+  ivec2 srcSize;
+  ivec2 dstSize;
+  uint  level;
+  uint  samples;
+};
+
+struct CullPushData {
+  mat4  viewProjMatrix;
+  uint  numDraws;
+  uint  pass;       // CULL_PASS_*
+  uint  useHiZ;     // 0 if the HiZ content is not valid yet, all draws in the frustum pass
+  uint  hizLevels;
+  vec2  hizSize;
+  uint  numCopies;  // instances per drawcall, a drawcall is kept if any copy is visible
+  uint  _pad;
+};
+
+// per geometry, the levels of detail follow each other in all three streams
+struct ExpandIdsPushData {
+  BUFFER_REFERENCE(uints_out, trianglePartIdsAddr);
+  BUFFER_REFERENCE(uints_in, partTriCountsAddr);
+  BUFFER_REFERENCE(uints_in, partTriOffsetsAddr);  // relative to the level
+  uint  numParts;
+  uint  numLevels;
+};
+
+// must match cadscene
+struct CopyData {
+  vec3  shift;
+  uint  partOffset;
+};
+
+// must match CadScene::Meshlet
+struct MeshletDesc {
+  vec4  sphere;       // object space bounding sphere
+  uint  dataOffset;   // vertex indices, followed by 3 x 8-bit local indices per triangle
+  uint  counts;       // numVertices | numTriangles << 16
+  uint  partIndex;
+  uint  cone;         // packSnorm4x8 of the normal cone axis and cutoff
+};
+
+// per MDI drawcall
+struct CullDrawInfo {
+  uint  matrixIndex;
+  uint  geometryIndex;
+};
+
+// placeholder of an object whose geometry is not resident, see bbox.vert.glsl
+struct BBoxPushData {
+  vec3  bboxMin;
+  uint  matrixIndex;
+  vec3  bboxMax;
+  uint  _pad;
+};
+
 struct AnimationData {
   uint    numMatrices;
   float   time;
-  vec2   _pad0;
+  uint    numNodes;   // matrices past the nodes have a dequantization folded in, see CadScene::m_dequantNodes
+  uint   _pad0;
 
   vec3    sceneCenter;
   float   sceneDimension;
@@ -148,7 +331,23 @@ struct DrawPushData
   // - MODE_PER_TRI_ID*: trianglePartIds - per-triangle part IDs
   // - MODE_PER_TRI_*BATCH_PART_SEARCH*: partTriCounts - per-part triangle counts
   // - MODE_PER_TRI_*GLOBAL_PART_SEARCH*: partTriOffsets - running per-part triangle offsets
+  // - MODE_PER_MESHLET_ID_MS: meshlets - MeshletDesc with the part ID per meshlet
+  // - MODE_PER_VERTEX_PART_ID_FS: vertexPartIds - per-vertex part IDs, indexed without the vertexOffset
   BUFFER_REFERENCE(uints_in, idsAddr);
+
+  // The remaining addresses are only declared by the shaders that read them. The host
+  // sizes the per-draw buffer, uniform slots and push constants to match, see
+  // RendererVK::getDrawDataSize.
+
+#if defined(__cplusplus) || USE_VERTEX_PULLING || MODE_PER_MESHLET_ID_MS
+  // Only used with USE_VERTEX_PULLING and MODE_PER_MESHLET_ID_MS: the geometry's vertices
+  BUFFER_REFERENCE(vertices_in, vboAddr);
+#endif
+
+#if defined(__cplusplus) || MODE_PER_MESHLET_ID_MS
+  // Only used by mesh shaders: the meshlets' vertex indices and triangles
+  BUFFER_REFERENCE(uints_in, meshletIndicesAddr);
+#endif
 };
 
 #ifdef __cplusplus
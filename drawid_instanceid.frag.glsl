@@ -26,6 +26,7 @@
 #extension GL_EXT_scalar_block_layout : enable
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
 #extension GL_EXT_shader_atomic_int64 : enable
+#extension GL_KHR_shader_subgroup_ballot : enable
 
 #include "common.h"
 #include "per_draw_inputs.glsl"
@@ -46,6 +47,30 @@ layout(set=0, binding=DRAW_SSBO_RAY, scalar) buffer coherent rayBuffer {
   RayData   ray;
 };
 
+layout(set=0, binding=DRAW_SSBO_SELECTION, std430) buffer coherent selectionBuffer {
+  uint  selectionBits[];
+};
+
+layout(set=0, binding=DRAW_SSBO_SELECTION_SET, std430) readonly buffer selectionSetBuffer {
+  uint  selectionSet[];
+};
+
+layout(set=0, binding=DRAW_SSBO_SELECTION_MASK, std430) readonly buffer selectionMaskBuffer {
+  uint  selectionMask[];
+};
+
+#if USE_PART_OVERRIDES
+layout(set=0, binding=DRAW_SSBO_PART_OVERRIDE, std430) readonly buffer partOverrideBuffer {
+  PartOverride  partOverrides[];
+};
+#endif
+
+#if PART_COVERAGE_PASS
+layout(set=0, binding=DRAW_SSBO_PART_COVERAGE, std430) buffer partCoverageBuffer {
+  uint  partCoverage[];
+};
+#endif
+
 ///////////////////////////////////////////////////////////
 // Input
 
@@ -57,7 +82,13 @@ layout(location=0) in Interpolants {
 
 // we are using an atomic for the raytest, which means earlyZ would be skipped
 // but that is not our intent
+// Hidden or ghosted part overrides rely on discard, which must happen before
+// the depth write, so while some exist the scene pass falls back to late depth
+// testing and leaves the picking atomics to the coverage pass (see PICK_IN_COVERAGE_PASS).
+// The coverage pass does not write depth and must only see visible fragments.
+#if !USE_PART_CUTOUTS || PART_COVERAGE_PASS
 layout(early_fragment_tests) in;
+#endif
 
 ///////////////////////////////////////////////////////////
 // Output
@@ -43,11 +43,14 @@ layout(set=0, binding=DRAW_SSBO_MATRIX, scalar) buffer matrixBuffer {
 ///////////////////////////////////////////////////////////
 // Input
 
-in layout(location = ATTRIB_VERTEX_POS_OCTNORMAL) vec4 inPosNormal;
+// see getVertexPosNormal()
 
 ///////////////////////////////////////////////////////////
 // Output
 
+// the depth-equal PART_COVERAGE_PASS pipeline must reproduce the depth of the scene pass
+invariant gl_Position;
+
 layout(location=0) out Interpolants {
   vec3 wPos;
   vec3 wNormal;
@@ -74,11 +77,12 @@ vec2 float32x3_to_oct(in vec3 v) {
 
 void main()
 {
+  vec4 inPosNormal = getVertexPosNormal();
   vec3 inNormal = oct_to_float32x3(unpackSnorm2x16(floatBitsToUint(inPosNormal.w)));
 
   MatrixData matrix = matrices[getMatrixIndex()];
 
-  vec3 wPos     = (matrix.worldMatrix   * vec4(inPosNormal.xyz,1)).xyz;
+  vec3 wPos     = (matrix.worldMatrix   * vec4(inPosNormal.xyz,1)).xyz + getCopyShift();
   vec3 wNormal  = mat3(matrix.worldMatrixIT) * inNormal;
 
   gl_Position   = scene.viewProjMatrix * vec4(wPos,1);
@@ -90,4 +94,7 @@ void main()
 #ifndef USE_PUSHCONSTANTS
   OUT_DRAWID.drawId = getDrawId();
 #endif
+#if USE_INSTANCED_COPIES
+  OUT_COPYID.partOffset = getCopyPartOffset();
+#endif
 }
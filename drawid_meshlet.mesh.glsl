@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#version 460 core
+/**/
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_buffer_reference : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
+#extension GL_EXT_mesh_shader : require
+
+#include "common.h"
+#include "per_draw_inputs.glsl"
+
+///////////////////////////////////////////////////////////
+// Bindings
+
+layout(set=0, binding=DRAW_UBO_SCENE, scalar) uniform sceneBuffer {
+  SceneData   scene;
+};
+
+layout(set=0, binding=DRAW_SSBO_MATRIX, scalar) buffer matrixBuffer {
+  MatrixData    matrices[];
+};
+
+layout(buffer_reference, buffer_reference_align=16, scalar) buffer readonly meshlets_in {
+  MeshletDesc d[];
+};
+
+///////////////////////////////////////////////////////////
+// Input
+// one workgroup per meshlet, PUSH.flexible is the first meshlet of the drawcall
+
+layout(local_size_x=MESHLET_WORKGROUPSIZE) in;
+
+///////////////////////////////////////////////////////////
+// Output
+
+layout(max_vertices=MESHLET_MAX_VERTICES, max_primitives=MESHLET_MAX_TRIANGLES) out;
+layout(triangles) out;
+
+// the depth-equal PART_COVERAGE_PASS pipeline must reproduce the depth of the scene pass
+out gl_MeshPerVertexEXT {
+  invariant vec4 gl_Position;
+} gl_MeshVerticesEXT[];
+
+layout(location=0) out Interpolants {
+  vec3 wPos;
+  vec3 wNormal;
+} OUT[];
+
+///////////////////////////////////////////////////////////
+
+// oct functions from http://jcgt.org/published/0003/02/01/paper.pdf
+vec2 oct_signNotZero(vec2 v) {
+  return vec2((v.x >= 0.0) ? +1.0 : -1.0, (v.y >= 0.0) ? +1.0 : -1.0);
+}
+vec3 oct_to_float32x3(vec2 e) {
+  vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0) v.xy = (1.0 - abs(v.yx)) * oct_signNotZero(v.xy);
+  return normalize(v);
+}
+
+void main()
+{
+  meshlets_in meshlets = meshlets_in(uint64_t(PUSH.idsAddr));
+  MeshletDesc meshlet  = meshlets.d[PUSH.flexible + gl_WorkGroupID.x];
+
+  uint numVertices  = meshlet.counts & 0xFFFF;
+  uint numTriangles = meshlet.counts >> 16;
+
+  MatrixData matrix    = matrices[getMatrixIndex()];
+  vec3       copyShift = getCopyShift();
+
+  // Cone culling in object space. The inverse transpose is not affected by the
+  // dequantization of USE_QUANTIZED_VERTICES, its transpose is the inverse of the
+  // original world matrix.
+  vec3 oViewPos = (vec4(scene.viewPos.xyz - copyShift, 1) * matrix.worldMatrixIT).xyz;
+  vec4 cone     = unpackSnorm4x8(meshlet.cone);
+  vec3 toCenter = meshlet.sphere.xyz - oViewPos;
+  if(dot(toCenter, cone.xyz) >= cone.w * length(toCenter) + meshlet.sphere.w)
+  {
+    SetMeshOutputsEXT(0, 0);
+    return;
+  }
+
+  SetMeshOutputsEXT(numVertices, numTriangles);
+
+  uints_in    meshletIndices = PUSH.meshletIndicesAddr;
+  vertices_in vertices       = PUSH.vboAddr;
+
+  for(uint v = gl_LocalInvocationID.x; v < numVertices; v += MESHLET_WORKGROUPSIZE)
+  {
+    uint vertexIndex = meshletIndices.d[meshlet.dataOffset + v];
+#if USE_QUANTIZED_VERTICES
+    vec4 inPosNormal = decodeVertex(vertices.d[vertexIndex]);
+#else
+    vec4 inPosNormal = vertices.d[vertexIndex];
+#endif
+    vec3 inNormal = oct_to_float32x3(unpackSnorm2x16(floatBitsToUint(inPosNormal.w)));
+
+    vec3 wPos = (matrix.worldMatrix * vec4(inPosNormal.xyz,1)).xyz + copyShift;
+
+    gl_MeshVerticesEXT[v].gl_Position = scene.viewProjMatrix * vec4(wPos,1);
+    OUT[v].wPos    = wPos;
+    OUT[v].wNormal = mat3(matrix.worldMatrixIT) * inNormal;
+  #if USE_INSTANCED_COPIES
+    OUT_COPYID[v].partOffset = getCopyPartOffset();
+  #endif
+  }
+
+  for(uint t = gl_LocalInvocationID.x; t < numTriangles; t += MESHLET_WORKGROUPSIZE)
+  {
+    uint packed = meshletIndices.d[meshlet.dataOffset + numVertices + t];
+    gl_PrimitiveTriangleIndicesEXT[t] = uvec3(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF);
+
+    // the whole meshlet is within one part, the fragment shader reads it back
+    gl_MeshPrimitivesEXT[t].gl_PrimitiveID = int(meshlet.partIndex);
+  }
+}
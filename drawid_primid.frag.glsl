@@ -26,12 +26,21 @@
 #extension GL_EXT_scalar_block_layout : enable
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
 #extension GL_EXT_shader_atomic_int64 : enable
+#extension GL_KHR_shader_subgroup_ballot : enable
 #extension GL_EXT_control_flow_attributes : enable
 
 #ifndef SEARCH_COUNT
 #define SEARCH_COUNT 8
 #endif
 
+#ifndef MODE_PER_MESHLET_ID_MS
+#define MODE_PER_MESHLET_ID_MS 0
+#endif
+
+#ifndef MODE_PER_VERTEX_PART_ID_FS
+#define MODE_PER_VERTEX_PART_ID_FS 0
+#endif
+
 // 1/0 toggle for a guess plus exponential search
 #ifndef GLOBAL_GUESS
 #error GLOBAL_GUESS not set
@@ -78,6 +87,30 @@ layout(set=0, binding=DRAW_SSBO_RAY, scalar) buffer coherent rayBuffer {
   RayData   ray;
 };
 
+layout(set=0, binding=DRAW_SSBO_SELECTION, std430) buffer coherent selectionBuffer {
+  uint  selectionBits[];
+};
+
+layout(set=0, binding=DRAW_SSBO_SELECTION_SET, std430) readonly buffer selectionSetBuffer {
+  uint  selectionSet[];
+};
+
+layout(set=0, binding=DRAW_SSBO_SELECTION_MASK, std430) readonly buffer selectionMaskBuffer {
+  uint  selectionMask[];
+};
+
+#if USE_PART_OVERRIDES
+layout(set=0, binding=DRAW_SSBO_PART_OVERRIDE, std430) readonly buffer partOverrideBuffer {
+  PartOverride  partOverrides[];
+};
+#endif
+
+#if PART_COVERAGE_PASS
+layout(set=0, binding=DRAW_SSBO_PART_COVERAGE, std430) buffer partCoverageBuffer {
+  uint  partCoverage[];
+};
+#endif
+
 ///////////////////////////////////////////////////////////
 // Input
 
@@ -86,15 +119,28 @@ layout(location=0) in Interpolants {
   vec3 wNormal;
 } IN;
 
-#ifdef USE_PUSHCONSTANTS
+// the mesh shader passes the part index as gl_PrimitiveID instead
+#if defined(USE_PUSHCONSTANTS) && !MODE_PER_MESHLET_ID_MS && !MODE_PER_VERTEX_PART_ID_FS
 layout(location=2) in Id {
   flat uint idsOffset;
 } IN_ID;
 #endif
 
+#if MODE_PER_VERTEX_PART_ID_FS
+layout(location=5) in PartId {
+  flat uint partIndex;
+} IN_PART;
+#endif
+
 // we are using an atomic for the raytest, which means earlyZ would be skipped
 // but that is not our intent
+// Hidden or ghosted part overrides rely on discard, which must happen before
+// the depth write, so while some exist the scene pass falls back to late depth
+// testing and leaves the picking atomics to the coverage pass (see PICK_IN_COVERAGE_PASS).
+// The coverage pass does not write depth and must only see visible fragments.
+#if !USE_PART_CUTOUTS || PART_COVERAGE_PASS
 layout(early_fragment_tests) in;
+#endif
 
 ///////////////////////////////////////////////////////////
 // Output
@@ -105,6 +151,7 @@ layout(location=0,index=0) out vec4 out_Color;
 
 #include "drawid_shading.glsl"
 
+#if !MODE_PER_MESHLET_ID_MS && !MODE_PER_VERTEX_PART_ID_FS
 uint getIdsOffset()
 {
 #ifdef USE_PUSHCONSTANTS
@@ -113,10 +160,24 @@ uint getIdsOffset()
     return perDrawData[getDrawId()].flexible;
 #endif
 }
+#endif
 
 void main()
 {
-#if SEARCH_COUNT
+#if MODE_PER_MESHLET_ID_MS
+
+  // Meshlets never cross a part boundary, the mesh shader writes the part of
+  // the meshlet as gl_PrimitiveID. No lookup or search is needed.
+  int partIndex = gl_PrimitiveID;
+
+#elif MODE_PER_VERTEX_PART_ID_FS
+
+  // Vertices shared by several parts were split at load, so all vertices of a
+  // triangle carry the same part index. The flat value of the provoking vertex
+  // is used, no per-triangle ids are fetched.
+  int partIndex = int(IN_PART.partIndex);
+
+#elif SEARCH_COUNT
   // find which partIndex we are based on the gl_PrimitiveIDIn which spans
   // multiple parts.
 
@@ -26,6 +26,10 @@
 #extension GL_EXT_scalar_block_layout : enable
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
 
+#ifndef MODE_PER_VERTEX_PART_ID_FS
+#define MODE_PER_VERTEX_PART_ID_FS 0
+#endif
+
 #include "common.h"
 #include "per_draw_inputs.glsl"
 
@@ -42,22 +46,33 @@ layout(set=0, binding=DRAW_SSBO_MATRIX, scalar) buffer matrixBuffer {
 
 ///////////////////////////////////////////////////////////
 // Input
-in layout(location = ATTRIB_VERTEX_POS_OCTNORMAL) vec4 inPosNormal;
+// see getVertexPosNormal()
 
 ///////////////////////////////////////////////////////////
 // Output
 
+// the depth-equal PART_COVERAGE_PASS pipeline must reproduce the depth of the scene pass
+invariant gl_Position;
+
 layout(location=0) out Interpolants {
   vec3 wPos;
   vec3 wNormal;
 } OUT;
 
-#ifdef USE_PUSHCONSTANTS
+#if defined(USE_PUSHCONSTANTS) && !MODE_PER_VERTEX_PART_ID_FS
 layout(location=2) out Id {
   flat uint idsOffset;
 } OUT_ID;
 #endif
 
+#if MODE_PER_VERTEX_PART_ID_FS
+// the same for all vertices of a triangle, the fragment shader gets the
+// one of the provoking vertex
+layout(location=5) out PartId {
+  flat uint partIndex;
+} OUT_PART;
+#endif
+
 ///////////////////////////////////////////////////////////
 
 // oct functions from http://jcgt.org/published/0003/02/01/paper.pdf
@@ -78,20 +93,29 @@ vec2 float32x3_to_oct(in vec3 v) {
 
 void main()
 {
+  vec4 inPosNormal = getVertexPosNormal();
   vec3 inNormal = oct_to_float32x3(unpackSnorm2x16(floatBitsToUint(inPosNormal.w)));
 
   MatrixData matrix = matrices[getMatrixIndex()];
 
-  vec3 wPos     = (matrix.worldMatrix   * vec4(inPosNormal.xyz,1)).xyz;
+  vec3 wPos     = (matrix.worldMatrix   * vec4(inPosNormal.xyz,1)).xyz + getCopyShift();
   vec3 wNormal  = mat3(matrix.worldMatrixIT) * inNormal;
 
   gl_Position   = scene.viewProjMatrix * vec4(wPos,1);  
   OUT.wPos      = wPos;
   OUT.wNormal   = wNormal;
   
-  #ifdef USE_PUSHCONSTANTS
-    OUT_ID.idsOffset = gl_InstanceIndex;
-  #else
+  #if MODE_PER_VERTEX_PART_ID_FS
+    // PUSH.idsAddr points to vertexPartIds, which are indexed like the geometry's
+    // vertices, hence without the vertexOffset of the drawcall
+    OUT_PART.partIndex = getIdsAddress().d[gl_VertexIndex - gl_BaseVertex];
+  #endif
+  #if defined(USE_PUSHCONSTANTS) && !MODE_PER_VERTEX_PART_ID_FS
+    OUT_ID.idsOffset = getBaseInstance();
+  #elif !defined(USE_PUSHCONSTANTS)
     OUT_DRAWID.drawId = getDrawId();
   #endif
+  #if USE_INSTANCED_COPIES
+    OUT_COPYID.partOffset = getCopyPartOffset();
+  #endif
 }
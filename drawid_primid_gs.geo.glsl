@@ -73,6 +73,8 @@ layout(triangles) in;
   layout(triangle_strip) out;
   layout(max_vertices=3) out;
 
+  invariant gl_Position;
+
   layout(location=0) in Inputs {
     vec3 wPos;
     vec3 wNormal;
@@ -155,6 +157,9 @@ void main()
 #if !USE_GEOMETRY_SHADER_PASSTHROUGH
 #ifndef USE_PUSHCONSTANTS
   OUT_DRAWID.drawId = getDrawId();
+#endif
+#if USE_INSTANCED_COPIES
+  OUT_COPYID.partOffset = getCopyPartOffset();
 #endif
   [[unroll]]
   for (int i = 0; i < 3; i++) {
@@ -17,6 +17,54 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+// Hidden or ghosted part overrides need late depth tests for their discard, so occluded
+// fragments of the scene pass would pick parts as well. The depth-equal coverage pass
+// only sees the visible surface and does the picking instead, but only while such
+// overrides exist. Otherwise the scene pass keeps early depth tests and picks itself.
+#define PICK_IN_COVERAGE_PASS USE_PART_CUTOUTS
+
+// partIndex is the unique one
+void pickPart(uint partIndex)
+{
+  // simple ray selection:
+
+  // if this fragment coordinate matches the mouse cursor
+  // we do a 64-bit atomicMin to find the closest surface (lowest depth value)
+  // and we store the unique partIndex 
+  if (all(equal(ivec2(gl_FragCoord.xy), scene.mousePos))) 
+  {
+    // pack partIndex in lower  32-bit
+    //      depth     in higher 32-bit
+    atomicMin(ray.mouseHit, packUint2x32(uvec2(partIndex, floatBitsToUint(gl_FragCoord.z))) );
+  }
+
+  // region selection:
+
+  // while a selection is performed, every fragment within the region sets the bit
+  // of its unique partIndex. The region is either the rectangle or the lasso mask,
+  // the rectangle is the lasso's bounding box in that case.
+  if (scene.selectMode != SELECTION_MODE_NONE)
+  {
+    uint selectionWord = partIndex / 32;
+    uint selectionBit  = 1u << (partIndex % 32);
+
+    ivec2 coord  = ivec2(gl_FragCoord.xy);
+    bool  inside = all(greaterThanEqual(coord, scene.selectRect.xy)) && all(lessThan(coord, scene.selectRect.zw));
+    if (inside && scene.selectMode == SELECTION_MODE_LASSO)
+    {
+      uint cellsPerRow = (uint(scene.viewport.x) + (1u << scene.selectMaskShift) - 1) >> scene.selectMaskShift;
+      uvec2 cell       = uvec2(coord) >> scene.selectMaskShift;
+      uint  cellIndex  = cell.y * cellsPerRow + cell.x;
+      inside = (selectionMask[cellIndex / 32] & (1u << (cellIndex % 32))) != 0;
+    }
+    // avoid the atomic if another fragment already did the work
+    if (inside && (selectionBits[selectionWord] & selectionBit) == 0)
+    {
+      atomicOr(selectionBits[selectionWord], selectionBit);
+    }
+  }
+}
+
 vec4 shading(uint partIndex)
 {
   // partIndex is a running index for each geometry.
@@ -25,6 +73,52 @@ vec4 shading(uint partIndex)
   // (otherwise every first part of any geometry will have the same index)
   partIndex += getUniquePartOffset();
 
+#if USE_PART_OVERRIDES
+  // per-part overrides are edited on the host and uploaded as dirty ranges
+  // (see ResourcesVK::cmdPartOverridesUpdate). Hiding parts re-records the renderer,
+  // to skip fully hidden draws and to switch to the USE_PART_CUTOUTS variant.
+  PartOverride partOverride = partOverrides[partIndex];
+#if USE_PART_CUTOUTS
+  if ((partOverride.flags & PART_OVERRIDE_HIDDEN) != 0)
+  {
+    discard;
+  }
+  // ghosting uses a screen-door pattern, so it needs no sorting or blending
+  if ((partOverride.flags & PART_OVERRIDE_GHOST) != 0 && ((int(gl_FragCoord.x) ^ int(gl_FragCoord.y)) & 1) != 0)
+  {
+    discard;
+  }
+#endif
+#endif
+
+#if PART_COVERAGE_PASS
+#if PICK_IN_COVERAGE_PASS
+  pickPart(partIndex);
+#endif
+#if USE_PART_COVERAGE
+  // Only fragments matching the final depth of the scene pass survive the
+  // depth-equal test. Neighboring fragments mostly belong to the same part,
+  // so aggregate within the subgroup and issue one atomic per distinct part.
+  if (!gl_HelperInvocation)
+  {
+    for (;;)
+    {
+      uint firstPart = subgroupBroadcastFirst(partIndex);
+      if (firstPart == partIndex)
+      {
+        uint count = subgroupBallotBitCount(subgroupBallot(true));
+        if (subgroupElect())
+        {
+          atomicAdd(partCoverage[partIndex], count);
+        }
+        break;
+      }
+    }
+  }
+#endif
+  return vec4(0);
+#endif
+
 #if COLORIZE_DRAWS
   MaterialSide side;
   side.diffuse = unpackUnorm4x8(murmurHash(getMaterialIndex()));
@@ -56,23 +150,24 @@ vec4 shading(uint partIndex)
   ldot   *= sign(ldot);
 
   // (sin(scene.time * 2) * 0.5 + 0.5) * 0.7 + 0.1
-  color += mix(side.diffuse, unpackUnorm4x8(murmurHash(partIndex)), scene.partWeight) * ldot;
+  vec4 diffuse = mix(side.diffuse, unpackUnorm4x8(murmurHash(partIndex)), scene.partWeight);
+#if USE_PART_OVERRIDES
+  if ((partOverride.flags & PART_OVERRIDE_COLOR) != 0)
+  {
+    diffuse = unpackUnorm4x8(partOverride.color);
+  }
+#endif
+  color += diffuse * ldot;
   color += side.specular * pow(max(0,dot(normal,halfDir)),16);
   
 #if 1
   // simple ray selection highlight:
-  
-  // if this fragment coordinate matches the mouse cursor
-  // we do a 64-bit atomicMin to find the closest surface (lowest depth value)
-  // and we store the unique partIndex 
-  if (all(equal(ivec2(gl_FragCoord.xy), scene.mousePos))) 
-  {
-    // pack partIndex in lower  32-bit
-    //      depth     in higher 32-bit
-    atomicMin(ray.mouseHit, packUint2x32(uvec2(partIndex, floatBitsToUint(gl_FragCoord.z))) );
-  }
-  
-  // rayLast is the result of the above logic from last frame.
+
+#if !PICK_IN_COVERAGE_PASS
+  pickPart(partIndex);
+#endif
+
+  // rayLast is the result of pickPart from last frame.
   // We cannot use the same frame's result, because as we raster the various triangles
   // the result will change.
   // If the current partIndex matches the one that was the closest in the last
@@ -85,5 +180,26 @@ vec4 shading(uint partIndex)
   }
 #endif
 
+#if 1
+  // region selection highlight:
+
+  uint selectionWord = partIndex / 32;
+  uint selectionBit  = 1u << (partIndex % 32);
+
+  // selectionSet is the result of the last selection, copied after rendering
+  // (see ResourcesVK::cmdSelectionEnd)
+  if ((selectionSet[selectionWord] & selectionBit) != 0)
+  {
+    color = mix(color, vec4(1.0, 0.6, 0.1, 1.0), 0.6);
+  }
+#endif
+
+#if USE_PART_OVERRIDES
+  if ((partOverride.flags & PART_OVERRIDE_HIGHLIGHT) != 0)
+  {
+    color = mix(color, vec4(0.1, 0.8, 1.0, 1.0), 0.5);
+  }
+#endif
+
   return color;
 }
\ No newline at end of file
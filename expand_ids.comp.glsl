@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_buffer_reference : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
+
+#include "common.h"
+
+// Expands the per-part triangle counts and offsets of one geometry into the
+// per-triangle part ids used by MODE_PER_TRI_ID*. Each workgroup fills the
+// triangle range of a part, gl_WorkGroupID.y is the level of detail.
+
+layout (local_size_x = EXPAND_IDS_WORKGROUPSIZE) in;
+
+layout(push_constant, scalar) uniform pushConstants {
+  ExpandIdsPushData PUSH;
+};
+
+void main()
+{
+  uints_out trianglePartIds = PUSH.trianglePartIdsAddr;
+  uints_in  partTriCounts   = PUSH.partTriCountsAddr;
+  uints_in  partTriOffsets  = PUSH.partTriOffsetsAddr;
+
+  uint level = gl_WorkGroupID.y;
+
+  // the offsets restart at every level, the level begins after the last
+  // part of the previous ones
+  uint levelBegin = 0;
+  for (uint l = 0; l < level; l++)
+  {
+    uint last = (l + 1) * PUSH.numParts - 1;
+    levelBegin += partTriOffsets.d[last] + partTriCounts.d[last];
+  }
+
+  // there may be more parts than workgroups
+  for (uint p = gl_WorkGroupID.x; p < PUSH.numParts; p += gl_NumWorkGroups.x)
+  {
+    uint idx   = level * PUSH.numParts + p;
+    uint count = partTriCounts.d[idx];
+    uint begin = levelBegin + partTriOffsets.d[idx];
+    for (uint i = gl_LocalInvocationID.x; i < count; i += EXPAND_IDS_WORKGROUPSIZE)
+    {
+      trianglePartIds.d[begin + i] = p;
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_buffer_reference : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
+
+#include "common.h"
+
+// Builds one level of the HiZ pyramid, storing the farthest depth.
+// Level 0 reduces the depth buffer into a power-of-two sized image,
+// every other level reduces 2x2 texels of the previous one.
+
+#ifndef HIZ_MSAA
+#define HIZ_MSAA 0
+#endif
+
+layout (local_size_x = HIZ_WORKGROUPSIZE, local_size_y = HIZ_WORKGROUPSIZE) in;
+
+#if HIZ_MSAA
+layout(binding=HIZ_TEX_DEPTH) uniform sampler2DMS texDepth;
+#else
+layout(binding=HIZ_TEX_DEPTH) uniform sampler2D texDepth;
+#endif
+
+layout(binding=HIZ_IMG_SRC, r32f) uniform readonly image2D imgSrc;
+layout(binding=HIZ_IMG_DST, r32f) uniform writeonly image2D imgDst;
+
+layout(push_constant, scalar) uniform pushConstants {
+  HiZPushData PUSH;
+};
+
+float fetchDepth(ivec2 coord)
+{
+#if HIZ_MSAA
+  float depth = 0;
+  for (int s = 0; s < int(PUSH.samples); s++)
+  {
+    depth = max(depth, texelFetch(texDepth, coord, s).r);
+  }
+  return depth;
+#else
+  return texelFetch(texDepth, coord, 0).r;
+#endif
+}
+
+void main()
+{
+  ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(coord, PUSH.dstSize))) {
+    return;
+  }
+
+  float depth = 0;
+  if (PUSH.level == 0)
+  {
+    // the texel covers a non-integer pixel footprint, take all touched pixels
+    ivec2 begin = (coord * PUSH.srcSize) / PUSH.dstSize;
+    ivec2 end   = min(((coord + 1) * PUSH.srcSize + PUSH.dstSize - 1) / PUSH.dstSize, PUSH.srcSize);
+    for (int y = begin.y; y < end.y; y++)
+    {
+      for (int x = begin.x; x < end.x; x++)
+      {
+        depth = max(depth, fetchDepth(ivec2(x,y)));
+      }
+    }
+  }
+  else
+  {
+    ivec2 srcMax = PUSH.srcSize - 1;
+    ivec2 src    = coord * 2;
+    depth = max(depth, imageLoad(imgSrc, min(src + ivec2(0,0), srcMax)).r);
+    depth = max(depth, imageLoad(imgSrc, min(src + ivec2(1,0), srcMax)).r);
+    depth = max(depth, imageLoad(imgSrc, min(src + ivec2(0,1), srcMax)).r);
+    depth = max(depth, imageLoad(imgSrc, min(src + ivec2(1,1), srcMax)).r);
+  }
+
+  imageStore(imgDst, coord, vec4(depth));
+}
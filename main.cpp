@@ -34,14 +34,57 @@
 
 #include <algorithm>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
 #include "renderer.hpp"
 #include "resources_vk.hpp"
 #include <glm/gtc/matrix_access.hpp>
+#include <glm/gtc/packing.hpp>
 
 namespace idraster {
 int const SAMPLE_SIZE_WIDTH(1024);
 int const SAMPLE_SIZE_HEIGHT(768);
 
+// resident memory of the process in bytes, current and peak
+static void getProcessMemory(size_t& current, size_t& peak)
+{
+  current = 0;
+  peak    = 0;
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters = {sizeof(counters)};
+  if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+  {
+    current = counters.WorkingSetSize;
+    peak    = counters.PeakWorkingSetSize;
+  }
+#else
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    peak = size_t(usage.ru_maxrss) * 1024;  // KB on linux
+  }
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if(statm)
+  {
+    long pages = 0;
+    if(fscanf(statm, "%*ld %ld", &pages) == 1)
+    {
+      current = size_t(pages) * size_t(sysconf(_SC_PAGESIZE));
+    }
+    fclose(statm);
+  }
+#endif
+}
+
 class Sample : public nvvk::AppWindowProfilerVK
 {
 
@@ -50,21 +93,33 @@ class Sample : public nvvk::AppWindowProfilerVK
     GUI_RENDERER,
     GUI_PERDRAWMODE,
     GUI_MSAA,
+    GUI_SELECTION,
   };
 
 public:
   struct Tweak
   {
-    int              renderer      = 0;
-    int              msaa          = 4;
-    int              copies        = 1;
-    bool             animation     = false;
-    bool             animationSpin = false;
-    int              cloneaxisX    = 1;
-    int              cloneaxisY    = 1;
-    int              cloneaxisZ    = 1;
-    float            percent       = 1.001f;
-    float            partWeight    = 0.3f;
+    int              renderer         = 0;
+    int              msaa             = 4;
+    int              copies           = 1;
+    bool             instancedCopies  = false;
+    int              geometryBudget   = 0;  // MB, 0 keeps all geometry resident
+    bool             optimizeGeometry = false;
+    bool             quantizeVertices = false;
+    bool             deduplicate      = false;
+    int              lods             = 1;  // levels of detail per geometry, including the full detail
+    bool             meshlets         = false;
+    bool             splitVertices    = false;  // per-vertex part ids
+    bool             releaseGeometry  = false;  // drop the host geometry once on the device
+    bool             animation        = false;
+    bool             animationSpin    = false;
+    int              cloneaxisX       = 1;
+    int              cloneaxisY       = 1;
+    int              cloneaxisZ       = 1;
+    float            percent          = 1.001f;
+    float            partWeight       = 0.3f;
+    int              selectionTool    = SELECTION_MODE_NONE;
+    bool             selectionAdd     = false;
     Renderer::Config config;
   };
 
@@ -100,8 +155,38 @@ public:
   double m_statsGpuDrawTime  = 0;
   double m_statsGpuBuildTime = 0;
 
+  VkPhysicalDeviceMultiDrawFeaturesEXT  m_multiDrawFeatures  = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_FEATURES_EXT};
+  VkPhysicalDeviceMeshShaderFeaturesEXT m_meshShaderFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT};
+
+  // region selection
+  bool                   m_selectDragging  = false;
+  bool                   m_selectClear     = false;
+  std::vector<glm::vec2> m_selectPoints;  // drag start and lasso outline in pixels
+  std::vector<uint32_t>  m_selectMask;
+  uint32_t               m_selectMaskShift = 0;
+  glm::ivec4             m_selectRect      = glm::ivec4(0);
+  std::vector<uint32_t>  m_selectedParts;
+  uint32_t               m_selectLatency   = 0;
+
+  glm::vec3 m_overrideColor = glm::vec3(1.0f, 0.2f, 0.2f);
+
+  // per-part coverage
+  int                                  m_coverageTopN    = 8;
+  std::vector<Resources::PartCoverage> m_coverageTop;
+  uint32_t                             m_coverageVisible = 0;
+  uint32_t                             m_coverageLatency = 0;
+
   bool initProgram();
-  bool initScene(const char* filename, int clones, int cloneaxis);
+  bool initScene(const char* filename,
+                 int         clones,
+                 int         cloneaxis,
+                 bool        instancedCopies,
+                 bool        optimizeGeometry,
+                 bool        quantizeVertices,
+                 bool        deduplicate,
+                 int         lods,
+                 bool        meshlets,
+                 bool        splitVertices);
   bool initFramebuffers(int width, int height);
   void initRenderer(int type);
   void deinitRenderer();
@@ -109,6 +194,9 @@ public:
   void setupConfigParameters();
   void setRendererFromName();
 
+  int  updateSelection(int width, int height);
+  void applyPartOverride(uint32_t flags);
+
   template <typename T>
   bool tweakChanged(const T& val)
   {
@@ -121,6 +209,8 @@ public:
   {
     setupConfigParameters();
     m_contextInfo.addDeviceExtension(VK_NV_GEOMETRY_SHADER_PASSTHROUGH_EXTENSION_NAME, true);
+    m_contextInfo.addDeviceExtension(VK_EXT_MULTI_DRAW_EXTENSION_NAME, true, &m_multiDrawFeatures);
+    m_contextInfo.addDeviceExtension(VK_EXT_MESH_SHADER_EXTENSION_NAME, true, &m_meshShaderFeatures);
 
     m_contextInfo.apiMajor = 1;
     m_contextInfo.apiMinor = 2;
@@ -196,7 +286,16 @@ bool Sample::initProgram()
   return true;
 }
 
-bool Sample::initScene(const char* filename, int clones, int cloneaxis)
+bool Sample::initScene(const char* filename,
+                       int         clones,
+                       int         cloneaxis,
+                       bool        instancedCopies,
+                       bool        optimizeGeometry,
+                       bool        quantizeVertices,
+                       bool        deduplicate,
+                       int         lods,
+                       bool        meshlets,
+                       bool        splitVertices)
 {
   std::string modelFilename(filename);
 
@@ -212,14 +311,58 @@ bool Sample::initScene(const char* filename, int clones, int cloneaxis)
 
   m_scene.unload();
 
-  bool status = m_scene.loadCSF(modelFilename.c_str(), clones, cloneaxis);
+  bool status = m_scene.loadCSF(modelFilename.c_str(), clones, cloneaxis, instancedCopies, optimizeGeometry, quantizeVertices,
+                                deduplicate, lods, meshlets, splitVertices);
   if(status)
   {
+    // the draw items of most renderers are concatenations of these
+    m_scene.buildDrawRangeCaches(m_tweak.config.searchBatch, m_tweak.config.ignoreMaterials);
+
     LOGI("\nscene %s\n", filename);
     LOGI("geometries: %6d\n", uint32_t(m_scene.m_geometry.size()));
     LOGI("materials:  %6d\n", uint32_t(m_scene.m_materials.size()));
     LOGI("nodes:      %6d\n", uint32_t(m_scene.m_matrices.size()));
     LOGI("objects:    %6d\n", uint32_t(m_scene.m_objects.size()));
+    LOGI("instances:  %6d\n", uint32_t(m_scene.m_copies.size()));
+    if(deduplicate)
+    {
+      LOGI("welded vertices:   %9d\n", m_scene.m_weldedVertices);
+      LOGI("merged geometries: %9d\n", m_scene.m_mergedGeometries);
+      LOGI("saved [KB]:        %9d\n", uint32_t(m_scene.m_dedupSavedSize / 1024));
+    }
+    if(optimizeGeometry)
+    {
+      LOGI("acmr:       %6.3f -> %.3f\n", m_scene.m_acmrOriginal, m_scene.m_acmrOptimized);
+    }
+    else
+    {
+      LOGI("acmr:       %6.3f\n", m_scene.m_acmrOriginal);
+    }
+    if(lods > 1)
+    {
+      LOGI("lods:       %6d, %d KB indices\n", m_scene.m_numLods, uint32_t(m_scene.m_lodIndexSize / 1024));
+    }
+    if(meshlets)
+    {
+      LOGI("meshlets:   %6d, %d KB, fill %.1f%% vertices %.1f%% triangles\n", m_scene.m_numMeshlets,
+           uint32_t(m_scene.m_meshletSize / 1024), m_scene.m_meshletVertexFill * 100.0f,
+           m_scene.m_meshletTriangleFill * 100.0f);
+    }
+    if(splitVertices)
+    {
+      LOGI("split vertices: %6d, +%.1f%%, %d KB vertex ids vs %d KB triangle ids\n", m_scene.m_splitVertices,
+           m_scene.m_numVertices ? float(m_scene.m_splitVertices) * 100.0f / float(m_scene.m_numVertices - m_scene.m_splitVertices) : 0.0f,
+           uint32_t(m_scene.m_vertexPartIdsSize / 1024), uint32_t(m_scene.m_trianglePartIdsSize / 1024));
+    }
+    if(quantizeVertices)
+    {
+      LOGI("quantization error: %g max, %g of bbox diagonal\n", m_scene.m_quantizationErrorMax,
+           m_scene.m_quantizationErrorRelative);
+    }
+    size_t memCurrent;
+    size_t memPeak;
+    getProcessMemory(memCurrent, memPeak);
+    LOGI("host memory: %d MB, peak %d MB\n", uint32_t(memCurrent / (1024 * 1024)), uint32_t(memPeak / (1024 * 1024)));
     LOGI("\n");
   }
   else
@@ -228,6 +371,7 @@ bool Sample::initScene(const char* filename, int clones, int cloneaxis)
   }
 
   m_shared.animUbo.numMatrices = uint(m_scene.m_matrices.size());
+  m_shared.animUbo.numNodes    = m_scene.m_numNodeMatrices;
 
   return status;
 }
@@ -265,6 +409,7 @@ void Sample::initRenderer(int typesort)
     bool valid  = m_resources->init(&m_context, &m_swapChain, &m_profiler);
     valid = valid && m_resources->initFramebuffer(m_windowState.m_swapSize[0], m_windowState.m_swapSize[1], m_tweak.msaa, getVsync());
     valid                = valid && m_resources->initPrograms(exePath(), std::string());
+    m_resources->setGeometryBudget(size_t(m_tweak.geometryBudget) * 1024 * 1024);
     valid                = valid && m_resources->initScene(m_scene);
     m_resources->m_frame = 0;
 
@@ -281,6 +426,12 @@ void Sample::initRenderer(int typesort)
   config.objectFrom = 0;
   config.objectNum  = uint32_t(double(m_scene.m_objects.size()) * double(m_tweak.percent));
   config.passthrough = m_tweak.config.passthrough && m_context.hasDeviceExtension(VK_NV_GEOMETRY_SHADER_PASSTHROUGH_EXTENSION_NAME);
+  if(config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_MULTIDRAW
+     && !(m_context.hasDeviceExtension(VK_EXT_MULTI_DRAW_EXTENSION_NAME) && m_multiDrawFeatures.multiDraw))
+  {
+    LOGW("VK_EXT_multi_draw not supported, falling back to MDI & gl_DrawID\n");
+    config.perDrawParameterMode = Renderer::PER_DRAW_INDEX_DRAWID;
+  }
 
   m_renderStats = Renderer::Stats();
 
@@ -290,6 +441,8 @@ void Sample::initRenderer(int typesort)
 
   LOGI("drawCalls:    %9d\n", m_renderStats.drawCalls);
   LOGI("drawTris:     %9d\n", m_renderStats.drawTriangles);
+  LOGI("drawGeoms:    %9d\n", m_renderStats.drawGeometries);
+  LOGI("record [ms]:  %9.3f\n", m_renderStats.recordTimeMs);
 }
 
 
@@ -324,7 +477,9 @@ bool Sample::begin()
   validated = validated && initProgram();
   validated = validated
               && initScene(m_modelFilename.c_str(), m_tweak.copies - 1,
-                           (m_tweak.cloneaxisX << 0) | (m_tweak.cloneaxisY << 1) | (m_tweak.cloneaxisZ << 2));
+                           (m_tweak.cloneaxisX << 0) | (m_tweak.cloneaxisY << 1) | (m_tweak.cloneaxisZ << 2),
+                           m_tweak.instancedCopies, m_tweak.optimizeGeometry, m_tweak.quantizeVertices,
+                           m_tweak.deduplicate, m_tweak.lods, m_tweak.meshlets, m_tweak.splitVertices);
 
   const Renderer::Registry registry = Renderer::getRegistry();
   for(size_t i = 0; i < registry.size(); i++)
@@ -370,11 +525,18 @@ bool Sample::begin()
     m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_PUSHCONSTANTS, "pushconstants");
     m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_INDEX_BASEINSTANCE, "MDI & gl_BaseInstance");
     m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_INDEX_ATTRIBUTE, "MDI & instanced attribute");
+    m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_INDEX_DRAWID, "MDI & gl_DrawID");
+    m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_UBO_DYNAMIC, "dynamic uniform buffer");
+    m_ui.enumAdd(GUI_PERDRAWMODE, Renderer::PER_DRAW_INDEX_MULTIDRAW, "multi-draw & gl_DrawID");
 
     m_ui.enumAdd(GUI_MSAA, 0, "none");
     m_ui.enumAdd(GUI_MSAA, 2, "2x");
     m_ui.enumAdd(GUI_MSAA, 4, "4x");
     m_ui.enumAdd(GUI_MSAA, 8, "8x");
+
+    m_ui.enumAdd(GUI_SELECTION, SELECTION_MODE_NONE, "none (camera)");
+    m_ui.enumAdd(GUI_SELECTION, SELECTION_MODE_RECT, "rectangle");
+    m_ui.enumAdd(GUI_SELECTION, SELECTION_MODE_LASSO, "lasso");
   }
 
   m_control.m_sceneOrbit     = glm::vec3(m_scene.m_bbox.max + m_scene.m_bbox.min) * 0.5f;
@@ -385,6 +547,7 @@ bool Sample::begin()
   m_shared.animUbo.sceneCenter    = m_control.m_sceneOrbit;
   m_shared.animUbo.sceneDimension = m_control.m_sceneDimension * 0.2f;
   m_shared.animUbo.numMatrices    = uint(m_scene.m_matrices.size());
+  m_shared.animUbo.numNodes       = m_scene.m_numNodeMatrices;
   m_shared.sceneUbo.wLightPos     = (m_scene.m_bbox.max + m_scene.m_bbox.min) * 0.5f + m_control.m_sceneDimension;
   m_shared.sceneUbo.wLightPos.w   = 1.0;
 
@@ -442,13 +605,104 @@ void Sample::processUI(int width, int height, double time)
     ImGui::Checkbox("colorize drawcalls", &m_tweak.config.colorizeDraws);
     ImGui::Checkbox("ignore materials", &m_tweak.config.ignoreMaterials);
     ImGui::Separator();
-    ImGuiH::InputIntClamped("model copies", &m_tweak.copies, 1, 16, 1, 1, ImGuiInputTextFlags_EnterReturnsTrue);
+    // instanced copies share all scene data, so many more are feasible
+    ImGuiH::InputIntClamped("model copies", &m_tweak.copies, 1, m_tweak.instancedCopies ? 4096 : 16, 1, 1,
+                            ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::Checkbox("instanced copies", &m_tweak.instancedCopies);
+    ImGuiH::InputIntClamped("geometry budget [MB] (0 = all)", &m_tweak.geometryBudget, 0, 65536, 16, 256,
+                            ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::Checkbox("deduplicate geometry", &m_tweak.deduplicate);
+    ImGui::Checkbox("optimize geometry", &m_tweak.optimizeGeometry);
+    ImGui::Checkbox("quantize vertices", &m_tweak.quantizeVertices);
+    ImGuiH::InputIntClamped("levels of detail", &m_tweak.lods, 1, CadScene::MAX_LODS, 1, 1,
+                            ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::Checkbox("build meshlets", &m_tweak.meshlets);
+    ImGui::Checkbox("split part vertices", &m_tweak.splitVertices);
+    ImGui::Checkbox("release host geometry", &m_tweak.releaseGeometry);
+    ImGuiH::InputIntClamped("lod pixels (0 = off)", &m_tweak.config.lodPixels, 0, 4096, 16, 128,
+                            ImGuiInputTextFlags_EnterReturnsTrue);
+    if(m_tweak.config.lodPixels && m_tweak.instancedCopies && m_tweak.copies > 1)
+    {
+      ImGui::Text(" instanced copies draw the level of the nearest copy");
+    }
     ImGui::SliderFloat("pct visible", &m_tweak.percent, 0.0f, 1.001f);
     ImGui::Separator();
     //m_ui.enumCombobox(GUI_MSAA, "msaa", &m_tweak.msaa);
     ImGui::Checkbox("sorted once (minimized state changes)", &m_tweak.config.sorted);
+    ImGui::Checkbox("occlusion culling (per-draw buffers only)", &m_tweak.config.occlusionCull);
+    ImGui::Checkbox("vertex pulling", &m_tweak.config.vertexPulling);
     ImGui::Checkbox("animation", &m_tweak.animation);
     ImGui::Separator();
+    if(ImGui::CollapsingHeader("selection"))
+    {
+      ImGui::PushItemWidth(ImGuiH::dpiScaled(170));
+      ImGui::Indent(ImGuiH::dpiScaled(24));
+      m_ui.enumCombobox(GUI_SELECTION, "left-drag tool", &m_tweak.selectionTool);
+      ImGui::Checkbox("add to selection", &m_tweak.selectionAdd);
+      if(ImGui::Button("clear selection"))
+      {
+        m_selectClear = true;
+      }
+      ImGui::Text("selected parts: %d (readback after %d frames)", uint32_t(m_selectedParts.size()), m_selectLatency);
+      ImGui::PopItemWidth();
+      ImGui::Unindent(ImGuiH::dpiScaled(24));
+    }
+    if(ImGui::CollapsingHeader("part overrides"))
+    {
+      ImGui::PushItemWidth(ImGuiH::dpiScaled(170));
+      ImGui::Indent(ImGuiH::dpiScaled(24));
+      ImGui::Checkbox("use part overrides", &m_tweak.config.partOverrides);
+      ImGui::ColorEdit3("override color", &m_overrideColor.x);
+      ImGui::Text("replace override of selected parts:");
+      if(ImGui::Button("hide"))
+      {
+        applyPartOverride(PART_OVERRIDE_HIDDEN);
+      }
+      ImGui::SameLine();
+      if(ImGui::Button("ghost"))
+      {
+        applyPartOverride(PART_OVERRIDE_GHOST);
+      }
+      ImGui::SameLine();
+      if(ImGui::Button("highlight"))
+      {
+        applyPartOverride(PART_OVERRIDE_HIGHLIGHT);
+      }
+      ImGui::SameLine();
+      if(ImGui::Button("color"))
+      {
+        applyPartOverride(PART_OVERRIDE_COLOR);
+      }
+      if(ImGui::Button("reset selected"))
+      {
+        applyPartOverride(0);
+      }
+      ImGui::SameLine();
+      if(ImGui::Button("reset all"))
+      {
+        m_resources->resetPartOverrides();
+      }
+      ImGui::PopItemWidth();
+      ImGui::Unindent(ImGuiH::dpiScaled(24));
+    }
+    if(ImGui::CollapsingHeader("part coverage"))
+    {
+      ImGui::PushItemWidth(ImGuiH::dpiScaled(170));
+      ImGui::Indent(ImGuiH::dpiScaled(24));
+      ImGui::Checkbox("count visible pixels", &m_tweak.config.partCoverage);
+      ImGuiH::InputIntClamped("top parts", &m_coverageTopN, 1, 64, 1, 1, ImGuiInputTextFlags_EnterReturnsTrue);
+      if(m_tweak.config.partCoverage)
+      {
+        ImGui::Text("visible parts: %d (readback after %d frames)", m_coverageVisible, m_coverageLatency);
+        for(const Resources::PartCoverage& part : m_coverageTop)
+        {
+          ImGui::Text("part %7d: %8d pixels", part.partIndex, part.pixels);
+        }
+      }
+      ImGui::PopItemWidth();
+      ImGui::Unindent(ImGuiH::dpiScaled(24));
+    }
+    ImGui::Separator();
     ImGui::PopItemWidth();
 
     {
@@ -496,13 +750,55 @@ void Sample::processUI(int width, int height, double time)
       //ImGui::Text("Frame          [ms]: %2.1f", m_statsFrameTime*1000.0f);
       //ImGui::Text("Render     CPU [ms]: %2.3f", cpuTimeF / 1000.0f);
       ImGui::Text("Render     GPU [ms]: %2.3f", gpuTimeF / 1000.0f);
+      ImGui::Text("Record     CPU [ms]: %2.3f", m_renderStats.recordTimeMs);
 
       //ImGui::ProgressBar(cpuTimeF / maxTimeF, ImVec2(0.0f, 0.0f));
       ImGui::Separator();
+      ImGui::Text(" vertices:      %9ld KB\n", m_scene.m_vertexSize / 1024);
+      ImGui::Text(" indices:       %9ld KB\n", m_scene.m_indexSize / 1024);
+      ImGui::Text(" 16-bit saved:  %9ld KB\n", m_scene.m_indexSavedSize / 1024);
+      ImGui::Text(" lod indices:   %9ld KB\n", m_scene.m_lodIndexSize / 1024);
+      ImGui::Text(" acmr:          %9.3f\n", m_scene.m_acmrOptimized);
       ImGui::Text(" triangle ids:  %9ld KB\n", m_scene.m_trianglePartIdsSize / 1024);
       ImGui::Text(" part ids:      %9ld KB\n", m_scene.m_partTriCountsSize / 1024);
+      if(m_scene.m_numMeshlets)
+      {
+        ImGui::Text(" meshlets:      %9d\n", m_scene.m_numMeshlets);
+        ImGui::Text(" meshlet data:  %9ld KB\n", m_scene.m_meshletSize / 1024);
+        ImGui::Text(" meshlet fill:  %8.1f%% vtx %.1f%% tri\n", m_scene.m_meshletVertexFill * 100.0f,
+                    m_scene.m_meshletTriangleFill * 100.0f);
+      }
+      if(m_scene.m_vertexPartIdsSize)
+      {
+        ImGui::Text(" split verts:   %9d\n", m_scene.m_splitVertices);
+        ImGui::Text(" vertex ids:    %9ld KB\n", m_scene.m_vertexPartIdsSize / 1024);
+      }
+      {
+        size_t memCurrent;
+        size_t memPeak;
+        getProcessMemory(memCurrent, memPeak);
+        ImGui::Text(" host memory:   %9ld MB\n", memCurrent / (1024 * 1024));
+        ImGui::Text(" host peak:     %9ld MB\n", memPeak / (1024 * 1024));
+        ImGui::Text(" host geometry: %9s\n", m_scene.hasGeometryData() ? "kept" : "released");
+      }
       ImGui::Text(" draw calls:    %9d\n", m_renderStats.drawCalls);
       ImGui::Text(" draw tris:     %9d\n", m_renderStats.drawTriangles);
+      ImGui::Text(" draw geoms:    %9d\n", m_renderStats.drawGeometries);
+      if(m_tweak.config.occlusionCull)
+      {
+        ImGui::Text(" cull early:    %9d\n", m_renderStats.cullEarly);
+        ImGui::Text(" cull late:     %9d\n", m_renderStats.cullLate);
+        ImGui::Text(" cull culled:   %9d\n", m_renderStats.cullCulled);
+      }
+      Resources::ResidencyStats residency;
+      if(m_resources->getResidencyStats(residency))
+      {
+        ImGui::Text(" resident:      %9ld KB\n", residency.residentSize / 1024);
+        ImGui::Text(" resident geos: %9d\n", residency.numResident);
+        ImGui::Text(" geo hits:      %9d\n", residency.hits);
+        ImGui::Text(" geo misses:    %9d\n", residency.misses);
+        ImGui::Text(" geo evictions: %9d\n", residency.evictions);
+      }
     }
   }
   ImGui::End();
@@ -518,9 +814,17 @@ void Sample::think(double time)
     processUI(width, height, time);
   }
 
+  int selectMode       = updateSelection(width, height);
+  int mouseButtonFlags = m_windowState.m_mouseButtonFlags;
+  if(m_tweak.selectionTool != SELECTION_MODE_NONE)
+  {
+    // left mouse button drives the selection tool instead of the camera
+    mouseButtonFlags &= ~MOUSE_BUTTONFLAG_LEFT;
+  }
+
   m_control.processActions({m_windowState.m_winSize[0], m_windowState.m_winSize[1]},
                            glm::vec2(m_windowState.m_mouseCurrent[0], m_windowState.m_mouseCurrent[1]),
-                           m_windowState.m_mouseButtonFlags, m_windowState.m_mouseWheel);
+                           mouseButtonFlags, m_windowState.m_mouseWheel);
 
   bool shadersChanged = false;
   if(m_windowState.onPress(KEY_R))
@@ -537,25 +841,57 @@ void Sample::think(double time)
     m_resources->initFramebuffer(width, height, m_tweak.msaa, getVsync());
   }
 
+  if(!m_tweak.instancedCopies)
+  {
+    // cloned copies duplicate all scene data
+    m_tweak.copies = std::min(m_tweak.copies, 16);
+  }
+
   bool sceneChanged = false;
   if(tweakChanged(m_tweak.copies) || tweakChanged(m_tweak.cloneaxisX) || tweakChanged(m_tweak.cloneaxisY)
-     || tweakChanged(m_tweak.cloneaxisZ))
+     || tweakChanged(m_tweak.cloneaxisZ) || tweakChanged(m_tweak.instancedCopies)
+     || tweakChanged(m_tweak.optimizeGeometry) || tweakChanged(m_tweak.quantizeVertices)
+     || tweakChanged(m_tweak.deduplicate) || tweakChanged(m_tweak.lods) || tweakChanged(m_tweak.meshlets)
+     || tweakChanged(m_tweak.splitVertices)
+     // the device geometry is rebuilt from the host copies, released ones come back from the file
+     || (!m_scene.hasGeometryData() && (tweakChanged(m_tweak.geometryBudget) || tweakChanged(m_tweak.releaseGeometry))))
   {
     sceneChanged = true;
     m_resources->synchronize();
     deinitRenderer();
     m_resources->deinitScene();
     initScene(m_modelFilename.c_str(), m_tweak.copies - 1,
-              (m_tweak.cloneaxisX << 0) | (m_tweak.cloneaxisY << 1) | (m_tweak.cloneaxisZ << 2));
+              (m_tweak.cloneaxisX << 0) | (m_tweak.cloneaxisY << 1) | (m_tweak.cloneaxisZ << 2), m_tweak.instancedCopies,
+              m_tweak.optimizeGeometry, m_tweak.quantizeVertices, m_tweak.deduplicate, m_tweak.lods, m_tweak.meshlets,
+              m_tweak.splitVertices);
+    m_resources->setGeometryBudget(size_t(m_tweak.geometryBudget) * 1024 * 1024);
+    m_resources->initScene(m_scene);
+  }
+  else if(tweakChanged(m_tweak.geometryBudget))
+  {
+    // the cpu-side scene stays, only the device geometry is rebuilt
+    sceneChanged = true;
+    m_resources->synchronize();
+    deinitRenderer();
+    m_resources->deinitScene();
+    m_resources->setGeometryBudget(size_t(m_tweak.geometryBudget) * 1024 * 1024);
     m_resources->initScene(m_scene);
   }
 
+  if(!sceneChanged && (tweakChanged(m_tweak.config.searchBatch) || tweakChanged(m_tweak.config.ignoreMaterials)))
+  {
+    m_scene.buildDrawRangeCaches(m_tweak.config.searchBatch, m_tweak.config.ignoreMaterials);
+  }
+
   if(shadersChanged || sceneChanged || tweakChanged(m_tweak.renderer) || tweakChanged(m_tweak.config.sorted)
      || tweakChanged(m_tweak.percent) || tweakChanged(m_tweak.config.passthrough)
      || tweakChanged(m_tweak.config.searchBatch) || tweakChanged(m_tweak.config.colorizeDraws)
      || tweakChanged(m_tweak.config.ignoreMaterials) || tweakChanged(m_tweak.config.globalSearchGuess)
      || tweakChanged(m_tweak.config.globalNaryN) || tweakChanged(m_tweak.config.globalNaryMin)
-     || tweakChanged(m_tweak.config.globalNaryMaxIter) || tweakChanged(m_tweak.config.perDrawParameterMode))
+     || tweakChanged(m_tweak.config.globalNaryMaxIter) || tweakChanged(m_tweak.config.perDrawParameterMode)
+     || tweakChanged(m_tweak.config.partOverrides) || tweakChanged(m_tweak.config.partCoverage)
+     || tweakChanged(m_tweak.config.occlusionCull) || tweakChanged(m_tweak.config.vertexPulling)
+     || tweakChanged(m_tweak.config.lodPixels))
   {
     m_resources->synchronize();
     initRenderer(m_tweak.renderer);
@@ -563,6 +899,23 @@ void Sample::think(double time)
 
   m_resources->beginFrame();
 
+  if(m_tweak.releaseGeometry && m_scene.hasGeometryData() && !m_resources->needsHostGeometry())
+  {
+    // the device has all geometry, only sizes, bboxes and parts stay on the host
+    size_t memBefore;
+    size_t memAfter;
+    size_t memPeak;
+    getProcessMemory(memBefore, memPeak);
+    size_t released = m_scene.releaseGeometryData();
+    getProcessMemory(memAfter, memPeak);
+    LOGI("released host geometry: %d KB, host memory %d -> %d MB, peak %d MB\n", uint32_t(released / 1024),
+         uint32_t(memBefore / (1024 * 1024)), uint32_t(memAfter / (1024 * 1024)), uint32_t(memPeak / (1024 * 1024)));
+  }
+
+  // results of earlier region selections arrive asynchronously
+  m_resources->getSelection(m_selectedParts, m_selectLatency);
+  m_resources->getPartCoverage(uint32_t(m_coverageTopN), m_coverageTop, m_coverageVisible, m_coverageLatency);
+
   if(tweakChanged(m_tweak.animation))
   {
     m_resources->synchronize();
@@ -606,6 +959,14 @@ void Sample::think(double time)
     sceneUbo.partWeight = m_tweak.partWeight;
 
     sceneUbo.mousePos = glm::ivec2(m_windowState.m_mouseCurrent[0], m_windowState.m_mouseCurrent[1]);
+
+    sceneUbo.selectMode        = selectMode;
+    sceneUbo.selectMaskShift   = m_selectMaskShift;
+    sceneUbo.selectRect        = m_selectRect;
+    m_shared.selectionMask     = selectMode == SELECTION_MODE_LASSO ? m_selectMask.data() : nullptr;
+    m_shared.selectionMaskSize = m_selectMask.size() * sizeof(uint32_t);
+    m_shared.selectionAdditive = m_tweak.selectionAdd && !m_selectClear;
+    m_selectClear              = false;
   }
 
   if(m_tweak.animation)
@@ -645,6 +1006,139 @@ void Sample::think(double time)
   m_lastTweak = m_tweak;
 }
 
+// Rasterizes the lasso polygon into a bitmask of cells, one bit per cell.
+// Returns the log2 of the cell size, which is chosen as small as possible
+// while the mask fits into SELECTION_MASK_MAX_BYTES.
+static uint32_t buildLassoMask(std::vector<uint32_t>& mask, const std::vector<glm::vec2>& points, int width, int height)
+{
+  uint32_t shift  = 0;
+  int      cellsX = width;
+  int      cellsY = height;
+  while(((size_t(cellsX) * size_t(cellsY) + 31) / 32) * sizeof(uint32_t) > SELECTION_MASK_MAX_BYTES)
+  {
+    shift++;
+    cellsX = (width + (1 << shift) - 1) >> shift;
+    cellsY = (height + (1 << shift) - 1) >> shift;
+  }
+
+  mask.assign((size_t(cellsX) * size_t(cellsY) + 31) / 32, 0);
+
+  // even-odd scanline fill through the cell centers
+  float              cellSize = float(1 << shift);
+  std::vector<float> crossings;
+  for(int y = 0; y < cellsY; y++)
+  {
+    float py = (float(y) + 0.5f) * cellSize;
+
+    crossings.clear();
+    for(size_t i = 0; i < points.size(); i++)
+    {
+      const glm::vec2& a = points[i];
+      const glm::vec2& b = points[(i + 1) % points.size()];
+      if((a.y <= py) != (b.y <= py))
+      {
+        crossings.push_back(a.x + (py - a.y) / (b.y - a.y) * (b.x - a.x));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    for(size_t i = 0; i + 1 < crossings.size(); i += 2)
+    {
+      int xBegin = std::max(0, int(ceilf(crossings[i] / cellSize - 0.5f)));
+      int xEnd   = std::min(cellsX, int(ceilf(crossings[i + 1] / cellSize - 0.5f)));
+      for(int x = xBegin; x < xEnd; x++)
+      {
+        size_t cell = size_t(y) * size_t(cellsX) + size_t(x);
+        mask[cell / 32] |= 1u << (cell % 32);
+      }
+    }
+  }
+
+  return shift;
+}
+
+// Tracks the left-drag of the selection tool, returns the SELECTION_MODE_*
+// to perform this frame, which only happens when the drag was released.
+int Sample::updateSelection(int width, int height)
+{
+  if(m_selectClear)
+  {
+    // an empty non-additive selection clears the result
+    m_selectRect = glm::ivec4(0);
+    return SELECTION_MODE_RECT;
+  }
+
+  if(m_tweak.selectionTool == SELECTION_MODE_NONE)
+  {
+    m_selectDragging = false;
+    return SELECTION_MODE_NONE;
+  }
+
+  bool      mouseLeft = (m_windowState.m_mouseButtonFlags & MOUSE_BUTTONFLAG_LEFT) != 0;
+  glm::vec2 mouse(m_windowState.m_mouseCurrent[0], m_windowState.m_mouseCurrent[1]);
+
+  if(!m_selectDragging)
+  {
+    if(mouseLeft && !(m_useUI && ImGui::GetIO().WantCaptureMouse))
+    {
+      m_selectDragging = true;
+      m_selectPoints.clear();
+      m_selectPoints.push_back(mouse);
+    }
+    return SELECTION_MODE_NONE;
+  }
+
+  if(mouseLeft)
+  {
+    if(m_tweak.selectionTool == SELECTION_MODE_LASSO && glm::distance(mouse, m_selectPoints.back()) >= 2.0f)
+    {
+      m_selectPoints.push_back(mouse);
+    }
+    return SELECTION_MODE_NONE;
+  }
+
+  // released
+  m_selectDragging = false;
+  m_selectPoints.push_back(mouse);
+
+  glm::vec2 boxMin = m_selectPoints[0];
+  glm::vec2 boxMax = m_selectPoints[0];
+  for(const glm::vec2& point : m_selectPoints)
+  {
+    boxMin = glm::min(boxMin, point);
+    boxMax = glm::max(boxMax, point);
+  }
+
+  m_selectRect.x = std::max(0, int(floorf(boxMin.x)));
+  m_selectRect.y = std::max(0, int(floorf(boxMin.y)));
+  m_selectRect.z = std::min(width, int(ceilf(boxMax.x)) + 1);
+  m_selectRect.w = std::min(height, int(ceilf(boxMax.y)) + 1);
+
+  if(m_tweak.selectionTool == SELECTION_MODE_LASSO)
+  {
+    m_selectMaskShift = buildLassoMask(m_selectMask, m_selectPoints, width, height);
+  }
+
+  return m_tweak.selectionTool;
+}
+
+void Sample::applyPartOverride(uint32_t flags)
+{
+  PartOverride value;
+  value.color = glm::packUnorm4x8(glm::vec4(m_overrideColor, 1.0f));
+  value.flags = flags;
+  if(!flags)
+  {
+    value.color = 0;
+  }
+
+  // only the modified range is uploaded with the next frame
+  for(uint32_t partIndex : m_selectedParts)
+  {
+    m_resources->setPartOverride(partIndex, value);
+  }
+}
+
 void Sample::resize(int width, int height)
 {
   initFramebuffers(width, height);
@@ -679,9 +1173,24 @@ void Sample::setupConfigParameters()
   m_parameterList.add("renderernamed", &m_rendererName);
   m_parameterList.add("msaa", &m_tweak.msaa);
   m_parameterList.add("copies", &m_tweak.copies);
+  m_parameterList.add("instancedcopies", &m_tweak.instancedCopies);
+  m_parameterList.add("geometrybudget", &m_tweak.geometryBudget);
+  m_parameterList.add("deduplicate", &m_tweak.deduplicate);
+  m_parameterList.add("optimizegeometry", &m_tweak.optimizeGeometry);
+  m_parameterList.add("quantizevertices", &m_tweak.quantizeVertices);
+  m_parameterList.add("lods", &m_tweak.lods);
+  m_parameterList.add("meshlets", &m_tweak.meshlets);
+  m_parameterList.add("splitvertices", &m_tweak.splitVertices);
+  m_parameterList.add("releasegeometry", &m_tweak.releaseGeometry);
   m_parameterList.add("animation", &m_tweak.animation);
   m_parameterList.add("animationspin", &m_tweak.animationSpin);
   m_parameterList.add("minstatechanges", &m_tweak.config.sorted);
+  m_parameterList.add("perdrawmode", (uint32_t*)&m_tweak.config.perDrawParameterMode);
+  m_parameterList.add("partoverrides", &m_tweak.config.partOverrides);
+  m_parameterList.add("partcoverage", &m_tweak.config.partCoverage);
+  m_parameterList.add("occlusioncull", &m_tweak.config.occlusionCull);
+  m_parameterList.add("vertexpulling", &m_tweak.config.vertexPulling);
+  m_parameterList.add("lodpixels", &m_tweak.config.lodPixels);
 }
 
 bool Sample::validateConfig()
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: Copyright (c) 2021 NVIDIA CORPORATION
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+
+
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_buffer_reference : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
+
+#include "common.h"
+
+// Tests the bounding box of every MDI drawcall against the HiZ pyramid
+// and sets the instanceCount of its VkDrawIndexedIndirectCommand to 0 or
+// the number of model copies.
+
+layout (local_size_x = CULL_WORKGROUPSIZE) in;
+
+layout(binding=CULL_SSBO_MATRIX, std430) readonly buffer matrixBuffer {
+  MatrixData    matrices[];
+};
+
+layout(binding=CULL_SSBO_BBOX, std430) readonly buffer bboxBuffer {
+  vec4  bboxes[];   // min, max per geometry
+};
+
+layout(binding=CULL_SSBO_DRAWINFO, std430) readonly buffer drawInfoBuffer {
+  CullDrawInfo  drawInfos[];
+};
+
+// VkDrawIndexedIndirectCommand, 5 uints each
+layout(binding=CULL_SSBO_INDIRECT, std430) writeonly buffer indirectBuffer {
+  uint  indirects[];
+};
+
+// 1 if drawn by the early pass
+layout(binding=CULL_SSBO_DRAWN, std430) buffer drawnBuffer {
+  uint  drawn[];
+};
+
+layout(binding=CULL_SSBO_STATS, std430) buffer statsBuffer {
+  uint  stats[];
+};
+
+layout(binding=CULL_TEX_HIZ) uniform sampler2D texHiZ;
+
+layout(binding=CULL_SSBO_COPIES, scalar) readonly buffer copiesBuffer {
+  CopyData  copies[];
+};
+
+layout(push_constant, scalar) uniform pushConstants {
+  CullPushData PUSH;
+};
+
+bool isVisible(vec3 bboxMin, vec3 bboxMax, mat4 worldViewProj)
+{
+  vec2  uvMin    = vec2( 1);
+  vec2  uvMax    = vec2( 0);
+  float depthMin = 1;
+
+  for (int i = 0; i < 8; i++)
+  {
+    vec3 corner = vec3((i & 1) != 0 ? bboxMax.x : bboxMin.x,
+                       (i & 2) != 0 ? bboxMax.y : bboxMin.y,
+                       (i & 4) != 0 ? bboxMax.z : bboxMin.z);
+    vec4 hPos = worldViewProj * vec4(corner, 1);
+    if (hPos.w <= 0) {
+      // crosses the camera plane, cannot be tested reliably
+      return true;
+    }
+    vec3 ndc = hPos.xyz / hPos.w;
+    uvMin    = min(uvMin, ndc.xy * 0.5 + 0.5);
+    uvMax    = max(uvMax, ndc.xy * 0.5 + 0.5);
+    depthMin = min(depthMin, ndc.z);
+  }
+
+  // frustum
+  if (any(greaterThan(uvMin, vec2(1))) || any(lessThan(uvMax, vec2(0))) || depthMin > 1) {
+    return false;
+  }
+
+  if (PUSH.useHiZ == 0) {
+    return true;
+  }
+
+  uvMin = clamp(uvMin, vec2(0), vec2(1));
+  uvMax = clamp(uvMax, vec2(0), vec2(1));
+
+  // pick the level where the box covers at most 2x2 texels
+  vec2  size  = (uvMax - uvMin) * PUSH.hizSize;
+  float level = clamp(ceil(log2(max(max(size.x, size.y), 1.0))), 0, float(PUSH.hizLevels - 1));
+
+  float depthMax = textureLod(texHiZ, uvMin, level).r;
+  depthMax = max(depthMax, textureLod(texHiZ, vec2(uvMax.x, uvMin.y), level).r);
+  depthMax = max(depthMax, textureLod(texHiZ, vec2(uvMin.x, uvMax.y), level).r);
+  depthMax = max(depthMax, textureLod(texHiZ, uvMax, level).r);
+
+  return depthMin <= depthMax;
+}
+
+void main()
+{
+  uint drawIdx = gl_GlobalInvocationID.x;
+  if (drawIdx >= PUSH.numDraws) {
+    return;
+  }
+
+  CullDrawInfo info        = drawInfos[drawIdx];
+  mat4         worldMatrix = matrices[info.matrixIndex].worldMatrix;
+  vec3         bboxMin     = bboxes[info.geometryIndex * 2 + 0].xyz;
+  vec3         bboxMax     = bboxes[info.geometryIndex * 2 + 1].xyz;
+
+  // all copies share the drawcall, it is kept if any of them is visible
+  bool visible = false;
+  for (uint c = 0; c < PUSH.numCopies && !visible; c++)
+  {
+    mat4 copyMatrix = worldMatrix;
+    copyMatrix[3].xyz += copies[c].shift;
+    visible = isVisible(bboxMin, bboxMax, PUSH.viewProjMatrix * copyMatrix);
+  }
+
+  if (PUSH.pass == CULL_PASS_EARLY)
+  {
+    drawn[drawIdx] = visible ? 1 : 0;
+    if (visible) {
+      atomicAdd(stats[CULL_STAT_EARLY], 1);
+    }
+  }
+  else
+  {
+    // only draw what the early pass missed
+    bool drawnEarly = drawn[drawIdx] != 0;
+    visible = visible && !drawnEarly;
+    if (visible) {
+      atomicAdd(stats[CULL_STAT_LATE], 1);
+    }
+    else if (!drawnEarly) {
+      atomicAdd(stats[CULL_STAT_CULLED], 1);
+    }
+  }
+
+  indirects[drawIdx * 5 + 1] = visible ? PUSH.numCopies : 0;
+}
@@ -6,6 +6,13 @@ layout(set = 0, binding = DRAW_SSBO_PER_DRAW, scalar) buffer perDrawBuffer
 {
   DrawPushData perDrawData[];
 };
+#elif UNIFORMS_TECHNIQUE == UNIFORMS_MULTISETSDYNAMIC
+// The per-draw data is bound for every draw like push constants, but from a
+// separate descriptor set with a dynamic offset into a uniform buffer.
+layout(set = 1, binding = DRAW_UBO_PER_DRAW, scalar) uniform perDrawUbo
+{
+  DrawPushData PUSH;
+};
 #else
 layout(push_constant, scalar) uniform pushConstants
 {
@@ -21,6 +28,25 @@ uint getBaseInstance()
 {
   return InBaseInstance;
 }
+#elif defined(USE_DRAWID_INDEX)
+// gl_DrawID restarts at 0 for every vkCmdDrawIndexedIndirect, so the index
+// of the first drawcall of the MDI batch is provided as push constant.
+// firstInstance is not used at all.
+layout(push_constant) uniform drawIdPushConstants
+{
+  uint drawIdOffset;
+}
+DRAWID_PUSH;
+uint getBaseInstance()
+{
+  return DRAWID_PUSH.drawIdOffset + gl_DrawID;
+}
+#elif USE_INSTANCED_COPIES
+// with instanced copies gl_InstanceIndex also contains the copy
+uint getBaseInstance()
+{
+  return gl_BaseInstance;
+}
 #else
 // We use  gl_InstanceIndex here instead of gl_BaseInstance as in
 // the non-instanced case, gl_InstanceIndex == gl_BaseIndex
@@ -31,6 +57,113 @@ uint getBaseInstance()
 #endif
 #endif // VERTEX_SHADER
 
+#if USE_INSTANCED_COPIES
+// Every drawcall is instanced once per model copy. The vertex shader
+// fetches the copy's shift, and forwards its unique part offset to the
+// next stages.
+#ifdef _VERTEX_SHADER_
+layout(set = 0, binding = DRAW_SSBO_COPIES, scalar) readonly buffer copiesBuffer
+{
+  CopyData copies[];
+};
+layout(location = 4) out CopyId
+{
+  flat uint partOffset;
+}
+OUT_COPYID;
+uint getCopyIndex()
+{
+  return uint(gl_InstanceIndex - gl_BaseInstance);
+}
+vec3 getCopyShift()
+{
+  return copies[getCopyIndex()].shift;
+}
+uint getCopyPartOffset()
+{
+  return copies[getCopyIndex()].partOffset;
+}
+#endif  // _VERTEX_SHADER_
+
+#ifdef _MESH_SHADER_
+layout(set = 0, binding = DRAW_SSBO_COPIES, scalar) readonly buffer copiesBuffer
+{
+  CopyData copies[];
+};
+layout(location = 4) out CopyId
+{
+  flat uint partOffset;
+}
+OUT_COPYID[];
+// every copy is a row of workgroups, see vkCmdDrawMeshTasksEXT
+uint getCopyIndex()
+{
+  return gl_WorkGroupID.y;
+}
+vec3 getCopyShift()
+{
+  return copies[getCopyIndex()].shift;
+}
+uint getCopyPartOffset()
+{
+  return copies[getCopyIndex()].partOffset;
+}
+#endif  // _MESH_SHADER_
+
+#ifdef _GEOMETRY_SHADER_
+#if USE_GEOMETRY_SHADER_PASSTHROUGH
+layout(passthrough, location = 4) in InCopyId
+{
+  flat uint partOffset;
+}
+IN_COPYID[];
+#else
+layout(location = 4) in InCopyId
+{
+  flat uint partOffset;
+}
+IN_COPYID[];
+layout(location = 4) out OutCopyId
+{
+  flat uint partOffset;
+}
+OUT_COPYID;
+#endif
+uint getCopyPartOffset()
+{
+  return IN_COPYID[0].partOffset;
+}
+#endif  // _GEOMETRY_SHADER_
+
+#if _FRAGMENT_SHADER_
+layout(location = 4) in CopyId
+{
+  flat uint partOffset;
+}
+IN_COPYID;
+uint getCopyPartOffset()
+{
+  return IN_COPYID.partOffset;
+}
+#endif  // _FRAGMENT_SHADER_
+
+#ifdef _COMPUTE_SHADER_
+uint getCopyPartOffset()
+{
+  return 0;
+}
+#endif  // _COMPUTE_SHADER_
+#else   // USE_INSTANCED_COPIES
+vec3 getCopyShift()
+{
+  return vec3(0);
+}
+uint getCopyPartOffset()
+{
+  return 0;
+}
+#endif  // USE_INSTANCED_COPIES
+
 #ifdef _VERTEX_SHADER_
 #ifndef USE_PUSHCONSTANTS
 // When not using push constants, we need to forward the draw ID to the next
@@ -98,9 +231,9 @@ uint getDrawId(); // declared, but not defined
 #endif  // USE_PUSHCONSTANTS
 #endif  //_GEOMETRY_SHADER_
 
-#ifdef _COMPUTE_SHADER_
+#if defined(_COMPUTE_SHADER_) || defined(_MESH_SHADER_)
 uint getDrawId(); // declared, but not defined
-#endif  // _COMPUTE_SHADER_
+#endif  // _COMPUTE_SHADER_ || _MESH_SHADER_
 
 
 uint getMaterialIndex()
@@ -134,9 +267,9 @@ uints_in getIdsAddress()
 uint getUniquePartOffset()
 {
 #ifdef USE_PUSHCONSTANTS
-  return PUSH.uniquePartOffset;
+  return PUSH.uniquePartOffset + getCopyPartOffset();
 #else   // USE_PUSHCONSTANTS
-  return perDrawData[getDrawId()].uniquePartOffset;
+  return perDrawData[getDrawId()].uniquePartOffset + getCopyPartOffset();
 #endif  // USE_PUSHCONSTANTS
 }
 
@@ -150,3 +283,50 @@ uint getPartId()
 #endif  // USE_PUSHCONSTANTS
 }
 #endif
+
+#if defined(_VERTEX_SHADER_) || defined(_MESH_SHADER_)
+#if USE_QUANTIZED_VERTICES
+// Returns the same layout as the float vertices: the unorm position is within the
+// geometry's bbox, the matrix of the part maps it back. The normal is re-encoded to
+// the snorm16 oct bits in w.
+vec4 decodeVertex(uvec2 packed)
+{
+  vec3 pos    = vec3(packed.x & 0xFFFF, packed.x >> 16, packed.y & 0xFFFF) / 65535.0;
+  vec2 normal = unpackSnorm4x8(packed.y >> 16).xy;
+  return vec4(pos, uintBitsToFloat(packSnorm2x16(normal)));
+}
+#endif
+#endif  // _VERTEX_SHADER_ || _MESH_SHADER_
+
+#ifdef _VERTEX_SHADER_
+#if USE_VERTEX_PULLING
+// The vertex buffer is not bound, every drawcall reads the vertices of its geometry
+// through the per-draw address instead. vertexOffset is always 0, so gl_VertexIndex
+// is the value from the index buffer.
+vec4 getVertexPosNormal()
+{
+#ifdef USE_PUSHCONSTANTS
+  vertices_in vertices = PUSH.vboAddr;
+#else   // USE_PUSHCONSTANTS
+  vertices_in vertices = perDrawData[getDrawId()].vboAddr;
+#endif  // USE_PUSHCONSTANTS
+#if USE_QUANTIZED_VERTICES
+  return decodeVertex(vertices.d[gl_VertexIndex]);
+#else
+  return vertices.d[gl_VertexIndex];
+#endif
+}
+#elif USE_QUANTIZED_VERTICES
+in layout(location = ATTRIB_VERTEX_POS_OCTNORMAL) uvec2 inPosNormal;
+vec4 getVertexPosNormal()
+{
+  return decodeVertex(inPosNormal);
+}
+#else  // USE_VERTEX_PULLING
+in layout(location = ATTRIB_VERTEX_POS_OCTNORMAL) vec4 inPosNormal;
+vec4 getVertexPosNormal()
+{
+  return inPosNormal;
+}
+#endif  // USE_VERTEX_PULLING
+#endif  // _VERTEX_SHADER_
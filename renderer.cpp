@@ -20,7 +20,9 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <thread>
 #include "renderer.hpp"
+#include <glm/gtc/matrix_transform.hpp>
 #include <nvpwindow.hpp>
 
 #include "common.h"
@@ -48,6 +50,8 @@ static void FillCombined(std::vector<Renderer::DrawItem>& drawItems,
 {
   Renderer::DrawItem di;
   di.geometryIndex = obj.geometryIndex;
+  di.index16       = geo.ibo16Size != 0;
+  di.lod           = 0;
   di.objectIndex   = objectIndex;
   di.materialIndex = -1;
   di.matrixIndex   = -1;
@@ -101,9 +105,12 @@ static void FillIndividual(std::vector<Renderer::DrawItem>& drawItems,
 
     Renderer::DrawItem di;
     di.geometryIndex = obj.geometryIndex;
+    di.index16       = geo.ibo16Size != 0;
+    di.lod           = 0;
     di.matrixIndex   = part.matrixIndex;
     di.materialIndex = part.materialIndex;
     di.partIndex     = uint32_t(p);
+    di.partCount     = 1;
     di.range         = mesh.indexSolid;
     di.objectIndex   = objectIndex;
     di.objectOffset  = obj.uniquePartOffset;
@@ -112,36 +119,373 @@ static void FillIndividual(std::vector<Renderer::DrawItem>& drawItems,
   }
 }
 
+// patches the object's cached ranges into draw items, returns the end of the written items
+static Renderer::DrawItem* FillCached(Renderer::DrawItem* NV_RESTRICT drawItems,
+                                      const CadScene::DrawRangeCache& cache,
+                                      const CadScene::Object&         obj,
+                                      const CadScene::Geometry&       geo,
+                                      int                             objectIndex)
+{
+  uint32_t r = cache.objectFirstRange[objectIndex];
+  for(uint32_t s = cache.objectFirstState[objectIndex]; s < cache.objectFirstState[objectIndex + 1]; s++)
+  {
+    const CadScene::DrawStateInfo& state = cache.state[s];
+    for(int i = 0; i < cache.stateCount[s]; i++, r++)
+    {
+      Renderer::DrawItem& di = *drawItems++;
+      di.geometryIndex       = obj.geometryIndex;
+      di.index16             = geo.ibo16Size != 0;
+      di.lod                 = 0;
+      di.matrixIndex         = state.matrixIndex;
+      di.materialIndex       = state.materialIndex;
+      di.partIndex           = int(cache.firstPart[r]);
+      di.partCount           = int(cache.partCounts[r]);
+      di.range.offset        = cache.offsets[r];
+      di.range.count         = cache.counts[r];
+      di.objectIndex         = objectIndex;
+      di.objectOffset        = obj.uniquePartOffset;
+    }
+  }
+  return drawItems;
+}
+
+// objects per thread at least, smaller scenes are not worth the thread startup
+static const size_t FILL_OBJECTS_PER_THREAD = 1024;
+
+// runs fn(t) for t in [0, numThreads), the calling thread does t = 0
+template <typename F>
+static void RunThreads(uint32_t numThreads, const F& fn)
+{
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for(uint32_t t = 1; t < numThreads; t++)
+  {
+    threads.emplace_back([&fn, t]() { fn(t); });
+  }
+  fn(0);
+  for(std::thread& thread : threads)
+  {
+    thread.join();
+  }
+}
+
 void Renderer::fillDrawItems(std::vector<DrawItem>& drawItems, const CadScene* NV_RESTRICT scene, const Config& config, uint32_t maxCombine, Stats& stats)
 {
   size_t maxObjects = scene->m_objects.size();
   size_t from       = std::min(maxObjects - 1, size_t(config.objectFrom));
   maxObjects        = std::min(maxObjects, from + size_t(config.objectNum));
 
-  for(size_t i = from; i < maxObjects; i++)
+  size_t   numObjects = maxObjects - from;
+  uint32_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+  numThreads = uint32_t(std::max(size_t(1), std::min(size_t(numThreads), numObjects / FILL_OBJECTS_PER_THREAD)));
+
+  // every thread handles a contiguous range of objects, so the concatenation
+  // keeps the object order of a sequential fill
+  size_t perThread = (numObjects + numThreads - 1) / numThreads;
+  auto   getObjects = [&](uint32_t t, size_t& begin, size_t& end) {
+    begin = std::min(maxObjects, from + perThread * t);
+    end   = std::min(maxObjects, begin + perThread);
+  };
+
+  // the scene's ranges, when they were built for this combining, tell the number of draw
+  // items up front. Otherwise every thread fills its own list first.
+  const CadScene::DrawRangeCache*    cache = scene->findDrawRangeCache(maxCombine, config.ignoreMaterials);
+  std::vector<std::vector<DrawItem>> threadItems(cache ? 0 : numThreads);
+
+  if(!cache)
   {
-    const CadScene::Object&   obj = scene->m_objects[i];
-    const CadScene::Geometry& geo = scene->m_geometry[obj.geometryIndex];
+    RunThreads(numThreads, [&](uint32_t t) {
+      size_t begin, end;
+      getObjects(t, begin, end);
+
+      for(size_t i = begin; i < end; i++)
+      {
+        const CadScene::Object&   obj = scene->m_objects[i];
+        const CadScene::Geometry& geo = scene->m_geometry[obj.geometryIndex];
 
-    if(maxCombine)
+        if(maxCombine)
+        {
+          FillCombined(threadItems[t], config, obj, geo, int(i), maxCombine);
+        }
+        else
+        {
+          FillIndividual(threadItems[t], config, obj, geo, int(i));
+        }
+      }
+    });
+  }
+
+  // prefix sum of the list sizes, segment t of the final list is [segments[t], segments[t + 1])
+  std::vector<size_t> segments(numThreads + 1);
+  segments[0] = drawItems.size();
+  for(uint32_t t = 0; t < numThreads; t++)
+  {
+    size_t begin, end;
+    getObjects(t, begin, end);
+    segments[t + 1] = segments[t] + (cache ? cache->objectFirstRange[end] - cache->objectFirstRange[begin] : threadItems[t].size());
+  }
+  drawItems.resize(segments[numThreads]);
+
+  std::vector<uint32_t> threadTriangles(numThreads, 0);
+  RunThreads(numThreads, [&](uint32_t t) {
+    DrawItem* segment = drawItems.data() + segments[t];
+    if(cache)
     {
-      FillCombined(drawItems, config, obj, geo, int(i), maxCombine);
+      size_t begin, end;
+      getObjects(t, begin, end);
+
+      DrawItem* items = segment;
+      for(size_t i = begin; i < end; i++)
+      {
+        const CadScene::Object& obj = scene->m_objects[i];
+        items = FillCached(items, *cache, obj, scene->m_geometry[obj.geometryIndex], int(i));
+      }
     }
     else
     {
-      FillIndividual(drawItems, config, obj, geo, int(i));
+      std::copy(threadItems[t].begin(), threadItems[t].end(), segment);
+      threadItems[t] = std::vector<DrawItem>();
+    }
+
+    for(size_t i = segments[t]; i < segments[t + 1]; i++)
+    {
+      threadTriangles[t] += drawItems[i].range.count / 3;
     }
+
+    if(config.sorted)
+    {
+      std::sort(drawItems.begin() + segments[t], drawItems.begin() + segments[t + 1], DrawItem_compare_groups);
+    }
+  });
+
+  for(uint32_t t = 0; t < numThreads; t++)
+  {
+    stats.drawTriangles += threadTriangles[t] * uint32_t(scene->m_copies.size());
   }
 
   if(config.sorted)
   {
-    std::sort(drawItems.begin(), drawItems.end(), DrawItem_compare_groups);
+    // draw items from before this fill form one more sorted segment
+    if(segments[0])
+    {
+      std::sort(drawItems.begin(), drawItems.begin() + segments[0], DrawItem_compare_groups);
+      segments.insert(segments.begin(), 0);
+    }
+
+    // merge neighboring sorted segments pairwise, each level halves their count
+    uint32_t numSegments = uint32_t(segments.size() - 1);
+    for(uint32_t width = 1; width < numSegments; width *= 2)
+    {
+      uint32_t numMerges = (numSegments + width * 2 - 1) / (width * 2);
+      RunThreads(numMerges, [&](uint32_t m) {
+        uint32_t first = m * width * 2;
+        uint32_t mid   = std::min(numSegments, first + width);
+        uint32_t last  = std::min(numSegments, first + width * 2);
+        std::inplace_merge(drawItems.begin() + segments[first], drawItems.begin() + segments[mid],
+                           drawItems.begin() + segments[last], DrawItem_compare_groups);
+      });
+    }
+  }
+  else
+  {
+    // at least group by index type, otherwise the MDI batches split at every switch
+    std::stable_partition(drawItems.begin(), drawItems.end(), [](const DrawItem& di) { return di.index16; });
+  }
+
+  // distinct geometries depend on the final order
+  stats.drawCalls += uint32_t(drawItems.size());
+  for(size_t i = 0; i < drawItems.size(); i++)
+  {
+    if(i == 0 || drawItems[i].geometryIndex != drawItems[i - 1].geometryIndex)
+    {
+      stats.drawGeometries++;
+    }
+  }
+}
+
+// Instanced copies share the drawcalls and therefore the level. The copy whose scene
+// center is nearest to the camera picks it for all objects, so close copies are not
+// drawn coarser than their size asks for, while far copies draw more detail than needed.
+static glm::vec3 getNearestCopyShift(const CadScene* NV_RESTRICT scene, const glm::vec3& viewPos)
+{
+  glm::vec3 center      = glm::vec3(scene->m_bbox.min + scene->m_bbox.max) * 0.5f;
+  glm::vec3 nearest     = glm::vec3(0);
+  float     nearestDist = FLT_MAX;
+  for(const CadScene::Copy& copy : scene->m_copies)
+  {
+    float dist = glm::distance(center + copy.shift, viewPos);
+    if(dist < nearestDist)
+    {
+      nearestDist = dist;
+      nearest     = copy.shift;
+    }
+  }
+  return nearest;
+}
+
+static int getObjectLod(const CadScene* NV_RESTRICT scene, const CadScene::Object& obj, const glm::vec3& shift, const glm::mat4& viewProjMatrix, int width, int height, int lodPixels)
+{
+  const CadScene::BBox& bbox   = scene->m_geometryBboxes[obj.geometryIndex];
+  glm::mat4             matrix = viewProjMatrix * glm::translate(glm::mat4(1), shift) * scene->m_matrices[obj.matrixIndex].worldMatrix;
+
+  glm::vec2 ndcMin(FLT_MAX);
+  glm::vec2 ndcMax(-FLT_MAX);
+  for(int i = 0; i < 8; i++)
+  {
+    glm::vec4 corner((i & 1) ? bbox.max.x : bbox.min.x, (i & 2) ? bbox.max.y : bbox.min.y,
+                     (i & 4) ? bbox.max.z : bbox.min.z, 1.0f);
+    glm::vec4 clip = matrix * corner;
+    if(clip.w <= 0)
+    {
+      // crosses the camera plane
+      return 0;
+    }
+    glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    ndcMin        = glm::min(ndcMin, ndc);
+    ndcMax        = glm::max(ndcMax, ndc);
+  }
+
+  float pixels = std::max((ndcMax.x - ndcMin.x) * 0.5f * float(width), (ndcMax.y - ndcMin.y) * 0.5f * float(height));
+
+  // every level is meant for half the size of the previous one
+  int   lod       = 0;
+  float threshold = float(lodPixels);
+  while(pixels < threshold && lod < CadScene::MAX_LODS - 1)
+  {
+    lod++;
+    threshold *= 0.5f;
   }
+  return lod;
+}
+
+bool Renderer::updateLods(std::vector<DrawItem>&      drawItems,
+                          const CadScene* NV_RESTRICT scene,
+                          const Config&               config,
+                          const glm::mat4&            viewProjMatrix,
+                          const glm::vec3&            viewPos,
+                          int                         width,
+                          int                         height,
+                          Stats&                      stats)
+{
+  bool      changed       = false;
+  int       lastObject    = -1;
+  int       objectLod     = 0;
+  uint32_t  drawTriangles = 0;
+  glm::vec3 copyShift     = getNearestCopyShift(scene, viewPos);
 
   for(size_t i = 0; i < drawItems.size(); i++)
   {
-    stats.drawCalls++;
-    stats.drawTriangles += drawItems[i].range.count / 3;
+    DrawItem&                 di  = drawItems[i];
+    const CadScene::Geometry& geo = scene->m_geometry[di.geometryIndex];
+
+    // Known gap: picking the level per copy would need separate drawcalls per level,
+    // see getNearestCopyShift.
+    if(di.objectIndex != lastObject)
+    {
+      objectLod  = getObjectLod(scene, scene->m_objects[di.objectIndex], copyShift, viewProjMatrix, width, height, config.lodPixels);
+      lastObject = di.objectIndex;
+    }
+
+    int lod = std::min(objectLod, int(geo.lods.size()));
+    if(lod != di.lod)
+    {
+      // the parts of all levels are in the same order, so the range stays contiguous
+      const std::vector<CadScene::GeometryPart>& parts = geo.getLodParts(lod);
+
+      di.lod          = lod;
+      di.range.offset = parts[di.partIndex].indexSolid.offset;
+      di.range.count  = 0;
+      for(int p = di.partIndex; p < di.partIndex + di.partCount; p++)
+      {
+        di.range.count += parts[p].indexSolid.count;
+      }
+      changed = true;
+    }
+    drawTriangles += di.range.count / 3;
+  }
+
+  stats.drawTriangles = drawTriangles * uint32_t(scene->m_copies.size());
+  return changed;
+}
+
+void Renderer::getVisibleGeometries(std::vector<uint32_t>&       geometryIndices,
+                                    const std::vector<DrawItem>& drawItems,
+                                    const CadScene* NV_RESTRICT  scene,
+                                    const glm::mat4&             viewProjMatrix,
+                                    const glm::vec3&             viewPos)
+{
+  // testing every copy would cost as much as the copies, the world box of an object
+  // is stretched over all of them instead
+  glm::vec3 shiftMin(FLT_MAX);
+  glm::vec3 shiftMax(-FLT_MAX);
+  for(const CadScene::Copy& copy : scene->m_copies)
+  {
+    shiftMin = glm::min(shiftMin, copy.shift);
+    shiftMax = glm::max(shiftMax, copy.shift);
+  }
+
+  std::vector<std::pair<float, uint32_t>> visible;
+  std::vector<bool>                       objectTested(scene->m_objects.size(), false);
+  std::vector<bool>                       geometryUsed(scene->m_geometry.size(), false);
+  for(const DrawItem& di : drawItems)
+  {
+    if(objectTested[di.objectIndex])
+    {
+      continue;
+    }
+    objectTested[di.objectIndex] = true;
+
+    const CadScene::BBox& bbox   = scene->m_geometryBboxes[di.geometryIndex];
+    const glm::mat4&      matrix = scene->m_matrices[di.matrixIndex].worldMatrix;
+
+    glm::vec3 wMin(FLT_MAX);
+    glm::vec3 wMax(-FLT_MAX);
+    for(int i = 0; i < 8; i++)
+    {
+      glm::vec4 corner((i & 1) ? bbox.max.x : bbox.min.x, (i & 2) ? bbox.max.y : bbox.min.y,
+                       (i & 4) ? bbox.max.z : bbox.min.z, 1.0f);
+      glm::vec3 wPos = glm::vec3(matrix * corner);
+      wMin           = glm::min(wMin, wPos);
+      wMax           = glm::max(wMax, wPos);
+    }
+    wMin += shiftMin;
+    wMax += shiftMax;
+
+    // outside if all corners are beyond the same clip plane
+    uint32_t outside = 0x3F;
+    for(int i = 0; i < 8; i++)
+    {
+      glm::vec4 clip = viewProjMatrix
+                       * glm::vec4((i & 1) ? wMax.x : wMin.x, (i & 2) ? wMax.y : wMin.y, (i & 4) ? wMax.z : wMin.z, 1.0f);
+      uint32_t planes = 0;
+      planes |= clip.x < -clip.w ? 1 : 0;
+      planes |= clip.x > clip.w ? 2 : 0;
+      planes |= clip.y < -clip.w ? 4 : 0;
+      planes |= clip.y > clip.w ? 8 : 0;
+      planes |= clip.z < 0 ? 16 : 0;
+      planes |= clip.z > clip.w ? 32 : 0;
+      outside &= planes;
+    }
+    if(outside)
+    {
+      continue;
+    }
+
+    glm::vec3 nearest = glm::clamp(viewPos, wMin, wMax);
+    visible.push_back({glm::distance(nearest, viewPos), uint32_t(di.geometryIndex)});
+  }
+
+  // nearest first, they win if not all fit into the budget
+  std::sort(visible.begin(), visible.end());
+
+  geometryIndices.clear();
+  for(const auto& it : visible)
+  {
+    if(!geometryUsed[it.second])
+    {
+      geometryUsed[it.second] = true;
+      geometryIndices.push_back(it.second);
+    }
   }
 }
 
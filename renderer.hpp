@@ -37,13 +37,25 @@ public:
   {
     PER_DRAW_PUSHCONSTANTS,
     PER_DRAW_INDEX_BASEINSTANCE,
-    PER_DRAW_INDEX_ATTRIBUTE
+    PER_DRAW_INDEX_ATTRIBUTE,
+    PER_DRAW_INDEX_DRAWID,
+    PER_DRAW_UBO_DYNAMIC,
+    PER_DRAW_INDEX_MULTIDRAW
   };
 
   struct Stats
   {
-    uint32_t drawCalls     = 0;
-    uint32_t drawTriangles = 0;
+    uint32_t drawCalls      = 0;
+    uint32_t drawTriangles  = 0;
+    uint32_t drawGeometries = 0;  // geometry switches between consecutive drawcalls
+
+    // occlusion culling results, delayed by a few frames
+    uint32_t cullEarly  = 0;  // drawn by the early pass
+    uint32_t cullLate   = 0;  // drawn by the late pass, missed by the early pass
+    uint32_t cullCulled = 0;
+
+    // CPU time to record the scene command buffer(s), including the per-draw buffer uploads
+    float recordTimeMs = 0;
   };
 
   struct Config
@@ -54,6 +66,11 @@ public:
     bool     passthrough     = true;
     bool     colorizeDraws   = false;
     bool     ignoreMaterials = false;
+    bool     partOverrides   = false;
+    bool     partCoverage    = false;
+    bool     occlusionCull   = false;  // only with the MDI per-draw buffer modes
+    bool     vertexPulling   = false;  // vertices fetched via buffer address, no vertex buffer binds
+    int      lodPixels       = 0;      // projected object size below which coarser levels are drawn, 0 disables
     uint32_t searchBatch = 16;
 
     // MODE_PER_TRI_GLOBAL_PART_SEARCH_FS settings
@@ -74,12 +91,16 @@ public:
     int                 objectIndex;
     uint32_t            objectOffset;
     int                 partCount;
+    bool                index16;  // geometry has 16-bit indices, see CadScene::MAX_INDEX16_VERTICES
+    int                 lod;      // level of detail of range, see CadScene::Geometry::lods
     CadScene::DrawRange range;
   };
 
   static inline bool DrawItem_compare_groups(const DrawItem& a, const DrawItem& b)
   {
     int diff = 0;
+    // 16-bit and 32-bit indices are in different index buffers
+    diff     = diff != 0 ? diff : (int(b.index16) - int(a.index16));
     diff     = diff != 0 ? diff : (a.geometryIndex - b.geometryIndex);
     diff     = diff != 0 ? diff : (a.materialIndex - b.materialIndex);
     diff     = diff != 0 ? diff : (a.matrixIndex - b.matrixIndex);
@@ -122,6 +143,23 @@ public:
 
   void fillDrawItems(std::vector<DrawItem>& drawItems, const CadScene* NV_RESTRICT scene, const Config& config, uint32_t maxCombine, Stats& stats);
 
+  // picks the level of detail of every object by its projected size, returns true if any draw item changed
+  bool updateLods(std::vector<DrawItem>&      drawItems,
+                  const CadScene* NV_RESTRICT scene,
+                  const Config&               config,
+                  const glm::mat4&            viewProjMatrix,
+                  const glm::vec3&            viewPos,
+                  int                         width,
+                  int                         height,
+                  Stats&                      stats);
+
+  // geometries of the draw items in the view frustum, nearest first, see CadSceneVK::requestGeometries
+  static void getVisibleGeometries(std::vector<uint32_t>&       geometryIndices,
+                                   const std::vector<DrawItem>& drawItems,
+                                   const CadScene* NV_RESTRICT  scene,
+                                   const glm::mat4&             viewProjMatrix,
+                                   const glm::vec3&             viewPos);
+
   Config                      m_config;
   const CadScene* NV_RESTRICT m_scene;
 };
@@ -33,6 +33,7 @@
 
 #include "common.h"
 
+#include <chrono>
 #include <numeric> // std::iota
 
 namespace idraster {
@@ -51,6 +52,8 @@ public:
     MODE_PER_TRI_ID_FS,
     MODE_PER_TRI_BATCH_PART_SEARCH_FS,
     MODE_PER_TRI_GLOBAL_PART_SEARCH_FS,
+    MODE_PER_MESHLET_ID_MS,
+    MODE_PER_VERTEX_PART_ID_FS,
   };
 
   class TypeInstance : public Renderer::Type
@@ -149,6 +152,41 @@ public:
     Resources* resources() { return ResourcesVK::get(); }
   };
 
+  class TypeMeshlet : public Renderer::Type
+  {
+    bool isAvailable(const nvvk::Context& context) const
+    {
+      return context.hasDeviceExtension(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    }
+
+    const char* name() const { return "per-meshlet part index ms"; }
+    Renderer*   create() const
+    {
+      RendererVK* renderer = new RendererVK();
+      renderer->m_mode     = MODE_PER_MESHLET_ID_MS;
+      return renderer;
+    }
+    unsigned int priority() const { return 1; }
+
+    Resources* resources() { return ResourcesVK::get(); }
+  };
+
+  class TypeVertexPart : public Renderer::Type
+  {
+    bool isAvailable(const nvvk::Context& context) const { return true; }
+
+    const char* name() const { return "per-vertex flat part index fs"; }
+    Renderer*   create() const
+    {
+      RendererVK* renderer = new RendererVK();
+      renderer->m_mode     = MODE_PER_VERTEX_PART_ID_FS;
+      return renderer;
+    }
+    unsigned int priority() const { return 1; }
+
+    Resources* resources() { return ResourcesVK::get(); }
+  };
+
 public:
   bool init(const CadScene* NV_RESTRICT scene, Resources* resources, const Config& config, Stats& stats) override;
   void deinit() override;
@@ -163,19 +201,102 @@ private:
   struct StateSetup
   {
     nvvk::ShaderModuleID vertexShader;
+    nvvk::ShaderModuleID meshShader;  // replaces the vertex shader for MODE_PER_MESHLET_ID_MS
     nvvk::ShaderModuleID geometryShader;
     nvvk::ShaderModuleID fragmentShader;
+    nvvk::ShaderModuleID fragmentShaderCutout;  // USE_PART_CUTOUTS variants, only with Config::partOverrides
+    nvvk::ShaderModuleID fragmentShaderCoverage;
+    nvvk::ShaderModuleID fragmentShaderCoverageCutout;
+
+    // see getScenePipeline and getCoveragePipeline
+    VkPipeline                   pipeline               = VK_NULL_HANDLE;
+    VkPipeline                   pipelineCutout         = VK_NULL_HANDLE;
+    VkPipeline                   pipelineCoverage       = VK_NULL_HANDLE;
+    VkPipeline                   pipelineCoverageCutout = VK_NULL_HANDLE;
+    nvvk::DescriptorSetContainer container;
+    nvvk::DescriptorSetContainer containerPerDraw;  // set 1, only for PER_DRAW_UBO_DYNAMIC
+    VkPipelineLayout             pipeLayout = VK_NULL_HANDLE;  // container's, or both sets for PER_DRAW_UBO_DYNAMIC
+
+    // placeholder boxes of the objects whose geometry is not ready, see cmdBBoxes
+    nvvk::ShaderModuleID bboxVertexShader;
+    nvvk::ShaderModuleID bboxFragmentShader;
+    VkPipeline           pipelineBBox   = VK_NULL_HANDLE;
+    VkPipelineLayout     pipeLayoutBBox = VK_NULL_HANDLE;  // set 0 of container, BBoxPushData
+  };
 
+  // PER_DRAW_UBO_DYNAMIC: every change of per-draw state gets its own aligned slot
+  struct PerDrawUbo
+  {
+    MappedBuffer buffer;
+    uint8_t*     mapping  = nullptr;
+    VkDeviceSize slotSize = 0;
+    size_t       numSlots = 0;
+    size_t       maxSlots = 0;
+  };
+
+  // MDI batches of fillCmdBufferPerDrawBuffer, replayed for the coverage pass.
+  // With PER_DRAW_INDEX_MULTIDRAW the offset addresses m_multiDraws instead of the indirect buffer.
+  struct MdiBatch
+  {
+    VkBuffer     vbo;
+    VkBuffer     ibo;
+    VkIndexType  indexType;
+    VkDeviceSize offset;
+    uint32_t     count;
+  };
+
+  // two-pass occlusion culling of the MDI drawcalls against ResourcesVK::m_hiz
+  struct Culling
+  {
+    bool                         enabled = false;
+    nvvk::ShaderModuleID         shader;
     VkPipeline                   pipeline = VK_NULL_HANDLE;
-    nvvk::DescriptorSetContainer container;
+    nvvk::DescriptorSetContainer container;  // set per CULL_PASS
+
+    ResBuffer    bboxes;        // per geometry
+    MappedBuffer drawInfos;     // per drawcall
+    MappedBuffer drawn;         // per drawcall, drawn by early pass
+    MappedBuffer indirectLate;  // copy of m_indirectDrawBuffer for the late pass
+    ResBuffer    stats;
+    ReadbackRing statsReadback;
+
+    glm::mat4 viewProjPrev;
+    bool      hizValid = false;
+  };
+
+  // one version per frame in flight plus the one being recorded
+  static const uint32_t NUM_SET_VERSIONS = nvvk::DEFAULT_RING_SIZE + 1;
+
+  // command buffers replaced by a re-record, freed once no frame in flight uses them
+  struct RetiredCmdBuffers
+  {
+    VkCommandBuffer cmdBuffer;
+    VkCommandBuffer cmdBufferLate;
+    uint32_t        lastFrame;
   };
 
   struct DrawSetup
   {
-    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkCommandBuffer cmdBuffer     = VK_NULL_HANDLE;
+    VkCommandBuffer cmdBufferLate = VK_NULL_HANDLE;  // late pass of the occlusion culling
+
+    // recorded by setupCmdBuffer, without the draw items whose geometry is not ready
+    // or whose parts are all hidden
+    uint32_t drawCount = 0;
+
+    // recorded with the USE_PART_CUTOUTS pipelines
+    bool   cutouts        = false;
+    size_t hiddenChangeID = 0;
+
+    // Re-recording writes the per-draw bindings into the next version of the descriptor
+    // sets, the previous ones stay untouched until the frames using them completed.
+    uint32_t setVersion                     = 0;
+    bool     setRetired[NUM_SET_VERSIONS]   = {};
+    uint32_t setLastFrame[NUM_SET_VERSIONS] = {};
 
     size_t fboChangeID;
     size_t pipeChangeID;
+    size_t geometryChangeID;
   };
 
   std::vector<DrawItem> m_drawItems;
@@ -183,21 +304,44 @@ private:
   VkCommandPool         m_cmdPool;
   DrawSetup             m_draw;
   StateSetup            m_setup;
-  ResBuffer             m_perDrawDataBuffer;
+  MappedBuffer          m_perDrawDataBuffer;
   ResBuffer             m_perDrawIndexBuffer;
-  ResBuffer             m_indirectDrawBuffer;
+  MappedBuffer          m_indirectDrawBuffer;
+  PerDrawUbo            m_perDrawUbo;
+  std::vector<MdiBatch> m_mdiBatches;
+  Culling               m_cull;
+
+  std::vector<RetiredCmdBuffers> m_retiredCmdBuffers;
+
+  // with a geometry budget, requested every frame
+  std::vector<uint32_t> m_visibleGeometries;
+
+  // PER_DRAW_INDEX_MULTIDRAW: CPU-side draws consumed by vkCmdDrawMultiIndexedEXT at record time
+  std::vector<VkMultiDrawIndexedInfoEXT> m_multiDraws;
+  uint32_t                               m_maxMultiDrawCount = 0;
+
+  // MODE_PER_MESHLET_ID_MS: workgroups along x per vkCmdDrawMeshTasksEXT, with one row per copy
+  uint32_t m_maxMeshTasks = 0;
+
+  // MODE_PER_TRI_ID_GS/FS: geometries of the recorded draws, whose triangle part ids get
+  // expanded on the device before the next frame's render pass
+  std::vector<uint32_t> m_expandGeometries;
+
+  float m_recordTimeMs = 0;
 
   ResourcesVK* NV_RESTRICT m_resources;
 
-  void fillCmdBuffer(VkCommandBuffer cmd, const DrawItem* NV_RESTRICT drawItems, size_t drawCount)
+  void fillCmdBuffer(VkCommandBuffer cmd, VkPipeline pipeline, const DrawItem* NV_RESTRICT drawItems, size_t drawCount)
   {
     const ResourcesVK* res   = m_resources;
     const CadSceneVK&  scene = res->m_scene;
 
     int      lastMaterial     = -1;
     int      lastGeometry     = -1;
+    int      lastLod          = -1;
     int      lastMatrix       = -1;
     uint32_t lastUniqueOffset = ~0;
+    uint32_t lastPartRebase   = 0;
     VkBuffer lastVbo          = VK_NULL_HANDLE;
     VkBuffer lastIbo          = VK_NULL_HANDLE;
 
@@ -205,89 +349,131 @@ private:
     uint32_t numDrawCalls           = 0;
     uint32_t numPushConstantUpdates = 0;
     uint32_t numPushConstantBytes   = 0;
+    uint32_t numUboBinds            = 0;
+    uint32_t numCopies              = uint32_t(m_scene->m_copies.size());
 
     nvvk::DebugUtil::ScopedCmdLabel dbgLabel(cmd, "fillCmdBuffer");
 
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.container.getPipeLayout(), 0, 1,
-                            m_setup.container.getSets(), 0, NULL);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeLayout, 0, 1, m_setup.container.getSets(m_draw.setVersion), 0, NULL);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    // PER_DRAW_UBO_DYNAMIC collects the state changes into a new slot of the
+    // per-draw uniform buffer, which is bound via dynamic offset before the drawcall
+    bool         useUbo   = m_config.perDrawParameterMode == Renderer::PER_DRAW_UBO_DYNAMIC;
+    bool         uboDirty = false;
+    DrawPushData uboState = {};
+    m_perDrawUbo.numSlots = 0;
+
+    auto cmdPushState = [&](uint32_t offset, uint32_t size, const void* data) {
+      if(useUbo)
+      {
+        memcpy(reinterpret_cast<uint8_t*>(&uboState) + offset, data, size);
+        uboDirty = true;
+      }
+      else
+      {
+        vkCmdPushConstants(cmd, m_setup.pipeLayout, VK_SHADER_STAGE_GEOMETRY_BIT | getVertexStage() | VK_SHADER_STAGE_FRAGMENT_BIT,
+                           offset, size, data);
+        numPushConstantBytes += size;
+        ++numPushConstantUpdates;
+      }
+    };
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeline);
+    auto cmdFlushUbo = [&]() {
+      if(uboDirty)
+      {
+        assert(m_perDrawUbo.numSlots < m_perDrawUbo.maxSlots);
+        uint32_t dynamicOffset = uint32_t(m_perDrawUbo.numSlots * m_perDrawUbo.slotSize);
+        memcpy(m_perDrawUbo.mapping + dynamicOffset, &uboState, getDrawDataSize());
+        m_perDrawUbo.numSlots++;
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeLayout, 1, 1,
+                                m_setup.containerPerDraw.getSets(m_draw.setVersion), 1, &dynamicOffset);
+        ++numUboBinds;
+        uboDirty = false;
+      }
+    };
 
     for(size_t idx = 0; idx < drawCount; idx++)
     {
       const DrawItem&             di  = drawItems[idx];
       const CadSceneVK::Geometry& geo = scene.m_geometry[di.geometryIndex];
-      assert(geo.ibo.offset % sizeof(uint32_t) == 0);
-      uint32_t drawIndicesOffset = uint32_t(geo.ibo.offset + di.range.offset) / sizeof(uint32_t);
+      uint32_t drawIndicesOffset = getFirstIndex(geo, di);
       uint32_t drawIndicesCount  = di.range.count;
 
       if(lastGeometry != di.geometryIndex)
       {
-        if(geo.vbo.buffer != lastVbo)
+        if(m_mode == MODE_PER_MESHLET_ID_MS)
+        {
+          // the mesh shader fetches everything through the addresses, nothing is bound
+          cmdPushState(offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.meshletsAddr);
+          cmdPushState(offsetof(DrawPushData, vboAddr), sizeof(uint64_t), &geo.vboAddr);
+          cmdPushState(offsetof(DrawPushData, meshletIndicesAddr), sizeof(uint64_t), &geo.meshletIndicesAddr);
+        }
+        else if(m_config.vertexPulling)
+        {
+          cmdPushState(offsetof(DrawPushData, vboAddr), sizeof(uint64_t), &geo.vboAddr);
+        }
+        else if(geo.vbo.buffer != lastVbo)
         {
           lastVbo             = geo.vbo.buffer;
           VkDeviceSize offset = 0;
           vkCmdBindVertexBuffers(cmd, BINDING_PER_VERTEX, 1, &geo.vbo.buffer, &offset);
           ++numBufferBinds;
         }
-        if(geo.ibo.buffer != lastIbo)
+        if(geo.ibo.buffer != lastIbo && m_mode != MODE_PER_MESHLET_ID_MS)
         {
           lastIbo = geo.ibo.buffer;
-          vkCmdBindIndexBuffer(cmd, geo.ibo.buffer, 0, VK_INDEX_TYPE_UINT32);
+          vkCmdBindIndexBuffer(cmd, geo.ibo.buffer, 0, geo.indexType);
           ++numBufferBinds;
         }
 
         lastGeometry = di.geometryIndex;
+        lastLod      = -1;
+      }
+
+      // draws of parts beyond the 16-bit encoding change the ids address per draw
+      uint32_t partRebase = getPartRebase(di);
+      if(lastLod != di.lod || lastPartRebase != partRebase)
+      {
+        lastLod        = di.lod;
+        lastPartRebase = partRebase;
 
+        uint64_t idsAddr = 0;
         if(m_mode == MODE_PER_TRI_ID_GS)
         {
-          vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                             VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                             offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.trianglePartIdsAddr);
-          numPushConstantBytes += sizeof(uint64_t);
-          ++numPushConstantUpdates;
+          idsAddr = uint64_t(geo.trianglePartIdsAddr);
         }
         else if(m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_GS)
         {
-          vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                             VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                             offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.partTriCountsAddr);
-          numPushConstantBytes += sizeof(uint64_t);
-          ++numPushConstantUpdates;
+          idsAddr = getPartIdsAddress(geo.partTriCountsAddr, di);
         }
         else if(m_mode == MODE_PER_TRI_ID_FS)
         {
-          vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                             VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                             offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.trianglePartIdsAddr);
-          numPushConstantBytes += sizeof(uint64_t);
-          ++numPushConstantUpdates;
+          idsAddr = uint64_t(geo.trianglePartIdsAddr);
         }
         else if(m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_FS)
         {
-          vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                             VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                             offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.partTriCountsAddr);
-          numPushConstantBytes += sizeof(uint64_t);
-          ++numPushConstantUpdates;
+          idsAddr = getPartIdsAddress(geo.partTriCountsAddr, di);
         }
         else if(m_mode == MODE_PER_TRI_GLOBAL_PART_SEARCH_FS)
         {
-          vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                             VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                             offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &geo.partTriOffsetsAddr);
-          numPushConstantBytes += sizeof(uint64_t);
-          ++numPushConstantUpdates;
+          idsAddr = getPartIdsAddress(geo.partTriOffsetsAddr, di);
+        }
+        else if(m_mode == MODE_PER_VERTEX_PART_ID_FS)
+        {
+          idsAddr = uint64_t(geo.vertexPartIdsAddr);
+        }
+        if(idsAddr)
+        {
+          cmdPushState(offsetof(DrawPushData, idsAddr), sizeof(uint64_t), &idsAddr);
         }
       }
 
       if(lastMatrix != di.matrixIndex)
       {
-        vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                           VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                           offsetof(DrawPushData, matrixIndex), sizeof(uint32_t), &di.matrixIndex);
-        numPushConstantBytes += sizeof(uint32_t);
-        ++numPushConstantUpdates;
+        cmdPushState(offsetof(DrawPushData, matrixIndex), sizeof(uint32_t), &di.matrixIndex);
 
         lastMatrix = di.matrixIndex;
       }
@@ -300,28 +486,23 @@ private:
 
       if(lastMaterial != materialIndex)
       {
-        vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                           VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                           offsetof(DrawPushData, materialIndex), sizeof(uint32_t), &materialIndex);
-        numPushConstantBytes += sizeof(uint32_t);
-        ++numPushConstantUpdates;
+        cmdPushState(offsetof(DrawPushData, materialIndex), sizeof(uint32_t), &materialIndex);
 
         lastMaterial = materialIndex;
       }
 
-      if(di.objectOffset != lastUniqueOffset)
+      uint32_t uniquePartOffset = di.objectOffset + partRebase;
+      if(uniquePartOffset != lastUniqueOffset)
       {
-        vkCmdPushConstants(cmd, m_setup.container.getPipeLayout(),
-                           VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                           offsetof(DrawPushData, uniquePartOffset), sizeof(uint32_t), &di.objectOffset);
-        numPushConstantBytes += sizeof(uint32_t);
-        ++numPushConstantUpdates;
+        cmdPushState(offsetof(DrawPushData, uniquePartOffset), sizeof(uint32_t), &uniquePartOffset);
 
-        lastUniqueOffset = di.objectOffset;
+        lastUniqueOffset = uniquePartOffset;
       }
 
       // drawcall
       uint32_t instanceIndex;
+      uint32_t firstMeshlet = 0;
+      uint32_t numMeshlets  = 0;
       switch(m_mode)
       {
         case RendererVK::MODE_PER_DRAW_BASEINST:
@@ -339,21 +520,54 @@ private:
         case RendererVK::MODE_PER_TRI_GLOBAL_PART_SEARCH_FS:
           // the partIndex is encoded per triangle in the idsBuffer
           // instanceIndex will encode the offset into the per-triangle idsBuffer, / 3 because 3 indices per triangle.
-          assert(di.partIndex < (1 << 16));
-          assert(di.partCount < (1 << 16));
-          instanceIndex = uint32_t(di.partCount) | (uint32_t(di.partIndex) << 16);
+          assert(di.partCount <= int(CadScene::MAX_SEARCH_PARTS));
+          instanceIndex = uint32_t(di.partCount) | ((uint32_t(di.partIndex) - partRebase) << 16);
+          break;
+        case RendererVK::MODE_PER_MESHLET_ID_MS:
+          // the meshlets of all parts of the item, the mesh shader adds the workgroup index
+          firstMeshlet = getMeshletRange(di, numMeshlets);
+          cmdPushState(offsetof(DrawPushData, flexible), sizeof(uint32_t), &firstMeshlet);
+          instanceIndex = 0;
           break;
         default:
           instanceIndex = 0;
           break;
       }
-      assert(geo.vbo.offset % sizeof(CadScene::Vertex) == 0);
-      vkCmdDrawIndexed(cmd, drawIndicesCount, 1, drawIndicesOffset, geo.vbo.offset / sizeof(CadScene::Vertex), instanceIndex);
+      cmdFlushUbo();
+
+      if(m_mode == MODE_PER_MESHLET_ID_MS)
+      {
+        // one row of workgroups per copy, split at the device limits
+        for(uint32_t first = 0; first < numMeshlets; first += m_maxMeshTasks)
+        {
+          if(first)
+          {
+            uint32_t chunkMeshlet = firstMeshlet + first;
+            cmdPushState(offsetof(DrawPushData, flexible), sizeof(uint32_t), &chunkMeshlet);
+            cmdFlushUbo();
+          }
+          vkCmdDrawMeshTasksEXT(cmd, std::min(numMeshlets - first, m_maxMeshTasks), numCopies, 1);
+          ++numDrawCalls;
+        }
+        continue;
+      }
+
+      assert(geo.vbo.offset % m_scene->m_vertexStride == 0);
+      int32_t vertexOffset = m_config.vertexPulling ? 0 : int32_t(geo.vbo.offset / m_scene->m_vertexStride);
+      vkCmdDrawIndexed(cmd, drawIndicesCount, numCopies, drawIndicesOffset, vertexOffset, instanceIndex);
       ++numDrawCalls;
     }
 
-    LOGSTATS("buffer binds: %u, push constant updates: %u (%u byte), drawcalls: %u \n", numBufferBinds,
-             numPushConstantUpdates, numPushConstantBytes, numDrawCalls);
+    if(useUbo)
+    {
+      LOGSTATS("buffer binds: %u, dynamic ubo binds: %u (%u byte), drawcalls: %u \n", numBufferBinds, numUboBinds,
+               uint32_t(numUboBinds * getDrawDataSize()), numDrawCalls);
+    }
+    else
+    {
+      LOGSTATS("buffer binds: %u, push constant updates: %u (%u byte), drawcalls: %u \n", numBufferBinds,
+               numPushConstantUpdates, numPushConstantBytes, numDrawCalls);
+    }
   }
 
   void fillCmdBufferPerDrawBuffer(VkCommandBuffer cmd, const DrawItem* NV_RESTRICT drawItems, size_t drawCount)
@@ -361,14 +575,16 @@ private:
     const ResourcesVK* res   = m_resources;
     const CadSceneVK&  scene = res->m_scene;
 
-    int      lastMaterial     = -1;
-    int      lastGeometry     = -1;
-    int      lastMatrix       = -1;
-    uint32_t lastUniqueOffset = ~0;
-    VkBuffer lastVbo          = VK_NULL_HANDLE;
-    VkBuffer lastIbo          = VK_NULL_HANDLE;
+    int         lastMaterial     = -1;
+    int         lastGeometry     = -1;
+    int         lastMatrix       = -1;
+    uint32_t    lastUniqueOffset = ~0;
+    VkBuffer    lastVbo          = VK_NULL_HANDLE;
+    VkBuffer    lastIbo          = VK_NULL_HANDLE;
+    VkIndexType lastIndexType    = VK_INDEX_TYPE_UINT32;
 
     uint32_t numBufferBinds = 0;
+    uint32_t numCopies      = uint32_t(m_scene->m_copies.size());
 
     uint32_t     numMDIDraws     = 0;  // keep track of the number of draws in the current MDI batch
     VkDeviceSize mdiBufferOffset = 0;  // keep track of the offset for the next VkDrawIndexedIndirectCommand
@@ -376,31 +592,38 @@ private:
 
     nvvk::DebugUtil::ScopedCmdLabel dbgLabel(cmd, "fillCmdBufferPerDrawBuffer");
 
-    // Here we store per-Draw data into a buffer
-    m_perDrawDataBuffer = m_resources->createBuffer(sizeof(DrawPushData) * drawCount,
-                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-    assert(m_perDrawDataBuffer.buffer);
+    // Here we store per-Draw data into a buffer, written directly through its persistent mapping.
+    // The stride leaves out the addresses the shaders of this mode do not declare.
+    uint32_t drawDataSize = getDrawDataSize();
+    uint8_t* perDrawData  = (uint8_t*)m_perDrawDataBuffer.map(drawDataSize * drawCount, res->m_frame);
 
     {
       VkDevice                          device = res->m_device;
       std::vector<VkWriteDescriptorSet> updateDescriptors;
 
-      updateDescriptors.push_back(m_setup.container.makeWrite(0, DRAW_SSBO_PER_DRAW, &m_perDrawDataBuffer.info));
+      updateDescriptors.push_back(m_setup.container.makeWrite(m_draw.setVersion, DRAW_SSBO_PER_DRAW, &m_perDrawDataBuffer.getBuffer().info));
 
       vkUpdateDescriptorSets(device, updateDescriptors.size(), updateDescriptors.data(), 0, 0);
     }
 
     // m_indirectDrawBuffer stores the MDI draw calls in the form of VkDrawIndexedIndirectCommand
-    m_indirectDrawBuffer = m_resources->createBuffer(sizeof(VkDrawIndexedIndirectCommand) * drawCount,
-                                                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-    assert(m_indirectDrawBuffer.buffer);
+    // the occlusion culling writes their instanceCount
+    // multi-draw passes the draws directly when recording, no buffer needed
+    bool useMultiDraw = m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_MULTIDRAW;
+    VkDrawIndexedIndirectCommand* indirectDraws = nullptr;
+    if(!useMultiDraw)
+    {
+      indirectDraws =
+          (VkDrawIndexedIndirectCommand*)m_indirectDrawBuffer.map(sizeof(VkDrawIndexedIndirectCommand) * drawCount, res->m_frame);
+    }
+    VkBuffer indirectBuffer = m_indirectDrawBuffer.getBuffer().buffer;
 
 
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.container.getPipeLayout(), 0, 1,
-                            m_setup.container.getSets(), 0, NULL);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeLayout, 0, 1, m_setup.container.getSets(m_draw.setVersion), 0, NULL);
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeline);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, getScenePipeline());
 
+    if(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_ATTRIBUTE)
     {
       // This is an optional buffer, "emulating" gl_BaseInstance, which can be faster on some hardware
       // setupPipeline() set this vertex buffer up to be indexed by the instance ID
@@ -412,31 +635,37 @@ private:
     auto flushMDIDraws = [&]() {
       if(numMDIDraws)
       {
-        vkCmdDrawIndexedIndirect(cmd, m_indirectDrawBuffer.buffer, startMdiBufferOffset, numMDIDraws,
-                                 sizeof(VkDrawIndexedIndirectCommand));
+        cmdDrawBatch(cmd, indirectBuffer, startMdiBufferOffset, numMDIDraws);
+        m_mdiBatches.push_back({lastVbo, lastIbo, lastIndexType, startMdiBufferOffset, numMDIDraws});
         startMdiBufferOffset = mdiBufferOffset;
         numMDIDraws          = 0;
       }
     };
 
 
-    std::vector<DrawPushData>                 perDrawData(drawCount);
-    std::vector<VkDrawIndexedIndirectCommand> indirectDraws;
+    CullDrawInfo* cullDrawInfos = nullptr;
+    if(m_cull.enabled)
+    {
+      cullDrawInfos = (CullDrawInfo*)m_cull.drawInfos.map(sizeof(CullDrawInfo) * drawCount, res->m_frame);
+    }
+
+    m_mdiBatches.clear();
+    m_multiDraws.clear();
 
     for(size_t drawId = 0; drawId < drawCount; drawId++)
     {
       const DrawItem&             di       = drawItems[drawId];
       const CadSceneVK::Geometry& geo      = scene.m_geometry[di.geometryIndex];
-      DrawPushData&               drawData = perDrawData[drawId];
+      DrawPushData                drawData = {};
       drawData.flexible                    = drawId;
 
-      assert(geo.ibo.offset % sizeof(uint32_t) == 0);
-      uint32_t drawIndicesOffset = uint32_t(geo.ibo.offset + di.range.offset) / sizeof(uint32_t);
+      uint32_t drawIndicesOffset = getFirstIndex(geo, di);
       uint32_t drawIndicesCount  = di.range.count;
 
       if(lastGeometry != di.geometryIndex)
       {
-        if(geo.vbo.buffer != lastVbo)
+        // with vertex pulling only the index buffer splits the MDI batches
+        if(!m_config.vertexPulling && geo.vbo.buffer != lastVbo)
         {
           flushMDIDraws();
 
@@ -449,8 +678,9 @@ private:
         {
           flushMDIDraws();
 
-          lastIbo = geo.ibo.buffer;
-          vkCmdBindIndexBuffer(cmd, geo.ibo.buffer, 0, VK_INDEX_TYPE_UINT32);
+          lastIbo       = geo.ibo.buffer;
+          lastIndexType = geo.indexType;
+          vkCmdBindIndexBuffer(cmd, geo.ibo.buffer, 0, geo.indexType);
           ++numBufferBinds;
         }
 
@@ -462,7 +692,7 @@ private:
       }
       else if(m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_GS)
       {
-        drawData.idsAddr = uint64_t(geo.partTriCountsAddr);
+        drawData.idsAddr = getPartIdsAddress(geo.partTriCountsAddr, di);
       }
       else if(m_mode == MODE_PER_TRI_ID_FS)
       {
@@ -470,15 +700,30 @@ private:
       }
       else if(m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_FS)
       {
-        drawData.idsAddr = uint64_t(geo.partTriCountsAddr);
+        drawData.idsAddr = getPartIdsAddress(geo.partTriCountsAddr, di);
       }
       else if(m_mode == MODE_PER_TRI_GLOBAL_PART_SEARCH_FS)
       {
-        drawData.idsAddr = uint64_t(geo.partTriOffsetsAddr);
+        drawData.idsAddr = getPartIdsAddress(geo.partTriOffsetsAddr, di);
+      }
+      else if(m_mode == MODE_PER_VERTEX_PART_ID_FS)
+      {
+        drawData.idsAddr = uint64_t(geo.vertexPartIdsAddr);
+      }
+
+      if(m_config.vertexPulling)
+      {
+        drawData.vboAddr = uint64_t(geo.vboAddr);
       }
 
       drawData.matrixIndex = di.matrixIndex;
 
+      if(cullDrawInfos)
+      {
+        cullDrawInfos[drawId].matrixIndex   = di.matrixIndex;
+        cullDrawInfos[drawId].geometryIndex = di.geometryIndex;
+      }
+
       int materialIndex = di.materialIndex;
       if(m_config.colorizeDraws)
       {
@@ -486,7 +731,9 @@ private:
       }
       drawData.materialIndex = materialIndex;
 
-      drawData.uniquePartOffset = di.objectOffset;
+      // draws of parts beyond the 16-bit encoding are rebased, see getPartRebase
+      uint32_t partRebase       = getPartRebase(di);
+      drawData.uniquePartOffset = di.objectOffset + partRebase;
 
       switch(m_mode)
       {
@@ -504,65 +751,613 @@ private:
         case RendererVK::MODE_PER_TRI_GLOBAL_PART_SEARCH_FS:
           // the partIndex is encoded per triangle in the idsBuffer
           // instanceIndex will encode the offset into the per-triangle idsBuffer, / 3 because 3 indices per triangle.
-          assert(di.partIndex < (1 << 16));
-          assert(di.partCount < (1 << 16));
-          drawData.flexible = uint32_t(di.partCount) | (uint32_t(di.partIndex) << 16);
+          assert(di.partCount <= int(CadScene::MAX_SEARCH_PARTS));
+          drawData.flexible = uint32_t(di.partCount) | ((uint32_t(di.partIndex) - partRebase) << 16);
           break;
         default:
           break;
       }
 
 
-      assert(geo.vbo.offset % sizeof(CadScene::Vertex) == 0);
-      uint vertexOffset = geo.vbo.offset / sizeof(CadScene::Vertex);
+      assert(geo.vbo.offset % m_scene->m_vertexStride == 0);
+      uint vertexOffset = m_config.vertexPulling ? 0 : uint(geo.vbo.offset / m_scene->m_vertexStride);
 
       {
-        VkDrawIndexedIndirectCommand cmd{drawIndicesCount, 1, drawIndicesOffset, (int32_t)vertexOffset, (uint32_t)drawId};
-        indirectDraws.push_back(cmd);
+        // the emulated baseInstance attribute is fetched per instance, hence one entry per copy
+        uint32_t firstInstance = uint32_t(drawId);
+        if(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_ATTRIBUTE)
+        {
+          firstInstance *= numCopies;
+        }
+        else if(isDrawIdIndexed())
+        {
+          // the drawcall is identified by gl_DrawID instead
+          firstInstance = 0;
+        }
+        if(useMultiDraw)
+        {
+          m_multiDraws.push_back({drawIndicesOffset, drawIndicesCount, (int32_t)vertexOffset});
+        }
+        else
+        {
+          indirectDraws[drawId] = {drawIndicesCount, numCopies, drawIndicesOffset, (int32_t)vertexOffset, firstInstance};
+        }
         mdiBufferOffset += sizeof(VkDrawIndexedIndirectCommand);
       }
 
+      memcpy(perDrawData + drawDataSize * drawId, &drawData, drawDataSize);
       ++numMDIDraws;
     }
 
     flushMDIDraws();
 
+    if(getCoveragePipeline() && !m_cull.enabled)
     {
-      ResourcesVK* res = m_resources;
-      ScopeStaging staging(res->m_allocator, res->m_queue, res->m_queueFamily);
-      // now that we know how many and in what order the drawcalls happen, set up the per-drawcall buffer
-      staging.upload({m_perDrawDataBuffer.buffer, 0, drawCount * sizeof(DrawPushData)}, perDrawData.data());
-      // also upload the indirect draw data
-      staging.upload({m_indirectDrawBuffer.buffer, 0, drawCount * sizeof(VkDrawIndexedIndirectCommand)}, indirectDraws.data());
-      staging.submit();
-      // ScopeStaging will wait for the uploads to finish when going out of scope
+      // same draws again, now counting the visible pixels per part.
+      // With culling the final depth is only known after the late pass, see setupCmdBuffer.
+      cmdDrawMdiBatches(cmd, getCoveragePipeline(), indirectBuffer);
+    }
+
+    if(m_cull.enabled)
+    {
+      // the late pass starts from the same draws, the early pass has not drawn anything yet
+      void* indirectLate = m_cull.indirectLate.map(sizeof(VkDrawIndexedIndirectCommand) * drawCount, res->m_frame);
+      memcpy(indirectLate, indirectDraws, sizeof(VkDrawIndexedIndirectCommand) * drawCount);
+      void* drawn = m_cull.drawn.map(sizeof(uint32_t) * drawCount, res->m_frame);
+      memset(drawn, 0, sizeof(uint32_t) * drawCount);
     }
 
     LOGSTATS("buffer binds: %u, drawcalls: %u \n", numBufferBinds, numMDIDraws);
   }
 
 
+  // after the scene, so the boxes do not occlude anything drawn later in the frame
+  void cmdBBoxes(VkCommandBuffer cmd, const std::vector<DrawItem>& missingItems) const
+  {
+    if(missingItems.empty())
+    {
+      return;
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipelineBBox);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeLayoutBBox, 0, 1,
+                            m_setup.container.getSets(m_draw.setVersion), 0, NULL);
+
+    for(const DrawItem& di : missingItems)
+    {
+      const CadScene::BBox& bbox = m_scene->m_geometryBboxes[di.geometryIndex];
+
+      BBoxPushData push = {};
+      push.bboxMin      = glm::vec3(bbox.min);
+      push.bboxMax      = glm::vec3(bbox.max);
+      push.matrixIndex  = uint32_t(di.matrixIndex);
+      vkCmdPushConstants(cmd, m_setup.pipeLayoutBBox, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+      vkCmdDraw(cmd, 24, uint32_t(m_scene->m_copies.size()), 0, 0);
+    }
+  }
+
   void setupCmdBuffer(const DrawItem* NV_RESTRICT drawItems, size_t drawCount)
   { 
     ResourcesVK* res = m_resources;
 
+    auto recordBegin = std::chrono::high_resolution_clock::now();
+
+    nextSetVersion();
+
+    const ResourcesVK::PartOverrides& overrides = res->m_partOverrides;
+    m_draw.cutouts        = m_config.partOverrides && overrides.numCutouts;
+    m_draw.hiddenChangeID = overrides.hiddenChangeID;
+
+    // Draw items of geometries still being uploaded, or not resident within
+    // the geometry budget, are left out until a later re-record, their objects
+    // are drawn as boxes instead. Draw items of hidden parts are left out in
+    // every mode, not only by the occlusion culling.
+    bool skipHidden  = m_config.partOverrides && overrides.numHidden;
+    bool skipMissing = res->m_scene.isUploading() || res->m_scene.m_residency.budget;
+
+    std::vector<DrawItem> readyItems;
+    std::vector<DrawItem> missingItems;
+    if(skipHidden || skipMissing)
+    {
+      std::vector<bool> objectMissing(m_scene->m_objects.size(), false);
+      for(size_t i = 0; i < drawCount; i++)
+      {
+        if(skipHidden && isDrawHidden(drawItems[i]))
+        {
+          continue;
+        }
+        if(!skipMissing || res->m_scene.isGeometryReady(drawItems[i].geometryIndex))
+        {
+          readyItems.push_back(drawItems[i]);
+        }
+        else if(!objectMissing[drawItems[i].objectIndex])
+        {
+          objectMissing[drawItems[i].objectIndex] = true;
+          missingItems.push_back(drawItems[i]);
+        }
+      }
+      drawItems = readyItems.data();
+      drawCount = readyItems.size();
+    }
+
+    m_expandGeometries.clear();
+    if(m_mode == MODE_PER_TRI_ID_GS || m_mode == MODE_PER_TRI_ID_FS)
+    {
+      std::vector<bool> geometryUsed(res->m_scene.m_geometry.size(), false);
+      for(size_t i = 0; i < drawCount; i++)
+      {
+        if(!geometryUsed[drawItems[i].geometryIndex])
+        {
+          geometryUsed[drawItems[i].geometryIndex] = true;
+          m_expandGeometries.push_back(uint32_t(drawItems[i].geometryIndex));
+        }
+      }
+    }
+
+    m_draw.drawCount = uint32_t(drawCount);
+
     VkCommandBuffer cmd = res->createCmdBuffer(m_cmdPool, false, false, true);
     res->cmdDynamicState(cmd);
 
-    if (m_config.perDrawParameterMode == Renderer::PER_DRAW_PUSHCONSTANTS)
+    if(isBoundPerDraw())
     {
-        fillCmdBuffer(cmd, drawItems, drawCount);
+        if(m_config.perDrawParameterMode == Renderer::PER_DRAW_UBO_DYNAMIC)
+        {
+          size_t maxSlots = drawCount;
+          if(m_mode == MODE_PER_MESHLET_ID_MS)
+          {
+            // every further chunk of the mesh tasks changes the first meshlet
+            for(size_t i = 0; i < drawCount; i++)
+            {
+              uint32_t numMeshlets;
+              getMeshletRange(drawItems[i], numMeshlets);
+              maxSlots += numMeshlets ? (numMeshlets - 1) / m_maxMeshTasks : 0;
+            }
+          }
+          initPerDrawUbo(maxSlots);
+        }
+        fillCmdBuffer(cmd, getScenePipeline(), drawItems, drawCount);
+        if(getCoveragePipeline())
+        {
+          // same draws again, now counting the visible pixels per part
+          fillCmdBuffer(cmd, getCoveragePipeline(), drawItems, drawCount);
+        }
     }
     else
     {
         fillCmdBufferPerDrawBuffer(cmd, drawItems, drawCount);
     }
+    cmdBBoxes(cmd, missingItems);
 
     vkEndCommandBuffer(cmd);
     m_draw.cmdBuffer = cmd;
+
+    m_recordTimeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - recordBegin).count();
+
+    if(m_cull.enabled)
+    {
+      // the late pass draws the same batches, with instanceCount set only for the draws
+      // the early pass missed
+      VkCommandBuffer cmdLate = res->createCmdBuffer(m_cmdPool, false, false, true);
+      res->cmdDynamicState(cmdLate);
+
+      vkCmdBindDescriptorSets(cmdLate, VK_PIPELINE_BIND_POINT_GRAPHICS, m_setup.pipeLayout, 0, 1,
+                              m_setup.container.getSets(m_draw.setVersion), 0, NULL);
+      if(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_ATTRIBUTE)
+      {
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(cmdLate, BINDING_PER_INSTANCE, 1, &m_perDrawIndexBuffer.buffer, &offset);
+      }
+      cmdDrawMdiBatches(cmdLate, getScenePipeline(), m_cull.indirectLate.getBuffer().buffer);
+
+      if(getCoveragePipeline())
+      {
+        // the draws of both passes, each has the instanceCount of the draws it rendered
+        cmdDrawMdiBatches(cmdLate, getCoveragePipeline(), m_indirectDrawBuffer.getBuffer().buffer);
+        cmdDrawMdiBatches(cmdLate, getCoveragePipeline(), m_cull.indirectLate.getBuffer().buffer);
+      }
+
+      vkEndCommandBuffer(cmdLate);
+      m_draw.cmdBufferLate = cmdLate;
+
+      updateCullDescriptors();
+    }
+  }
+
+  // DrawRange offsets are in bytes of 32-bit indices, the device indices may be 16-bit
+  static uint32_t getFirstIndex(const CadSceneVK::Geometry& geo, const DrawItem& di)
+  {
+    VkDeviceSize indexSize = geo.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    assert(geo.ibo.offset % indexSize == 0);
+    return uint32_t(geo.ibo.offset / indexSize + di.range.offset / sizeof(uint32_t));
   }
 
-  void deleteCmdBuffer() { vkFreeCommandBuffers(m_resources->m_device, m_cmdPool, 1, &m_draw.cmdBuffer); }
+  // the per-part arrays of the coarser levels follow the full detail ones, see CadScene::Geometry::lods
+  // The search modes encode partCount | (partIndex << 16). A draw whose first part does not
+  // fit into 16 bits instead starts the ids address at its first part and adds the part to
+  // the unique part offset, the shaders then find the part relative to it. Small geometries
+  // keep the plain encoding.
+  uint32_t getPartRebase(const DrawItem& di) const
+  {
+    bool isSearch = m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_GS || m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_FS
+                    || m_mode == MODE_PER_TRI_GLOBAL_PART_SEARCH_FS;
+    return isSearch && di.partIndex >= (1 << 16) ? uint32_t(di.partIndex) : 0;
+  }
+
+  uint64_t getPartIdsAddress(VkDeviceAddress addr, const DrawItem& di) const
+  {
+    return uint64_t(addr) + sizeof(uint32_t) * (m_scene->m_geometry[di.geometryIndex].parts.size() * di.lod + getPartRebase(di));
+  }
+
+  // Meshlets are ordered by part, so the parts of a draw item have a contiguous range of
+  // meshlets. Only the full detail has meshlets, coarser levels draw it as well.
+  uint32_t getMeshletRange(const DrawItem& di, uint32_t& numMeshlets) const
+  {
+    const std::vector<CadScene::GeometryPart>& parts = m_scene->m_geometry[di.geometryIndex].parts;
+    const CadScene::GeometryPart&              first = parts[di.partIndex];
+    const CadScene::GeometryPart&              last  = parts[di.partIndex + di.partCount - 1];
+
+    numMeshlets = last.meshletOffset + last.meshletCount - first.meshletOffset;
+    return first.meshletOffset;
+  }
+
+  // mesh shaders replace the vertex stage for MODE_PER_MESHLET_ID_MS
+  VkShaderStageFlags getVertexStage() const
+  {
+    return m_mode == MODE_PER_MESHLET_ID_MS ? VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_VERTEX_BIT;
+  }
+
+  // Hidden or ghosted parts need late depth tests in the scene pass, so the picking of the
+  // visible parts moves to the depth-equal pass. Both switch only while such parts exist.
+  VkPipeline getScenePipeline() const { return m_draw.cutouts ? m_setup.pipelineCutout : m_setup.pipeline; }
+
+  // optional depth-equal pass, Config::partCoverage counts the visible pixels per part
+  VkPipeline getCoveragePipeline() const
+  {
+    return m_draw.cutouts ? m_setup.pipelineCoverageCutout : m_setup.pipelineCoverage;
+  }
+
+  // all parts of the draw item are hidden in every copy
+  bool isDrawHidden(const DrawItem& di) const
+  {
+    const std::vector<PartOverride>& table = m_resources->m_partOverrides.table;
+    for(const CadScene::Copy& copy : m_scene->m_copies)
+    {
+      for(int p = di.partIndex; p < di.partIndex + di.partCount; p++)
+      {
+        if((table[copy.partOffset + di.objectOffset + p].flags & PART_OVERRIDE_HIDDEN) == 0)
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // per-draw state is bound for every drawcall, rather than indexed from the buffers of the MDI path
+  bool isBoundPerDraw() const
+  {
+    return m_config.perDrawParameterMode == Renderer::PER_DRAW_PUSHCONSTANTS
+           || m_config.perDrawParameterMode == Renderer::PER_DRAW_UBO_DYNAMIC;
+  }
+
+  // the per-draw buffer is indexed by gl_DrawID plus a pushed batch offset
+  bool isDrawIdIndexed() const
+  {
+    return m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_DRAWID
+           || m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_MULTIDRAW;
+  }
+
+  // DrawPushData ends with addresses only some modes declare in their shaders, see common.h
+  uint32_t getDrawDataSize() const
+  {
+    if(m_mode == MODE_PER_MESHLET_ID_MS)
+    {
+      return uint32_t(sizeof(DrawPushData));
+    }
+    if(m_config.vertexPulling)
+    {
+      return uint32_t(offsetof(DrawPushData, meshletIndicesAddr));
+    }
+    return uint32_t(offsetof(DrawPushData, vboAddr));
+  }
+
+  // at most one slot per drawcall, fillCmdBuffer writes the used ones. The coverage pass
+  // records the same state changes again and rewrites the same slots with the same data.
+  void initPerDrawUbo(size_t maxSlots)
+  {
+    ResourcesVK* res = m_resources;
+
+    VkDeviceSize alignment = res->m_context->m_physicalInfo.properties10.limits.minUniformBufferOffsetAlignment;
+    m_perDrawUbo.slotSize  = (getDrawDataSize() + alignment - 1) & ~(alignment - 1);
+    m_perDrawUbo.numSlots  = 0;
+    m_perDrawUbo.maxSlots  = maxSlots;
+    m_perDrawUbo.mapping   = (uint8_t*)m_perDrawUbo.buffer.map(m_perDrawUbo.slotSize * maxSlots, res->m_frame);
+
+    VkDescriptorBufferInfo info  = {m_perDrawUbo.buffer.getBuffer().buffer, 0, getDrawDataSize()};
+    VkWriteDescriptorSet   write = m_setup.containerPerDraw.makeWrite(m_draw.setVersion, DRAW_UBO_PER_DRAW, &info);
+    vkUpdateDescriptorSets(res->m_device, 1, &write, 0, nullptr);
+  }
+
+  // requires the queue to be idle, all descriptor set versions are free again
+  void deleteCmdBuffer()
+  {
+    retireCmdBuffer();
+    for(const RetiredCmdBuffers& retired : m_retiredCmdBuffers)
+    {
+      freeCmdBuffers(retired);
+    }
+    m_retiredCmdBuffers.clear();
+    for(uint32_t v = 0; v < NUM_SET_VERSIONS; v++)
+    {
+      m_draw.setRetired[v] = false;
+    }
+  }
+
+  // keeps the command buffers and their descriptor set version until frames in flight completed
+  void retireCmdBuffer()
+  {
+    if(m_draw.cmdBuffer)
+    {
+      m_retiredCmdBuffers.push_back({m_draw.cmdBuffer, m_draw.cmdBufferLate, m_resources->m_frame});
+      m_draw.cmdBuffer     = VK_NULL_HANDLE;
+      m_draw.cmdBufferLate = VK_NULL_HANDLE;
+    }
+    m_draw.setRetired[m_draw.setVersion]   = true;
+    m_draw.setLastFrame[m_draw.setVersion] = m_resources->m_frame;
+  }
+
+  void freeCmdBuffers(const RetiredCmdBuffers& retired)
+  {
+    vkFreeCommandBuffers(m_resources->m_device, m_cmdPool, 1, &retired.cmdBuffer);
+    if(retired.cmdBufferLate)
+    {
+      vkFreeCommandBuffers(m_resources->m_device, m_cmdPool, 1, &retired.cmdBufferLate);
+    }
+  }
+
+  // RingFences::setCycleAndWait(frame) guarantees completion of all frames up to frame - DEFAULT_RING_SIZE,
+  // same as for MappedBuffer
+  void nextSetVersion()
+  {
+    ResourcesVK* res = m_resources;
+
+    for(size_t i = 0; i < m_retiredCmdBuffers.size();)
+    {
+      if(m_retiredCmdBuffers[i].lastFrame + nvvk::DEFAULT_RING_SIZE <= res->m_frame)
+      {
+        freeCmdBuffers(m_retiredCmdBuffers[i]);
+        m_retiredCmdBuffers.erase(m_retiredCmdBuffers.begin() + i);
+      }
+      else
+      {
+        i++;
+      }
+    }
+
+    uint32_t version = (m_draw.setVersion + 1) % NUM_SET_VERSIONS;
+    if(m_draw.setRetired[version] && m_draw.setLastFrame[version] + nvvk::DEFAULT_RING_SIZE > res->m_frame)
+    {
+      // only when re-recorded more than once per frame
+      LOGW("descriptor set version %d still in use, waiting for the queue\n", version);
+      vkQueueWaitIdle(res->m_queue);
+    }
+    m_draw.setVersion          = version;
+    m_draw.setRetired[version] = false;
+  }
+
+  // replays the MDI batches recorded by fillCmdBufferPerDrawBuffer
+  void cmdDrawMdiBatches(VkCommandBuffer cmd, VkPipeline pipeline, VkBuffer indirectBuffer) const
+  {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    VkBuffer lastVbo = VK_NULL_HANDLE;
+    VkBuffer lastIbo = VK_NULL_HANDLE;
+    for(const MdiBatch& batch : m_mdiBatches)
+    {
+      if(batch.vbo && batch.vbo != lastVbo)
+      {
+        lastVbo             = batch.vbo;
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(cmd, BINDING_PER_VERTEX, 1, &batch.vbo, &offset);
+      }
+      if(batch.ibo != lastIbo)
+      {
+        lastIbo = batch.ibo;
+        vkCmdBindIndexBuffer(cmd, batch.ibo, 0, batch.indexType);
+      }
+      cmdDrawBatch(cmd, indirectBuffer, batch.offset, batch.count);
+    }
+  }
+
+  // draws count drawcalls starting at indirectOffset, either from the indirect buffer
+  // or from m_multiDraws
+  void cmdDrawBatch(VkCommandBuffer cmd, VkBuffer indirectBuffer, VkDeviceSize indirectOffset, uint32_t count) const
+  {
+    uint32_t first = uint32_t(indirectOffset / sizeof(VkDrawIndexedIndirectCommand));
+
+    if(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_MULTIDRAW)
+    {
+      uint32_t numCopies = uint32_t(m_scene->m_copies.size());
+      // gl_DrawID restarts with every call, calls are split at the device limit
+      for(uint32_t i = 0; i < count; i += m_maxMultiDrawCount)
+      {
+        uint32_t num = std::min(count - i, m_maxMultiDrawCount);
+        cmdPushDrawIdOffset(cmd, first + i);
+        vkCmdDrawMultiIndexedEXT(cmd, num, &m_multiDraws[first + i], numCopies, 0, sizeof(VkMultiDrawIndexedInfoEXT), nullptr);
+      }
+    }
+    else
+    {
+      cmdPushDrawIdOffset(cmd, first);
+      vkCmdDrawIndexedIndirect(cmd, indirectBuffer, indirectOffset, count, sizeof(VkDrawIndexedIndirectCommand));
+    }
+  }
+
+  // gl_DrawID is relative to the batch starting at drawIdOffset
+  void cmdPushDrawIdOffset(VkCommandBuffer cmd, uint32_t drawIdOffset) const
+  {
+    if(isDrawIdIndexed())
+    {
+      vkCmdPushConstants(cmd, m_setup.pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &drawIdOffset);
+    }
+  }
+
+  void initCulling()
+  {
+    ResourcesVK* res    = m_resources;
+    VkDevice     device = res->m_device;
+
+    m_cull.shader = res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "occlusion_cull.comp.glsl");
+
+    m_cull.container.init(device);
+    m_cull.container.addBinding(CULL_SSBO_MATRIX, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_BBOX, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_DRAWINFO, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_INDIRECT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_DRAWN, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_STATS, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_TEX_HIZ, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.addBinding(CULL_SSBO_COPIES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_cull.container.initLayout();
+
+    VkPushConstantRange range = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushData)};
+    m_cull.container.initPipeLayout(1, &range);
+    m_cull.container.initPool(2 * NUM_SET_VERSIONS);
+
+    VkComputePipelineCreateInfo     pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    VkPipelineShaderStageCreateInfo stageInfo    = {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    stageInfo.stage                              = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.pName                              = "main";
+    stageInfo.module                             = res->m_shaderManager.get(m_cull.shader);
+
+    pipelineInfo.layout = m_cull.container.getPipeLayout();
+    pipelineInfo.stage  = stageInfo;
+    VkResult result     = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &m_cull.pipeline);
+    assert(result == VK_SUCCESS);
+
+    {
+      // quantized positions are within the unit cube, the matrices map it to the bbox
+      std::vector<CadScene::BBox> bboxes = m_scene->m_geometryBboxes;
+      if(m_scene->m_quantizedVertices)
+      {
+        for(CadScene::BBox& bbox : bboxes)
+        {
+          bbox.min = glm::vec4(0, 0, 0, 1);
+          bbox.max = glm::vec4(1, 1, 1, 1);
+        }
+      }
+
+      ScopeStaging staging(res->m_allocator, res->m_queue, res->m_queueFamily);
+      m_cull.bboxes = res->createBufferT(bboxes.data(), bboxes.size(),
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                         staging.getCmd());
+      m_cull.stats = res->createBuffer(sizeof(uint32_t) * CULL_STATS_NUM,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+      staging.submit();
+    }
+    m_cull.statsReadback.init(&res->m_allocator, sizeof(uint32_t) * CULL_STATS_NUM);
+
+    VkMemoryPropertyFlags mappedFlags = res->getMappedMemFlags();
+    m_cull.drawInfos.init(&res->m_allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mappedFlags);
+    m_cull.drawn.init(&res->m_allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mappedFlags);
+    m_cull.indirectLate.init(&res->m_allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mappedFlags);
+    m_cull.hizValid = false;
+  }
+
+  void deinitCulling()
+  {
+    ResourcesVK* res = m_resources;
+
+    m_cull.container.deinit();
+    vkDestroyPipeline(res->m_device, m_cull.pipeline, nullptr);
+    res->m_shaderManager.destroyShaderModule(m_cull.shader);
+
+    res->destroy(m_cull.bboxes);
+    m_cull.drawInfos.deinit();
+    m_cull.drawn.deinit();
+    m_cull.indirectLate.deinit();
+    res->destroy(m_cull.stats);
+    m_cull.statsReadback.deinit();
+  }
+
+  // a set per CULL_PASS within each version
+  uint32_t getCullSet(uint32_t pass) const { return m_draw.setVersion * 2 + pass; }
+
+  // the per-draw buffers and the hiz may be recreated
+  void updateCullDescriptors()
+  {
+    ResourcesVK* res = m_resources;
+
+    VkDescriptorImageInfo hizInfo = {res->m_hiz.sampler, res->m_hiz.viewAll, VK_IMAGE_LAYOUT_GENERAL};
+
+    std::vector<VkWriteDescriptorSet> updateDescriptors;
+    for(uint32_t pass = 0; pass < 2; pass++)
+    {
+      uint32_t         set      = getCullSet(pass);
+      const ResBuffer& indirect = (pass == CULL_PASS_EARLY ? m_indirectDrawBuffer : m_cull.indirectLate).getBuffer();
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_MATRIX, &res->m_scene.m_buffers.matrices.info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_BBOX, &m_cull.bboxes.info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_DRAWINFO, &m_cull.drawInfos.getBuffer().info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_INDIRECT, &indirect.info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_DRAWN, &m_cull.drawn.getBuffer().info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_STATS, &m_cull.stats.info));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_TEX_HIZ, &hizInfo));
+      updateDescriptors.push_back(m_cull.container.makeWrite(set, CULL_SSBO_COPIES, &res->m_scene.m_buffers.copies.info));
+    }
+    vkUpdateDescriptorSets(res->m_device, updateDescriptors.size(), updateDescriptors.data(), 0, 0);
+  }
+
+  void cmdCull(VkCommandBuffer cmd, uint32_t pass, const glm::mat4& viewProj, bool useHiZ) const
+  {
+    const ResourcesVK* res = m_resources;
+
+    nvvk::DebugUtil::ScopedCmdLabel dbgLabel(cmd, pass == CULL_PASS_EARLY ? "cullEarly" : "cullLate");
+
+    if(pass == CULL_PASS_EARLY)
+    {
+      VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+      memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+      vkCmdFillBuffer(cmd, m_cull.stats.buffer, 0, m_cull.stats.info.range, 0);
+    }
+
+    {
+      // previous drawcalls may still read the indirect commands
+      VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+      memBarrier.srcAccessMask   = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+      memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    CullPushData push;
+    push.viewProjMatrix = viewProj;
+    push.numDraws       = m_draw.drawCount;
+    push.pass           = pass;
+    push.useHiZ         = useHiZ ? 1 : 0;
+    push.hizLevels      = res->m_hiz.levels;
+    push.hizSize        = glm::vec2(res->m_hiz.width, res->m_hiz.height);
+    push.numCopies      = uint32_t(m_scene->m_copies.size());
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull.container.getPipeLayout(), 0, 1,
+                            m_cull.container.getSets(getCullSet(pass)), 0, nullptr);
+    vkCmdPushConstants(cmd, m_cull.container.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmd, (push.numDraws + CULL_WORKGROUPSIZE - 1) / CULL_WORKGROUPSIZE, 1, 1);
+
+    {
+      VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+      memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+      memBarrier.dstAccessMask   = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+    }
+  }
 
   void setupPipeline(bool needsBaseInstanceBuffer)
   {
@@ -570,11 +1365,35 @@ private:
     VkDevice     device = res->m_device;
 
     vkDestroyPipeline(device, m_setup.pipeline, nullptr);
+    vkDestroyPipeline(device, m_setup.pipelineCutout, nullptr);
+    vkDestroyPipeline(device, m_setup.pipelineCoverage, nullptr);
+    vkDestroyPipeline(device, m_setup.pipelineCoverageCutout, nullptr);
+    vkDestroyPipeline(device, m_setup.pipelineBBox, nullptr);
+    m_setup.pipelineCutout         = VK_NULL_HANDLE;
+    m_setup.pipelineCoverage       = VK_NULL_HANDLE;
+    m_setup.pipelineCoverageCutout = VK_NULL_HANDLE;
 
     {
       nvvk::GraphicsPipelineState     state = res->m_gfxState;
       nvvk::GraphicsPipelineGenerator gen(state);
 
+      if(m_config.vertexPulling || m_mode == MODE_PER_MESHLET_ID_MS)
+      {
+        // the vertex or mesh shader reads the vertices itself
+        state.clearAttributeDescriptions();
+        state.clearBindingDescriptions();
+      }
+      else if(m_scene->m_quantizedVertices)
+      {
+        // decoded by the vertex shader, see getVertexPosNormal()
+        state.clearAttributeDescriptions();
+        state.clearBindingDescriptions();
+        state.addAttributeDescription(nvvk::GraphicsPipelineState::makeVertexInputAttribute(
+            ATTRIB_VERTEX_POS_OCTNORMAL, BINDING_PER_VERTEX, VK_FORMAT_R32G32_UINT, 0));
+        state.addBindingDescription(nvvk::GraphicsPipelineState::makeVertexInputBinding(
+            BINDING_PER_VERTEX, sizeof(CadScene::VertexQuantized), VK_VERTEX_INPUT_RATE_VERTEX));
+      }
+
       if (needsBaseInstanceBuffer)
       {
           state.addAttributeDescription(nvvk::GraphicsPipelineState::makeVertexInputAttribute(ATTRIB_BASEINSTANCE, BINDING_PER_INSTANCE,
@@ -586,18 +1405,80 @@ private:
       gen.setRenderPass(res->m_framebuffer.passPreserve);
       gen.setDevice(device);
       // pipelines
-      gen.setLayout(m_setup.container.getPipeLayout());
+      gen.setLayout(m_setup.pipeLayout);
       state.depthStencilState.depthCompareOp      = VK_COMPARE_OP_LESS_OR_EQUAL;
       state.rasterizationState.cullMode           = VK_CULL_MODE_BACK_BIT;
       state.multisampleState.rasterizationSamples = res->m_framebuffer.samplesUsed;
 
-      gen.addShader(res->m_shaderManager.get(m_setup.vertexShader), VK_SHADER_STAGE_VERTEX_BIT);
+      addVertexStages(gen);
       gen.addShader(res->m_shaderManager.get(m_setup.fragmentShader), VK_SHADER_STAGE_FRAGMENT_BIT);
-      if(m_mode == RendererVK::MODE_PER_TRI_ID_GS || m_mode == RendererVK::MODE_PER_TRI_BATCH_PART_SEARCH_GS)
+      m_setup.pipeline = gen.createPipeline();
+
+      if(m_config.partOverrides)
       {
-        gen.addShader(res->m_shaderManager.get(m_setup.geometryShader), VK_SHADER_STAGE_GEOMETRY_BIT);
+        gen.clearShaders();
+        addVertexStages(gen);
+        gen.addShader(res->m_shaderManager.get(m_setup.fragmentShaderCutout), VK_SHADER_STAGE_FRAGMENT_BIT);
+        m_setup.pipelineCutout = gen.createPipeline();
+      }
+
+      // runs after the scene within the same subpass, only the closest fragments pass
+      state.depthStencilState.depthCompareOp   = VK_COMPARE_OP_EQUAL;
+      state.depthStencilState.depthWriteEnable = VK_FALSE;
+      state.setBlendAttachmentColorMask(0, 0);
+
+      if(m_config.partCoverage)
+      {
+        gen.clearShaders();
+        addVertexStages(gen);
+        gen.addShader(res->m_shaderManager.get(m_setup.fragmentShaderCoverage), VK_SHADER_STAGE_FRAGMENT_BIT);
+        m_setup.pipelineCoverage = gen.createPipeline();
+      }
+      if(m_config.partOverrides)
+      {
+        gen.clearShaders();
+        addVertexStages(gen);
+        gen.addShader(res->m_shaderManager.get(m_setup.fragmentShaderCoverageCutout), VK_SHADER_STAGE_FRAGMENT_BIT);
+        m_setup.pipelineCoverageCutout = gen.createPipeline();
       }
-      m_setup.pipeline = gen.createPipeline();
+    }
+    {
+      nvvk::GraphicsPipelineState     state = res->m_gfxState;
+      nvvk::GraphicsPipelineGenerator gen(state);
+
+      // edges from gl_VertexIndex, depth tested but not written
+      state.clearAttributeDescriptions();
+      state.clearBindingDescriptions();
+      state.inputAssemblyState.topology           = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+      state.rasterizationState.cullMode           = VK_CULL_MODE_NONE;
+      state.depthStencilState.depthCompareOp      = VK_COMPARE_OP_LESS_OR_EQUAL;
+      state.depthStencilState.depthWriteEnable    = VK_FALSE;
+      state.multisampleState.rasterizationSamples = res->m_framebuffer.samplesUsed;
+
+      gen.setRenderPass(res->m_framebuffer.passPreserve);
+      gen.setDevice(device);
+      gen.setLayout(m_setup.pipeLayoutBBox);
+      gen.addShader(res->m_shaderManager.get(m_setup.bboxVertexShader), VK_SHADER_STAGE_VERTEX_BIT);
+      gen.addShader(res->m_shaderManager.get(m_setup.bboxFragmentShader), VK_SHADER_STAGE_FRAGMENT_BIT);
+      m_setup.pipelineBBox = gen.createPipeline();
+    }
+  }
+
+  // all stages before the fragment shader
+  void addVertexStages(nvvk::GraphicsPipelineGenerator& gen) const
+  {
+    const ResourcesVK* res = m_resources;
+
+    if(m_mode == RendererVK::MODE_PER_MESHLET_ID_MS)
+    {
+      gen.addShader(res->m_shaderManager.get(m_setup.meshShader), VK_SHADER_STAGE_MESH_BIT_EXT);
+      return;
+    }
+
+    gen.addShader(res->m_shaderManager.get(m_setup.vertexShader), VK_SHADER_STAGE_VERTEX_BIT);
+    if(m_mode == RendererVK::MODE_PER_TRI_ID_GS || m_mode == RendererVK::MODE_PER_TRI_BATCH_PART_SEARCH_GS)
+    {
+      gen.addShader(res->m_shaderManager.get(m_setup.geometryShader), VK_SHADER_STAGE_GEOMETRY_BIT);
     }
   }
 };
@@ -609,6 +1490,8 @@ static RendererVK::TypePrimSearch       s_type_prim_search_vk;
 static RendererVK::TypeGlobalPrimSearch s_type_global_prim_search_vk;
 static RendererVK::TypePrimGS           s_type_prim_gs_vk;
 static RendererVK::TypePrimSearchGS     s_type_prim_search_gs_vk;
+static RendererVK::TypeMeshlet          s_type_meshlet_vk;
+static RendererVK::TypeVertexPart       s_type_vertex_part_vk;
 
 bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, const Config& config, Stats& stats)
 {
@@ -618,15 +1501,64 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
   m_scene                         = scene;
   m_config                        = config;
 
+  if(m_mode == MODE_PER_MESHLET_ID_MS && !isBoundPerDraw())
+  {
+    // the drawcalls are not indexed, mesh shaders have neither instances nor the MDI buffers
+    LOGW("per-meshlet part index renderer only supports per-draw push constants or uniform buffers, using push constants\n");
+    m_config.perDrawParameterMode = Renderer::PER_DRAW_PUSHCONSTANTS;
+  }
+  if(m_mode == MODE_PER_MESHLET_ID_MS && !scene->m_numMeshlets)
+  {
+    LOGW("scene has no meshlets, enable \"build meshlets\" to draw with the per-meshlet part index renderer\n");
+  }
+  if(m_mode == MODE_PER_MESHLET_ID_MS && m_config.lodPixels)
+  {
+    // only the full detail has meshlets, a level change would record the same draws again
+    LOGW("per-meshlet part index renderer has no levels of detail, ignoring lod pixels\n");
+    m_config.lodPixels = 0;
+  }
+  if(m_mode == MODE_PER_VERTEX_PART_ID_FS && !scene->m_vertexPartIdsSize)
+  {
+    // there is nothing to fetch per vertex, the per-triangle ids always exist
+    LOGW("scene has no vertex part ids, enable \"split part vertices\" to draw with the per-vertex part index renderer, using per-tri part index fs\n");
+    m_mode = MODE_PER_TRI_ID_FS;
+  }
+
+  if(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_MULTIDRAW)
+  {
+    VkPhysicalDeviceMultiDrawPropertiesEXT multiDrawProps = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_PROPERTIES_EXT};
+    VkPhysicalDeviceProperties2            props          = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    props.pNext                                           = &multiDrawProps;
+    vkGetPhysicalDeviceProperties2(res->m_physical, &props);
+    m_maxMultiDrawCount = std::max(multiDrawProps.maxMultiDrawCount, 1u);
+  }
+
+  if(m_mode == MODE_PER_MESHLET_ID_MS)
+  {
+    VkPhysicalDeviceMeshShaderPropertiesEXT meshProps = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT};
+    VkPhysicalDeviceProperties2             props     = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    props.pNext                                       = &meshProps;
+    vkGetPhysicalDeviceProperties2(res->m_physical, &props);
+    // the copies multiply the workgroups of every call
+    uint32_t numCopies = uint32_t(scene->m_copies.size());
+    m_maxMeshTasks     = std::min(meshProps.maxMeshWorkGroupCount[0], meshProps.maxMeshWorkGroupTotalCount / numCopies);
+    m_maxMeshTasks     = std::max(m_maxMeshTasks, 1u);
+  }
+
   {
     std::string prepend;
     prepend += nvh::stringFormat("#define IGNORE_MATERIALS %d\n", config.ignoreMaterials ? 1 : 0);
     prepend += nvh::stringFormat("#define COLORIZE_DRAWS %d\n", config.colorizeDraws ? 1 : 0);
+    prepend += nvh::stringFormat("#define USE_PART_OVERRIDES %d\n", config.partOverrides ? 1 : 0);
+    prepend += nvh::stringFormat("#define USE_PART_COVERAGE %d\n", config.partCoverage ? 1 : 0);
+    prepend += nvh::stringFormat("#define USE_INSTANCED_COPIES %d\n", scene->m_copies.size() > 1 ? 1 : 0);
+    prepend += nvh::stringFormat("#define USE_VERTEX_PULLING %d\n", config.vertexPulling ? 1 : 0);
+    prepend += nvh::stringFormat("#define USE_QUANTIZED_VERTICES %d\n", scene->m_quantizedVertices ? 1 : 0);
     prepend += nvh::stringFormat("#define GLOBAL_GUESS %d\n", config.globalSearchGuess ? 1 : 0);
     prepend += nvh::stringFormat("#define GLOBAL_NARY_N %d\n", config.globalNaryN);
     prepend += nvh::stringFormat("#define GLOBAL_NARY_MIN %d\n", config.globalNaryMin);
     prepend += nvh::stringFormat("#define GLOBAL_NARY_ITERATIONS_MAX %d\n", config.globalNaryMaxIter);
-    switch(config.perDrawParameterMode)
+    switch(m_config.perDrawParameterMode)
     {
       case Renderer::PER_DRAW_PUSHCONSTANTS:
         prepend += nvh::stringFormat("#define USE_PUSHCONSTANTS\n");
@@ -637,6 +1569,15 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
       case Renderer::PER_DRAW_INDEX_BASEINSTANCE:
         // nothing to do
         break;
+      case Renderer::PER_DRAW_INDEX_DRAWID:
+      case Renderer::PER_DRAW_INDEX_MULTIDRAW:
+        prepend += nvh::stringFormat("#define USE_DRAWID_INDEX\n");
+        break;
+      case Renderer::PER_DRAW_UBO_DYNAMIC:
+        // same shader logic as push constants, but sourced from a uniform buffer
+        prepend += nvh::stringFormat("#define USE_PUSHCONSTANTS\n");
+        prepend += nvh::stringFormat("#define UNIFORMS_TECHNIQUE UNIFORMS_MULTISETSDYNAMIC\n");
+        break;
     }
 
     // init shaders
@@ -655,6 +1596,28 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
                                      m_mode == MODE_PER_TRI_BATCH_PART_SEARCH_FS ? config.searchBatch : 0);
         prepend += nvh::stringFormat("#define MODE_PER_TRI_GLOBAL_PART_SEARCH_FS %d\n",
                                      m_mode == MODE_PER_TRI_GLOBAL_PART_SEARCH_FS ? 1 : 0);
+        prepend += nvh::stringFormat("#define MODE_PER_MESHLET_ID_MS 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_VERTEX_PART_ID_FS 0\n");
+        m_setup.fragmentShader =
+            res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT, "drawid_primid.frag.glsl", prepend);
+        m_setup.vertexShader =
+            res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_VERTEX_BIT, "drawid_primid.vert.glsl", prepend);
+        break;
+      case RendererVK::MODE_PER_MESHLET_ID_MS:
+        prepend += nvh::stringFormat("#define SEARCH_COUNT 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_TRI_GLOBAL_PART_SEARCH_FS 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_MESHLET_ID_MS 1\n");
+        prepend += nvh::stringFormat("#define MODE_PER_VERTEX_PART_ID_FS 0\n");
+        m_setup.fragmentShader =
+            res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT, "drawid_primid.frag.glsl", prepend);
+        m_setup.meshShader =
+            res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_MESH_BIT_EXT, "drawid_meshlet.mesh.glsl", prepend);
+        break;
+      case RendererVK::MODE_PER_VERTEX_PART_ID_FS:
+        prepend += nvh::stringFormat("#define SEARCH_COUNT 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_TRI_GLOBAL_PART_SEARCH_FS 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_MESHLET_ID_MS 0\n");
+        prepend += nvh::stringFormat("#define MODE_PER_VERTEX_PART_ID_FS 1\n");
         m_setup.fragmentShader =
             res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT, "drawid_primid.frag.glsl", prepend);
         m_setup.vertexShader =
@@ -676,6 +1639,34 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
         break;
     }
 
+    {
+      // same fragment shader, with cutouts or only counting pixels per part and picking
+      const char* fragmentFile = "drawid_primid.frag.glsl";
+      if(m_mode == RendererVK::MODE_PER_DRAW_BASEINST)
+      {
+        fragmentFile = "drawid_instanceid.frag.glsl";
+      }
+      else if(m_mode == RendererVK::MODE_PER_TRI_ID_GS || m_mode == RendererVK::MODE_PER_TRI_BATCH_PART_SEARCH_GS)
+      {
+        fragmentFile = "drawid_primid_gs.frag.glsl";
+      }
+      if(config.partOverrides)
+      {
+        m_setup.fragmentShaderCutout = res->m_shaderManager.createShaderModule(
+            VK_SHADER_STAGE_FRAGMENT_BIT, fragmentFile, prepend + "#define USE_PART_CUTOUTS 1\n");
+        m_setup.fragmentShaderCoverageCutout = res->m_shaderManager.createShaderModule(
+            VK_SHADER_STAGE_FRAGMENT_BIT, fragmentFile, prepend + "#define USE_PART_CUTOUTS 1\n#define PART_COVERAGE_PASS 1\n");
+      }
+      if(config.partCoverage)
+      {
+        m_setup.fragmentShaderCoverage = res->m_shaderManager.createShaderModule(
+            VK_SHADER_STAGE_FRAGMENT_BIT, fragmentFile, prepend + "#define PART_COVERAGE_PASS 1\n");
+      }
+    }
+
+    m_setup.bboxVertexShader   = res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_VERTEX_BIT, "bbox.vert.glsl", prepend);
+    m_setup.bboxFragmentShader = res->m_shaderManager.createShaderModule(VK_SHADER_STAGE_FRAGMENT_BIT, "bbox.frag.glsl", prepend);
+
     if(!res->m_shaderManager.areShaderModulesValid())
     {
       return false;
@@ -683,13 +1674,20 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
 
     // init container
     m_setup.container.init(device);
+    // the bbox vertex shader also reads the scene, matrices and copies, see cmdBBoxes
     m_setup.container.addBinding(DRAW_UBO_SCENE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
-                                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT);
-    m_setup.container.addBinding(DRAW_SSBO_MATRIX, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
+                                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT | getVertexStage());
+    m_setup.container.addBinding(DRAW_SSBO_MATRIX, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | getVertexStage());
     m_setup.container.addBinding(DRAW_SSBO_MATERIAL, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
     m_setup.container.addBinding(DRAW_SSBO_RAY, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
     m_setup.container.addBinding(DRAW_SSBO_PER_DRAW, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
-                                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_VERTEX_BIT);
+                                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_GEOMETRY_BIT | getVertexStage());
+    m_setup.container.addBinding(DRAW_SSBO_SELECTION, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_setup.container.addBinding(DRAW_SSBO_SELECTION_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_setup.container.addBinding(DRAW_SSBO_SELECTION_MASK, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_setup.container.addBinding(DRAW_SSBO_PART_OVERRIDE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_setup.container.addBinding(DRAW_SSBO_PART_COVERAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_setup.container.addBinding(DRAW_SSBO_COPIES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | getVertexStage());
     m_setup.container.initLayout();
 
     VkPushConstantRange ranges[3];
@@ -703,28 +1701,96 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
   }
 
 
-    if(config.perDrawParameterMode == Renderer::PER_DRAW_PUSHCONSTANTS)
+    if(m_config.perDrawParameterMode == Renderer::PER_DRAW_PUSHCONSTANTS)
     {
-      ranges[0] = makePushConstantRange(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_GEOMETRY_BIT,
+      // extended to the last address the shaders of this mode declare
+      ranges[0] = makePushConstantRange(getVertexStage() | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_GEOMETRY_BIT,
                                         DrawPushData, matrixIndex, idsAddr);
+      ranges[0].size = getDrawDataSize();
+      rangeCount     = 1;
+    }
+    else if(isDrawIdIndexed())
+    {
+      // index of the first drawcall within each MDI batch
+      ranges[0]  = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t)};
       rangeCount = 1;
     }
 
-    m_setup.container.initPipeLayout(rangeCount, ranges);
-    m_setup.container.initPool(1);
+    if(m_config.perDrawParameterMode == Renderer::PER_DRAW_UBO_DYNAMIC)
+    {
+      m_setup.containerPerDraw.init(device);
+      m_setup.containerPerDraw.addBinding(DRAW_UBO_PER_DRAW, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
+                                          VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_GEOMETRY_BIT | getVertexStage());
+      m_setup.containerPerDraw.initLayout();
+      m_setup.containerPerDraw.initPool(NUM_SET_VERSIONS);
+
+      VkDescriptorSetLayout setLayouts[2] = {m_setup.container.getLayout(), m_setup.containerPerDraw.getLayout()};
+
+      VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+      layoutInfo.setLayoutCount             = 2;
+      layoutInfo.pSetLayouts                = setLayouts;
+      VkResult result                       = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &m_setup.pipeLayout);
+      assert(result == VK_SUCCESS);
+    }
+    else
+    {
+      m_setup.container.initPipeLayout(rangeCount, ranges);
+      m_setup.pipeLayout = m_setup.container.getPipeLayout();
+    }
+    m_setup.container.initPool(NUM_SET_VERSIONS);
+
+    {
+      VkDescriptorSetLayout setLayout = m_setup.container.getLayout();
+      VkPushConstantRange   range     = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(BBoxPushData)};
+
+      VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+      layoutInfo.setLayoutCount             = 1;
+      layoutInfo.pSetLayouts                = &setLayout;
+      layoutInfo.pushConstantRangeCount     = 1;
+      layoutInfo.pPushConstantRanges        = &range;
+      VkResult result                       = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &m_setup.pipeLayoutBBox);
+      assert(result == VK_SUCCESS);
+    }
 
     {
       std::vector<VkWriteDescriptorSet> updateDescriptors;
 
-      updateDescriptors.push_back(m_setup.container.makeWrite(0, DRAW_UBO_SCENE, &res->m_common.view.info));
-      updateDescriptors.push_back(m_setup.container.makeWrite(0, DRAW_SSBO_MATRIX, &res->m_scene.m_buffers.matrices.info));
-      updateDescriptors.push_back(m_setup.container.makeWrite(0, DRAW_SSBO_MATERIAL, &res->m_scene.m_buffers.materials.info));
-      updateDescriptors.push_back(m_setup.container.makeWrite(0, DRAW_SSBO_RAY, &res->m_common.ray.info));
+      // static bindings, the same in all versions
+      for(uint32_t v = 0; v < NUM_SET_VERSIONS; v++)
+      {
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_UBO_SCENE, &res->m_common.view.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_MATRIX, &res->m_scene.m_buffers.matrices.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_MATERIAL, &res->m_scene.m_buffers.materials.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_RAY, &res->m_common.ray.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_SELECTION, &res->m_selection.bits.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_SELECTION_SET, &res->m_selection.set.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_SELECTION_MASK, &res->m_selection.mask.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_PART_OVERRIDE, &res->m_partOverrides.buffer.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_PART_COVERAGE, &res->m_coverage.counters.info));
+        updateDescriptors.push_back(m_setup.container.makeWrite(v, DRAW_SSBO_COPIES, &res->m_scene.m_buffers.copies.info));
+      }
 
       vkUpdateDescriptorSets(device, updateDescriptors.size(), updateDescriptors.data(), 0, 0);
     }
 
     setupPipeline(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_ATTRIBUTE);
+
+    // rewritten by the host whenever the command buffer is re-recorded
+    VkMemoryPropertyFlags mappedFlags = res->getMappedMemFlags();
+    m_perDrawDataBuffer.init(&res->m_allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mappedFlags);
+    m_indirectDrawBuffer.init(&res->m_allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mappedFlags);
+    m_perDrawUbo.buffer.init(&res->m_allocator, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, mappedFlags);
+
+    // culling writes the indirect buffer, only available with the MDI modes
+    m_cull.enabled = config.occlusionCull && !isBoundPerDraw() && m_config.perDrawParameterMode != Renderer::PER_DRAW_INDEX_MULTIDRAW;
+    if(m_cull.enabled)
+    {
+      initCulling();
+      if(!res->m_shaderManager.areShaderModulesValid())
+      {
+        return false;
+      }
+    }
   }
   {
     VkResult                result;
@@ -742,13 +1808,18 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
         break;
       case RendererVK::MODE_PER_TRI_ID_GS:
       case RendererVK::MODE_PER_TRI_ID_FS:
-      case RendererVK::MODE_PER_TRI_GLOBAL_PART_SEARCH_FS:
+      case RendererVK::MODE_PER_MESHLET_ID_MS:
+      case RendererVK::MODE_PER_VERTEX_PART_ID_FS:
         maxCombine = ~0;
         break;
       case RendererVK::MODE_PER_TRI_BATCH_PART_SEARCH_GS:
       case RendererVK::MODE_PER_TRI_BATCH_PART_SEARCH_FS:
         maxCombine = config.searchBatch;
         break;
+      case RendererVK::MODE_PER_TRI_GLOBAL_PART_SEARCH_FS:
+        // the part count of a draw is encoded in 16 bits
+        maxCombine = CadScene::MAX_SEARCH_PARTS;
+        break;
       default:
         maxCombine = 0;
         break;
@@ -761,11 +1832,13 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
       ScopeStaging staging(res->m_allocator, res->m_queue, res->m_queueFamily);
 
       // This buffer will be essentially indexed by gl_BaseInstance and thus returns
-      // gl_BaseInstance to the shader without accessing gl_BaseInstance explicitly
-      std::vector<uint32_t> perDrawIndices(m_drawItems.size());
+      // gl_BaseInstance to the shader without accessing gl_BaseInstance explicitly.
+      // Instanced copies advance the attribute, so every drawcall gets an entry per copy.
+      size_t                numCopies = m_scene->m_copies.size();
+      std::vector<uint32_t> perDrawIndices(m_drawItems.size() * numCopies);
       for(size_t x = 0; x < perDrawIndices.size(); ++x)
       {
-        perDrawIndices[x] = x;
+        perDrawIndices[x] = uint32_t(x / numCopies);
       }
       
       m_perDrawIndexBuffer = m_resources->createBufferT(perDrawIndices.data(), perDrawIndices.size(),
@@ -776,12 +1849,12 @@ bool RendererVK::init(const CadScene* NV_RESTRICT scene, Resources* resources, c
 
 
     setupCmdBuffer(m_drawItems.data(), m_drawItems.size());
-
-
+    stats.recordTimeMs = m_recordTimeMs;
   }
 
-  m_draw.fboChangeID  = res->m_fboChangeID;
-  m_draw.pipeChangeID = res->m_pipeChangeID;
+  m_draw.fboChangeID      = res->m_fboChangeID;
+  m_draw.pipeChangeID     = res->m_pipeChangeID;
+  m_draw.geometryChangeID = res->m_geometryChangeID;
 
   return true;
 }
@@ -791,30 +1864,98 @@ void RendererVK::deinit()
   deleteCmdBuffer();
   vkDestroyCommandPool(m_resources->m_device, m_cmdPool, nullptr);
 
+  if(m_config.perDrawParameterMode == Renderer::PER_DRAW_UBO_DYNAMIC)
+  {
+    // otherwise owned by m_setup.container
+    vkDestroyPipelineLayout(m_resources->m_device, m_setup.pipeLayout, nullptr);
+    m_setup.containerPerDraw.deinit();
+  }
+  vkDestroyPipelineLayout(m_resources->m_device, m_setup.pipeLayoutBBox, nullptr);
   m_setup.container.deinit();
   vkDestroyPipeline(m_resources->m_device, m_setup.pipeline, nullptr);
+  vkDestroyPipeline(m_resources->m_device, m_setup.pipelineCutout, nullptr);
+  vkDestroyPipeline(m_resources->m_device, m_setup.pipelineCoverage, nullptr);
+  vkDestroyPipeline(m_resources->m_device, m_setup.pipelineCoverageCutout, nullptr);
+  vkDestroyPipeline(m_resources->m_device, m_setup.pipelineBBox, nullptr);
 
   m_resources->m_shaderManager.destroyShaderModule(m_setup.geometryShader);
   m_resources->m_shaderManager.destroyShaderModule(m_setup.fragmentShader);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.fragmentShaderCutout);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.fragmentShaderCoverage);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.fragmentShaderCoverageCutout);
   m_resources->m_shaderManager.destroyShaderModule(m_setup.vertexShader);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.meshShader);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.bboxVertexShader);
+  m_resources->m_shaderManager.destroyShaderModule(m_setup.bboxFragmentShader);
 
-  m_resources->destroy(m_perDrawDataBuffer);
-  m_resources->destroy(m_indirectDrawBuffer);
+  m_perDrawDataBuffer.deinit();
+  m_indirectDrawBuffer.deinit();
   m_resources->destroy(m_perDrawIndexBuffer);
+  m_perDrawUbo.buffer.deinit();
+
+  if(m_cull.enabled)
+  {
+    deinitCulling();
+  }
 }
 
 void RendererVK::draw(const Resources::Global& global, Stats& stats)
 {
   ResourcesVK* NV_RESTRICT res = m_resources;
 
+  bool residencyChanged = false;
+  if(res->m_scene.m_residency.budget)
+  {
+    // only what is in view is kept resident, the rest is evicted once its space is needed
+    getVisibleGeometries(m_visibleGeometries, m_drawItems, m_scene, global.sceneUbo.viewProjMatrix,
+                         glm::vec3(global.sceneUbo.viewPos));
+    residencyChanged = res->m_scene.requestGeometries(m_visibleGeometries);
+  }
+
+  // hidden draws are left out, and the cutout pipelines are only used while needed
+  bool overridesChanged = m_config.partOverrides
+                          && (m_draw.hiddenChangeID != res->m_partOverrides.hiddenChangeID
+                              || m_draw.cutouts != (res->m_partOverrides.numCutouts != 0));
+
   if(m_draw.pipeChangeID != res->m_pipeChangeID || m_draw.fboChangeID != res->m_fboChangeID)
   {
     setupPipeline(m_config.perDrawParameterMode == Renderer::PER_DRAW_INDEX_ATTRIBUTE);
     deleteCmdBuffer();
     setupCmdBuffer(m_drawItems.data(), m_drawItems.size());
+    stats.recordTimeMs = m_recordTimeMs;
+
+    m_draw.fboChangeID      = res->m_fboChangeID;
+    m_draw.pipeChangeID     = res->m_pipeChangeID;
+    m_draw.geometryChangeID = res->m_geometryChangeID;
+
+    // hiz got recreated
+    m_cull.hizValid = false;
+  }
+  else if(m_draw.geometryChangeID != res->m_geometryChangeID || residencyChanged || overridesChanged
+          || (m_config.lodPixels
+              && updateLods(m_drawItems, m_scene, m_config, global.sceneUbo.viewProjMatrix,
+                            glm::vec3(global.sceneUbo.viewPos), global.winWidth, global.winHeight, stats)))
+  {
+    // more geometries finished uploading, the resident ones changed, parts were hidden or shown,
+    // or the levels of detail changed. The previous command buffers and descriptor sets may
+    // still be in use by frames in flight, they are retired rather than waited for.
+    retireCmdBuffer();
+    setupCmdBuffer(m_drawItems.data(), m_drawItems.size());
+    stats.recordTimeMs = m_recordTimeMs;
+
+    m_draw.geometryChangeID = res->m_geometryChangeID;
+  }
 
-    m_draw.fboChangeID  = res->m_fboChangeID;
-    m_draw.pipeChangeID = res->m_pipeChangeID;
+  if(m_cull.enabled)
+  {
+    uint32_t        statsFrame;
+    const uint32_t* cullStats = (const uint32_t*)m_cull.statsReadback.acquire(res->m_ringFences.getCycleIndex(), statsFrame);
+    if(cullStats)
+    {
+      stats.cullEarly  = cullStats[CULL_STAT_EARLY];
+      stats.cullLate   = cullStats[CULL_STAT_LATE];
+      stats.cullCulled = cullStats[CULL_STAT_CULLED];
+    }
   }
 
 
@@ -827,7 +1968,26 @@ void RendererVK::draw(const Resources::Global& global, Stats& stats)
       vkCmdUpdateBuffer(primary, res->m_common.view.buffer, 0, sizeof(SceneData), (const uint32_t*)&global.sceneUbo);
       // reset the buffer used for picking so that atomicMin would give us the lowest value
       vkCmdFillBuffer(primary, res->m_common.ray.buffer, 0, sizeof(RayData), ~0);
-      
+      // prepare region selection if requested this frame
+      res->cmdSelectionBegin(primary, global);
+      // upload modified part overrides
+      res->cmdPartOverridesUpdate(primary);
+      if(m_config.partCoverage)
+      {
+        res->cmdCoverageBegin(primary);
+      }
+      if(m_cull.enabled)
+      {
+        // what was visible last frame is likely visible again
+        cmdCull(primary, CULL_PASS_EARLY, m_cull.hizValid ? m_cull.viewProjPrev : global.sceneUbo.viewProjMatrix, m_cull.hizValid);
+      }
+      if(!m_expandGeometries.empty())
+      {
+        // triangle part ids of newly drawn geometries, once per upload
+        res->cmdExpandTrianglePartIds(primary, m_expandGeometries);
+        m_expandGeometries.clear();
+      }
+
       res->cmdPipelineBarrier(primary);
 
       // render scene
@@ -835,6 +1995,31 @@ void RendererVK::draw(const Resources::Global& global, Stats& stats)
       vkCmdExecuteCommands(primary, 1, &m_draw.cmdBuffer);
       vkCmdEndRenderPass(primary);
 
+      if(m_cull.enabled)
+      {
+        // test everything the early pass culled against the new depth,
+        // catching what became visible this frame
+        res->cmdBuildHiZ(primary);
+        cmdCull(primary, CULL_PASS_LATE, global.sceneUbo.viewProjMatrix, true);
+
+        VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        memBarrier.srcAccessMask   = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        memBarrier.dstAccessMask   = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        vkCmdPipelineBarrier(primary, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+        res->cmdBeginRenderPass(primary, false, true);
+        vkCmdExecuteCommands(primary, 1, &m_draw.cmdBufferLate);
+        vkCmdEndRenderPass(primary);
+
+        // final depth for next frame's early pass
+        res->cmdBuildHiZ(primary);
+        m_cull.statsReadback.cmdCopy(primary, res->m_ringFences.getCycleIndex(), res->m_frame, m_cull.stats.buffer, 0);
+
+        m_cull.viewProjPrev = global.sceneUbo.viewProjMatrix;
+        m_cull.hizValid     = true;
+      }
+
       // copy the mouse-picking hit result from this frame
       // into the main ubo, so that we can use the result
       // for the next frame
@@ -850,6 +2035,12 @@ void RendererVK::draw(const Resources::Global& global, Stats& stats)
       cpy.srcOffset = 0;
       cpy.size      = sizeof(RayData);
       vkCmdCopyBuffer(primary, res->m_common.ray.buffer, res->m_common.view.buffer, 1, &cpy);
+
+      res->cmdSelectionEnd(primary, global);
+      if(m_config.partCoverage)
+      {
+        res->cmdCoverageEnd(primary);
+      }
     }
   }
   vkEndCommandBuffer(primary);
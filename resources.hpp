@@ -45,6 +45,23 @@ inline size_t alignedSize(size_t sz, size_t align)
 class Resources
 {
 public:
+  struct PartCoverage
+  {
+    uint32_t partIndex;  // unique part index
+    uint32_t pixels;     // visible fragments
+  };
+
+  struct ResidencyStats
+  {
+    size_t   budget;        // in bytes, 0 if all geometry is resident
+    size_t   residentSize;  // in bytes
+    uint32_t numResident;
+    uint32_t hits;       // of the last geometry request
+    uint32_t misses;     // of the last geometry request
+    uint32_t uploads;    // of the last geometry request
+    uint32_t evictions;  // since initScene
+  };
+
   struct Global
   {
     SceneData     sceneUbo;
@@ -54,6 +71,11 @@ public:
     int           workingSet;
     bool          workerBatched;
     ImDrawData*   imguiDrawData;
+
+    // region selection, only used when sceneUbo.selectMode != SELECTION_MODE_NONE
+    const uint32_t* selectionMask;      // lasso mask bits for SELECTION_MODE_LASSO
+    size_t          selectionMaskSize;  // in bytes
+    bool            selectionAdditive;  // add to the previous selection instead of replacing it
   };
 
   uint32_t m_numMatrices;
@@ -80,6 +102,35 @@ public:
   virtual void animation(const Global& global) {}
   virtual void animationReset() {}
 
+  // returns true if the result of a region selection became available,
+  // latency is the number of frames it took since the selection was performed
+  virtual bool getSelection(std::vector<uint32_t>& partIndices, uint32_t& latency) { return false; }
+
+  // per-part overrides indexed by unique part index, only used by renderers
+  // with Renderer::Config::partOverrides. Changes are uploaded with the next frame.
+  virtual void setPartOverride(uint32_t partIndex, const PartOverride& value) {}
+  virtual void resetPartOverrides() {}
+
+  // returns true if a new per-part coverage result became available, only
+  // produced by renderers with Renderer::Config::partCoverage.
+  // topParts holds up to topN parts with the most visible pixels in descending order,
+  // numVisible is the number of parts with any visible pixel and latency the number
+  // of frames since the result was rendered.
+  virtual bool getPartCoverage(uint32_t topN, std::vector<PartCoverage>& topParts, uint32_t& numVisible, uint32_t& latency)
+  {
+    return false;
+  }
+
+  // limits the device memory for scene geometry, takes effect with the next initScene.
+  // 0 keeps all geometry resident, otherwise geometries are streamed in on demand
+  // and the least recently drawn ones are evicted.
+  virtual void setGeometryBudget(size_t bytes) {}
+  virtual bool getResidencyStats(ResidencyStats& stats) { return false; }
+
+  // true while the device scene still reads the CadScene's geometry data, i.e. during the
+  // asynchronous upload, or for good when geometries are streamed in within a budget
+  virtual bool needsHostGeometry() { return true; }
+
   virtual void beginFrame() {}
   virtual void blitFrame(const Global& global) {}
   virtual void endFrame() {}
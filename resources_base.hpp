@@ -53,6 +53,26 @@ inline ResBuffer createResBuffer(nvvk::ResourceAllocator& resAllocator,
   return entry;
 }
 
+inline ResBuffer createResBuffer(nvvk::ResourceAllocator& resAllocator,
+                                 const VkBufferCreateInfo& createInfo,
+                                 VkMemoryPropertyFlags     memFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+{
+  ResBuffer entry = {nullptr};
+
+  if(createInfo.size)
+  {
+    VkBufferCreateInfo info = createInfo;
+    info.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    ((nvvk::Buffer&)entry) = resAllocator.createBuffer(info, memFlags);
+    entry.info.buffer      = entry.buffer;
+    entry.info.offset      = 0;
+    entry.info.range       = info.size;
+    entry.addr             = nvvk::getBufferDeviceAddress(resAllocator.getDevice(), entry.buffer);
+  }
+
+  return entry;
+}
+
 
 template <typename T>
 inline ResBuffer createResBufferT(nvvk::ResourceAllocator& resAllocator, const T* obj, size_t count, VkBufferUsageFlags flags, VkCommandBuffer cmd = VK_NULL_HANDLE)
@@ -60,6 +60,97 @@ void ResourcesVK::beginFrame()
   m_submissionWaitForRead = true;
   m_ringFences.setCycleAndWait(m_frame);
   m_ringCmdPool.setCycle(m_ringFences.getCycleIndex());
+
+  {
+    // the cycle's fence was waited on, so a readback issued within it is complete
+    uint32_t        selectionFrame;
+    const uint32_t* bits = (const uint32_t*)m_selection.readback.acquire(m_ringFences.getCycleIndex(), selectionFrame);
+    if(bits)
+    {
+      m_selection.result.clear();
+      for(uint32_t w = 0; w < m_selection.numWords; w++)
+      {
+        uint32_t word = bits[w];
+        for(uint32_t b = 0; word && b < 32; b++)
+        {
+          if(word & (1u << b))
+          {
+            m_selection.result.push_back(w * 32 + b);
+            word &= ~(1u << b);
+          }
+        }
+      }
+      m_selection.resultLatency = m_frame - selectionFrame;
+      m_selection.resultNew     = true;
+    }
+
+    uint32_t        coverageFrame;
+    const uint32_t* counters = (const uint32_t*)m_coverage.readback.acquire(m_ringFences.getCycleIndex(), coverageFrame);
+    if(counters)
+    {
+      // must copy, the buffer is written again within this cycle
+      m_coverage.result.assign(counters, counters + m_coverage.numParts);
+      m_coverage.resultLatency = m_frame - coverageFrame;
+      m_coverage.resultNew     = true;
+    }
+  }
+
+  uint64_t uploadsCompleted;
+  if(m_scene.updateUploads(uploadsCompleted))
+  {
+    // the transfer queue's copies are complete, make them visible to the draws of this frame.
+    // Submitted first, the barrier precedes the frame's other command buffers in submission order.
+    VkCommandBuffer cmd = createTempCmdBuffer();
+
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(cmd);
+
+    // polling the timeline on the host is no dependency on the device, so the barrier's
+    // submission waits for the transfer queue's copies itself and chains them to the draws
+    VkSemaphore                   timeline     = m_scene.getUploadTimeline();
+    VkPipelineStageFlags          waitStage    = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount       = 1;
+    timelineInfo.pWaitSemaphoreValues          = &uploadsCompleted;
+
+    VkSubmitInfo submitInfo       = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext              = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores    = &timeline;
+    submitInfo.pWaitDstStageMask  = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &cmd;
+    VkResult result               = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+    assert(result == VK_SUCCESS);
+
+    if(m_scene.isUploadComplete())
+    {
+      // the timeline must outlive the wait above, once per scene
+      vkQueueWaitIdle(m_queue);
+      m_scene.finishUploads();
+    }
+
+    m_geometryChangeID++;
+  }
+
+  if(m_scene.m_geometryMem.isCompactPending())
+  {
+    // evictions left holes in the geometry memory, close them a few megabytes per frame
+    VkCommandBuffer cmd = createTempCmdBuffer();
+    if(m_scene.compactGeometry(cmd, 16 * 1024 * 1024))
+    {
+      m_geometryChangeID++;
+    }
+    vkEndCommandBuffer(cmd);
+    submissionEnqueue(cmd);
+    // the moved-from ranges are free again, the copies must precede any upload into them
+    submissionExecute();
+  }
 }
 
 void ResourcesVK::endFrame()
@@ -247,8 +338,9 @@ void ResourcesVK::blitFrame(const Global& global)
 
 bool ResourcesVK::init(nvvk::Context* context, nvvk::SwapChain* swapChain, nvh::Profiler* profiler)
 {
-  m_fboChangeID  = 0;
-  m_pipeChangeID = 0;
+  m_fboChangeID      = 0;
+  m_pipeChangeID     = 0;
+  m_geometryChangeID = 0;
 
   m_context   = context;
   m_swapChain = swapChain;
@@ -287,6 +379,8 @@ bool ResourcesVK::init(nvvk::Context* context, nvvk::SwapChain* swapChain, nvh::
     m_common.view                 = createResBuffer(m_allocator, sizeof(SceneData) + sizeof(RayData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     m_common.anim                 = createResBuffer(m_allocator, sizeof(AnimationData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     m_common.ray                  = createResBuffer(m_allocator, sizeof(RayData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    m_selection.mask = createResBuffer(m_allocator, SELECTION_MASK_MAX_BYTES,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
   }
 
   // animation
@@ -295,11 +389,46 @@ bool ResourcesVK::init(nvvk::Context* context, nvvk::SwapChain* swapChain, nvh::
     m_animScene.addBinding(ANIM_UBO, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
     m_animScene.addBinding(ANIM_SSBO_MATRIXOUT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
     m_animScene.addBinding(ANIM_SSBO_MATRIXORIG, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+    m_animScene.addBinding(ANIM_SSBO_DEQUANT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
     m_animScene.initLayout();
     m_animScene.initPipeLayout();
     m_animScene.initPool(1);
   }
 
+  // hiz
+  {
+    m_hiz.container.init(m_device);
+    m_hiz.container.addBinding(HIZ_TEX_DEPTH, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+    m_hiz.container.addBinding(HIZ_IMG_SRC, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+    m_hiz.container.addBinding(HIZ_IMG_DST, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+    m_hiz.container.initLayout();
+
+    VkPushConstantRange range = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZPushData)};
+    m_hiz.container.initPipeLayout(1, &range);
+    m_hiz.container.initPool(HIZ_MAX_LEVELS);
+
+    VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter           = VK_FILTER_NEAREST;
+    samplerInfo.minFilter           = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode          = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod              = VK_LOD_CLAMP_NONE;
+    VkResult result                 = vkCreateSampler(m_device, &samplerInfo, nullptr, &m_hiz.sampler);
+    assert(result == VK_SUCCESS);
+  }
+
+  // triangle part id expansion
+  {
+    VkPushConstantRange        range      = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ExpandIdsPushData)};
+    VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutInfo.pushConstantRangeCount     = 1;
+    layoutInfo.pPushConstantRanges        = &range;
+    VkResult result = vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_expandIds.pipeLayout);
+    assert(result == VK_SUCCESS);
+  }
+
   return true;
 }
 
@@ -311,6 +440,7 @@ void ResourcesVK::deinit()
     destroy(m_common.view);
     destroy(m_common.anim);
     destroy(m_common.ray);
+    destroy(m_selection.mask);
   }
 
   m_ringFences.deinit();
@@ -325,6 +455,10 @@ void ResourcesVK::deinit()
   vkDestroyRenderPass(m_device, m_framebuffer.passPreserve, NULL);
 
   m_animScene.deinit();
+  m_hiz.container.deinit();
+  vkDestroySampler(m_device, m_hiz.sampler, nullptr);
+  vkDestroyPipelineLayout(m_device, m_expandIds.pipeLayout, nullptr);
+  m_expandIds.pipeLayout = VK_NULL_HANDLE;
 
   m_profilerVK.deinit();
   m_memAllocator.deinit();
@@ -346,6 +480,10 @@ bool ResourcesVK::initPrograms(const std::string& path, const std::string& prepe
 
   ///////////////////////////////////////////////////////////////////////////////////////////
   m_animShading.shaderModuleID = m_shaderManager.createShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "animation.comp.glsl");
+  m_hiz.shaderModuleID = m_shaderManager.createShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "hiz.comp.glsl", "#define HIZ_MSAA 0\n");
+  m_hiz.shaderModuleMsaaID =
+      m_shaderManager.createShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "hiz.comp.glsl", "#define HIZ_MSAA 1\n");
+  m_expandIds.shaderModuleID = m_shaderManager.createShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "expand_ids.comp.glsl");
 
   bool valid = m_shaderManager.areShaderModulesValid();
 
@@ -580,6 +718,9 @@ bool ResourcesVK::initFramebuffer(int winWidth, int winHeight, int msaa, bool vs
   dsImageViewInfo.image = m_framebuffer.imgDepthStencil;
   result                = vkCreateImageView(m_device, &dsImageViewInfo, NULL, &m_framebuffer.viewDepthStencil);
   assert(result == VK_SUCCESS);
+
+  initHiZ();
+
   // initial resource transitions
   {
     VkCommandBuffer cmd = createTempCmdBuffer();
@@ -599,6 +740,10 @@ bool ResourcesVK::initFramebuffer(int winWidth, int winHeight, int msaa, bool vs
                          VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
     }
 
+    // the hiz stays in general layout for storage and sampling
+    cmdImageTransition(cmd, m_hiz.image, VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_ACCESS_SHADER_READ_BIT,
+                       VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
     vkEndCommandBuffer(cmd);
 
     submissionEnqueue(cmd);
@@ -716,10 +861,169 @@ void ResourcesVK::deinitFramebuffer()
   vkDestroyFramebuffer(m_device, m_framebuffer.fboUI, nullptr);
   m_framebuffer.fboUI = VK_NULL_HANDLE;
 
+  deinitHiZ();
+
   m_framebuffer.memAllocator.freeAll();
   m_framebuffer.memAllocator.deinit();
 }
 
+void ResourcesVK::initHiZ()
+{
+  VkResult result;
+
+  auto floorPow2 = [](uint32_t v) {
+    uint32_t pow2 = 1;
+    while(pow2 * 2 <= v)
+    {
+      pow2 *= 2;
+    }
+    return pow2;
+  };
+
+  m_hiz.width  = floorPow2(uint32_t(m_framebuffer.renderWidth));
+  m_hiz.height = floorPow2(uint32_t(m_framebuffer.renderHeight));
+  m_hiz.levels = 1;
+  while((std::max(m_hiz.width, m_hiz.height) >> m_hiz.levels) && m_hiz.levels < HIZ_MAX_LEVELS)
+  {
+    m_hiz.levels++;
+  }
+
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType         = VK_IMAGE_TYPE_2D;
+  imageInfo.format            = VK_FORMAT_R32_SFLOAT;
+  imageInfo.extent.width      = m_hiz.width;
+  imageInfo.extent.height     = m_hiz.height;
+  imageInfo.extent.depth      = 1;
+  imageInfo.mipLevels         = m_hiz.levels;
+  imageInfo.arrayLayers       = 1;
+  imageInfo.samples           = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling            = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage             = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.flags             = 0;
+  imageInfo.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  m_hiz.image = m_framebuffer.memAllocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  VkImageViewCreateInfo viewInfo           = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format                          = imageInfo.format;
+  viewInfo.image                           = m_hiz.image;
+  viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel   = 0;
+  viewInfo.subresourceRange.levelCount     = m_hiz.levels;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount     = 1;
+  result                                   = vkCreateImageView(m_device, &viewInfo, NULL, &m_hiz.viewAll);
+  assert(result == VK_SUCCESS);
+
+  for(uint32_t i = 0; i < m_hiz.levels; i++)
+  {
+    viewInfo.subresourceRange.baseMipLevel = i;
+    viewInfo.subresourceRange.levelCount   = 1;
+    result                                 = vkCreateImageView(m_device, &viewInfo, NULL, &m_hiz.viewLevels[i]);
+    assert(result == VK_SUCCESS);
+  }
+
+  // sampling requires a single aspect
+  viewInfo.format                        = nvvk::findDepthStencilFormat(m_physical);
+  viewInfo.image                         = m_framebuffer.imgDepthStencil;
+  viewInfo.subresourceRange.aspectMask   = VK_IMAGE_ASPECT_DEPTH_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount   = 1;
+  result                                 = vkCreateImageView(m_device, &viewInfo, NULL, &m_hiz.viewDepth);
+  assert(result == VK_SUCCESS);
+
+  {
+    // set i writes level i, reading either the depth buffer (i == 0) or level i - 1.
+    // Unused bindings still point to valid views.
+    VkDescriptorImageInfo depthInfo = {m_hiz.sampler, m_hiz.viewDepth, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+    std::vector<VkDescriptorImageInfo> srcInfos(m_hiz.levels);
+    std::vector<VkDescriptorImageInfo> dstInfos(m_hiz.levels);
+
+    std::vector<VkWriteDescriptorSet> updateDescriptors;
+    for(uint32_t i = 0; i < m_hiz.levels; i++)
+    {
+      srcInfos[i] = {VK_NULL_HANDLE, m_hiz.viewLevels[i ? i - 1 : 0], VK_IMAGE_LAYOUT_GENERAL};
+      dstInfos[i] = {VK_NULL_HANDLE, m_hiz.viewLevels[i], VK_IMAGE_LAYOUT_GENERAL};
+
+      updateDescriptors.push_back(m_hiz.container.makeWrite(i, HIZ_TEX_DEPTH, &depthInfo));
+      updateDescriptors.push_back(m_hiz.container.makeWrite(i, HIZ_IMG_SRC, &srcInfos[i]));
+      updateDescriptors.push_back(m_hiz.container.makeWrite(i, HIZ_IMG_DST, &dstInfos[i]));
+    }
+    vkUpdateDescriptorSets(m_device, updateDescriptors.size(), updateDescriptors.data(), 0, 0);
+  }
+}
+
+void ResourcesVK::deinitHiZ()
+{
+  vkDestroyImageView(m_device, m_hiz.viewAll, nullptr);
+  vkDestroyImageView(m_device, m_hiz.viewDepth, nullptr);
+  m_hiz.viewAll   = VK_NULL_HANDLE;
+  m_hiz.viewDepth = VK_NULL_HANDLE;
+  for(uint32_t i = 0; i < m_hiz.levels; i++)
+  {
+    vkDestroyImageView(m_device, m_hiz.viewLevels[i], nullptr);
+    m_hiz.viewLevels[i] = VK_NULL_HANDLE;
+  }
+
+  // memory is owned by m_framebuffer.memAllocator
+  vkDestroyImage(m_device, m_hiz.image, nullptr);
+  m_hiz.image  = VK_NULL_HANDLE;
+  m_hiz.levels = 0;
+}
+
+void ResourcesVK::cmdBuildHiZ(VkCommandBuffer cmd) const
+{
+  cmdImageTransition(cmd, m_framebuffer.imgDepthStencil, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT,
+                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+  {
+    // earlier culling passes may still read the hiz
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  bool msaa = m_framebuffer.samplesUsed != VK_SAMPLE_COUNT_1_BIT;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, msaa ? m_hiz.pipelineMsaa : m_hiz.pipeline);
+
+  for(uint32_t i = 0; i < m_hiz.levels; i++)
+  {
+    HiZPushData push;
+    push.level   = i;
+    push.samples = uint32_t(m_framebuffer.samplesUsed);
+    push.dstSize = glm::ivec2(std::max(m_hiz.width >> i, 1u), std::max(m_hiz.height >> i, 1u));
+    if(i == 0)
+    {
+      push.srcSize = glm::ivec2(m_framebuffer.renderWidth, m_framebuffer.renderHeight);
+    }
+    else
+    {
+      push.srcSize = glm::ivec2(std::max(m_hiz.width >> (i - 1), 1u), std::max(m_hiz.height >> (i - 1), 1u));
+    }
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_hiz.container.getPipeLayout(), 0, 1,
+                            m_hiz.container.getSets(i), 0, nullptr);
+    vkCmdPushConstants(cmd, m_hiz.container.getPipeLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmd, (push.dstSize.x + HIZ_WORKGROUPSIZE - 1) / HIZ_WORKGROUPSIZE,
+                  (push.dstSize.y + HIZ_WORKGROUPSIZE - 1) / HIZ_WORKGROUPSIZE, 1);
+
+    // next level reads this one, the last barrier also makes the result visible to the culling
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  cmdImageTransition(cmd, m_framebuffer.imgDepthStencil, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT,
+                     VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                     VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
+
 void ResourcesVK::initPipes()
 {
   VkResult result;
@@ -763,12 +1067,49 @@ void ResourcesVK::initPipes()
     result = vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &m_animShading.pipeline);
     assert(result == VK_SUCCESS);
   }
+
+  {
+    // both variants, so msaa changes don't need a rebuild
+    VkComputePipelineCreateInfo     pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    VkPipelineShaderStageCreateInfo stageInfo    = {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    stageInfo.stage                              = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.pName                              = "main";
+    stageInfo.module                             = m_shaderManager.get(m_hiz.shaderModuleID);
+
+    pipelineInfo.layout = m_hiz.container.getPipeLayout();
+    pipelineInfo.stage  = stageInfo;
+    result = vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &m_hiz.pipeline);
+    assert(result == VK_SUCCESS);
+
+    pipelineInfo.stage.module = m_shaderManager.get(m_hiz.shaderModuleMsaaID);
+    result = vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &m_hiz.pipelineMsaa);
+    assert(result == VK_SUCCESS);
+  }
+
+  {
+    VkComputePipelineCreateInfo     pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    VkPipelineShaderStageCreateInfo stageInfo    = {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    stageInfo.stage                              = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.pName                              = "main";
+    stageInfo.module                             = m_shaderManager.get(m_expandIds.shaderModuleID);
+
+    pipelineInfo.layout = m_expandIds.pipeLayout;
+    pipelineInfo.stage  = stageInfo;
+    result = vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &m_expandIds.pipeline);
+    assert(result == VK_SUCCESS);
+  }
 }
 
 void ResourcesVK::deinitPipes()
 {
   vkDestroyPipeline(m_device, m_animShading.pipeline, NULL);
   m_animShading.pipeline = VK_NULL_HANDLE;
+  vkDestroyPipeline(m_device, m_hiz.pipeline, NULL);
+  vkDestroyPipeline(m_device, m_hiz.pipelineMsaa, NULL);
+  m_hiz.pipeline     = VK_NULL_HANDLE;
+  m_hiz.pipelineMsaa = VK_NULL_HANDLE;
+  vkDestroyPipeline(m_device, m_expandIds.pipeline, NULL);
+  m_expandIds.pipeline = VK_NULL_HANDLE;
 }
 
 void ResourcesVK::cmdDynamicState(VkCommandBuffer cmd) const
@@ -943,7 +1284,10 @@ bool ResourcesVK::initScene(const CadScene& cadscene)
 
   m_numMatrices = uint(cadscene.m_matrices.size());
 
-  m_scene.init(cadscene, &m_allocator, m_queue, m_queueFamily);
+  // geometry is uploaded in the background if there is a separate transfer queue
+  m_scene.init(cadscene, &m_allocator, m_queue, m_queueFamily, m_context->m_queueT.queue, m_context->m_queueT.familyIndex,
+               m_geometryBudget);
+  m_geometryChangeID++;
 
 
   {
@@ -955,10 +1299,53 @@ bool ResourcesVK::initScene(const CadScene& cadscene)
     updateDescriptors.push_back(m_animScene.makeWrite(0, ANIM_UBO, &m_common.anim.info));
     updateDescriptors.push_back(m_animScene.makeWrite(0, ANIM_SSBO_MATRIXOUT, &m_scene.m_buffers.matrices.info));
     updateDescriptors.push_back(m_animScene.makeWrite(0, ANIM_SSBO_MATRIXORIG, &m_scene.m_buffers.matricesOrig.info));
+    updateDescriptors.push_back(m_animScene.makeWrite(0, ANIM_SSBO_DEQUANT, &m_scene.m_buffers.dequantNodes.info));
 
     vkUpdateDescriptorSets(m_device, updateDescriptors.size(), updateDescriptors.data(), 0, 0);
   }
 
+  {
+    // one bit per unique part index
+    m_selection.numWords = (cadscene.m_numObjectParts + 31) / 32;
+
+    VkDeviceSize size = sizeof(uint32_t) * std::max(m_selection.numWords, 1u);
+    m_selection.bits  = createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_selection.set   = createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_selection.readback.init(&m_allocator, size);
+    m_selection.result.clear();
+    m_selection.resultNew = false;
+
+    ScopeStaging staging(m_allocator, m_queue, m_queueFamily);
+    vkCmdFillBuffer(staging.getCmd(), m_selection.bits.buffer, 0, size, 0);
+    vkCmdFillBuffer(staging.getCmd(), m_selection.set.buffer, 0, size, 0);
+    staging.submit();
+  }
+
+  {
+    // all zero means no override
+    m_partOverrides.table.assign(std::max(cadscene.m_numObjectParts, 1u), PartOverride{0, 0});
+    m_partOverrides.buffer = createBuffer(sizeof(PartOverride) * m_partOverrides.table.size(),
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_partOverrides.dirty.clear();
+    m_partOverrides.numHidden  = 0;
+    m_partOverrides.numCutouts = 0;
+    m_partOverrides.hiddenChangeID++;
+
+    ScopeStaging staging(m_allocator, m_queue, m_queueFamily);
+    vkCmdFillBuffer(staging.getCmd(), m_partOverrides.buffer.buffer, 0, m_partOverrides.buffer.info.range, 0);
+    staging.submit();
+  }
+
+  {
+    m_coverage.numParts = cadscene.m_numObjectParts;
+
+    VkDeviceSize size   = sizeof(uint32_t) * std::max(m_coverage.numParts, 1u);
+    m_coverage.counters = createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_coverage.readback.init(&m_allocator, size);
+    m_coverage.result.clear();
+    m_coverage.resultNew = false;
+  }
+
   return true;
 }
 
@@ -967,6 +1354,498 @@ void ResourcesVK::deinitScene()
   // guard by synchronization as some stuff is unsafe to delete while in use
   synchronize();
   m_scene.deinit();
+
+  if(m_selection.bits.buffer)
+  {
+    destroy(m_selection.bits);
+    destroy(m_selection.set);
+    m_selection.readback.deinit();
+  }
+  m_selection.numWords = 0;
+  m_selection.result.clear();
+  m_selection.resultNew = false;
+
+  if(m_partOverrides.buffer.buffer)
+  {
+    destroy(m_partOverrides.buffer);
+  }
+  m_partOverrides.table.clear();
+  m_partOverrides.dirty.clear();
+  m_partOverrides.numHidden  = 0;
+  m_partOverrides.numCutouts = 0;
+
+  if(m_coverage.counters.buffer)
+  {
+    destroy(m_coverage.counters);
+    m_coverage.readback.deinit();
+  }
+  m_coverage.numParts = 0;
+  m_coverage.result.clear();
+  m_coverage.resultNew = false;
+}
+
+bool ResourcesVK::cmdExpandTrianglePartIds(VkCommandBuffer cmd, const std::vector<uint32_t>& geometryIndices)
+{
+  bool bound = false;
+  for(uint32_t g : geometryIndices)
+  {
+    CadSceneVK::Geometry& geom = m_scene.m_geometry[g];
+    if(geom.trianglePartIdsValid || !m_scene.isGeometryReady(g))
+    {
+      continue;
+    }
+    geom.trianglePartIdsValid = true;
+    if(!geom.trianglePartIds.range)
+    {
+      continue;
+    }
+
+    if(!bound)
+    {
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_expandIds.pipeline);
+      bound = true;
+    }
+
+    ExpandIdsPushData push;
+    push.trianglePartIdsAddr = geom.trianglePartIdsAddr;
+    push.partTriCountsAddr   = geom.partTriCountsAddr;
+    push.partTriOffsetsAddr  = geom.partTriOffsetsAddr;
+    push.numParts            = geom.numParts;
+    push.numLevels           = geom.numLevels;
+    vkCmdPushConstants(cmd, m_expandIds.pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    // 65535 is the minimum guaranteed workgroup count, the shader loops over further parts
+    vkCmdDispatch(cmd, std::min(geom.numParts, 65535u), geom.numLevels, 1);
+  }
+
+  if(bound)
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1,
+                         &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  return bound;
+}
+
+bool ResourcesVK::getSelection(std::vector<uint32_t>& partIndices, uint32_t& latency)
+{
+  if(!m_selection.resultNew)
+  {
+    return false;
+  }
+
+  partIndices           = m_selection.result;
+  latency               = m_selection.resultLatency;
+  m_selection.resultNew = false;
+  return true;
+}
+
+void ResourcesVK::cmdSelectionBegin(VkCommandBuffer cmd, const Global& global) const
+{
+  if(global.sceneUbo.selectMode == SELECTION_MODE_NONE)
+  {
+    return;
+  }
+
+  VkDeviceSize size = m_selection.bits.info.range;
+
+  {
+    // previous frames may still access the selection buffers
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  if(global.selectionAdditive)
+  {
+    VkBufferCopy cpy = {0, 0, size};
+    vkCmdCopyBuffer(cmd, m_selection.set.buffer, m_selection.bits.buffer, 1, &cpy);
+  }
+  else
+  {
+    vkCmdFillBuffer(cmd, m_selection.bits.buffer, 0, size, 0);
+  }
+
+  if(global.sceneUbo.selectMode == SELECTION_MODE_LASSO && global.selectionMask)
+  {
+    // vkCmdUpdateBuffer is limited to 64 KB, hence SELECTION_MASK_MAX_BYTES
+    VkDeviceSize maskSize = alignedSize(std::min(global.selectionMaskSize, size_t(SELECTION_MASK_MAX_BYTES)), 4);
+    vkCmdUpdateBuffer(cmd, m_selection.mask.buffer, 0, maskSize, global.selectionMask);
+  }
+
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+}
+
+void ResourcesVK::cmdSelectionEnd(VkCommandBuffer cmd, const Global& global)
+{
+  if(global.sceneUbo.selectMode == SELECTION_MODE_NONE)
+  {
+    return;
+  }
+
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+
+  // the new selection drives the highlight from the next frame on,
+  // the host gets its copy once this frame's fence completed
+  VkBufferCopy cpy = {0, 0, m_selection.bits.info.range};
+  vkCmdCopyBuffer(cmd, m_selection.bits.buffer, m_selection.set.buffer, 1, &cpy);
+  m_selection.readback.cmdCopy(cmd, m_ringFences.getCycleIndex(), m_frame, m_selection.bits.buffer, 0);
+
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+}
+
+void ResourcesVK::setPartOverride(uint32_t partIndex, const PartOverride& value)
+{
+  if(partIndex >= m_partOverrides.table.size())
+  {
+    return;
+  }
+
+  PartOverride& entry = m_partOverrides.table[partIndex];
+  if(entry.color == value.color && entry.flags == value.flags)
+  {
+    return;
+  }
+
+  const uint32_t cutoutFlags = PART_OVERRIDE_HIDDEN | PART_OVERRIDE_GHOST;
+  bool           wasHidden   = (entry.flags & PART_OVERRIDE_HIDDEN) != 0;
+  bool           isHidden    = (value.flags & PART_OVERRIDE_HIDDEN) != 0;
+  bool           wasCutout   = (entry.flags & cutoutFlags) != 0;
+  bool           isCutout    = (value.flags & cutoutFlags) != 0;
+
+  m_partOverrides.numHidden += uint32_t(isHidden) - uint32_t(wasHidden);
+  m_partOverrides.numCutouts += uint32_t(isCutout) - uint32_t(wasCutout);
+  if(wasHidden != isHidden)
+  {
+    m_partOverrides.hiddenChangeID++;
+  }
+
+  entry = value;
+  m_partOverrides.dirty.push_back(partIndex);
+}
+
+void ResourcesVK::resetPartOverrides()
+{
+  for(uint32_t i = 0; i < uint32_t(m_partOverrides.table.size()); i++)
+  {
+    setPartOverride(i, PartOverride{0, 0});
+  }
+}
+
+void ResourcesVK::cmdPartOverridesUpdate(VkCommandBuffer cmd)
+{
+  std::vector<uint32_t>& dirty = m_partOverrides.dirty;
+  if(dirty.empty())
+  {
+    return;
+  }
+
+  {
+    // previous frames may still read the table
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  // Edits of parts far apart, for example the same part in several objects, would make a
+  // single span cover most of the table. Nearby parts are merged into one range instead,
+  // the few clean entries in between cost less than another command.
+  // vkCmdUpdateBuffer is limited to 64 KB per call.
+  const uint32_t maxGap       = 16;
+  const uint32_t maxPerUpdate = 65536 / sizeof(PartOverride);
+
+  std::sort(dirty.begin(), dirty.end());
+  dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+  size_t i = 0;
+  while(i < dirty.size())
+  {
+    uint32_t begin = dirty[i];
+    uint32_t end   = begin + 1;
+    for(i++; i < dirty.size() && dirty[i] <= end + maxGap && dirty[i] < begin + maxPerUpdate; i++)
+    {
+      end = dirty[i] + 1;
+    }
+    vkCmdUpdateBuffer(cmd, m_partOverrides.buffer.buffer, sizeof(PartOverride) * begin, sizeof(PartOverride) * (end - begin),
+                      &m_partOverrides.table[begin]);
+  }
+
+  dirty.clear();
+
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+}
+
+bool ResourcesVK::getResidencyStats(ResidencyStats& stats)
+{
+  const CadSceneVK::Residency& residency = m_scene.m_residency;
+  if(!residency.budget)
+  {
+    return false;
+  }
+
+  stats.budget       = size_t(residency.budget);
+  stats.residentSize = size_t(residency.residentSize);
+  stats.numResident  = residency.numResident;
+  stats.hits         = residency.hits;
+  stats.misses       = residency.misses;
+  stats.uploads      = residency.uploads;
+  stats.evictions    = residency.evictions;
+  return true;
+}
+
+bool ResourcesVK::getPartCoverage(uint32_t topN, std::vector<PartCoverage>& topParts, uint32_t& numVisible, uint32_t& latency)
+{
+  if(!m_coverage.resultNew)
+  {
+    return false;
+  }
+
+  topParts.clear();
+  for(uint32_t i = 0; i < uint32_t(m_coverage.result.size()); i++)
+  {
+    if(m_coverage.result[i])
+    {
+      topParts.push_back({i, m_coverage.result[i]});
+    }
+  }
+
+  numVisible = uint32_t(topParts.size());
+  topN       = std::min(topN, numVisible);
+
+  std::partial_sort(topParts.begin(), topParts.begin() + topN, topParts.end(),
+                    [](const PartCoverage& a, const PartCoverage& b) { return a.pixels > b.pixels; });
+  topParts.resize(topN);
+
+  latency              = m_coverage.resultLatency;
+  m_coverage.resultNew = false;
+  return true;
+}
+
+void ResourcesVK::cmdCoverageBegin(VkCommandBuffer cmd) const
+{
+  {
+    // previous frames may still access the counters
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  vkCmdFillBuffer(cmd, m_coverage.counters.buffer, 0, m_coverage.counters.info.range, 0);
+
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+}
+
+void ResourcesVK::cmdCoverageEnd(VkCommandBuffer cmd)
+{
+  {
+    VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    memBarrier.dstAccessMask   = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memBarrier,
+                         0, nullptr, 0, nullptr);
+  }
+
+  m_coverage.readback.cmdCopy(cmd, m_ringFences.getCycleIndex(), m_frame, m_coverage.counters.buffer, 0);
+}
+
+VkMemoryPropertyFlags ResourcesVK::getMappedMemFlags() const
+{
+  const VkMemoryPropertyFlags hostFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  const VkMemoryPropertyFlags allFlags  = hostFlags | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+  const VkPhysicalDeviceMemoryProperties& memProps = m_context->m_physicalInfo.memoryProperties;
+  for(uint32_t i = 0; i < memProps.memoryTypeCount; i++)
+  {
+    if((memProps.memoryTypes[i].propertyFlags & allFlags) == allFlags)
+    {
+      return allFlags;
+    }
+  }
+
+  return hostFlags;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ReadbackRing::init(nvvk::ResourceAllocator* allocator, VkDeviceSize size)
+{
+  m_allocator = allocator;
+  m_size      = size;
+}
+
+void ReadbackRing::deinit()
+{
+  for(uint32_t i = 0; i < MAX_CYCLES; i++)
+  {
+    Entry& entry = m_entries[i];
+    if(entry.buffer.buffer)
+    {
+      m_allocator->unmap(entry.buffer);
+      destroyResBuffer(*m_allocator, entry.buffer);
+    }
+    entry = Entry();
+  }
+  m_size = 0;
+}
+
+void ReadbackRing::cmdCopy(VkCommandBuffer cmd, uint32_t cycle, uint32_t frame, VkBuffer src, VkDeviceSize srcOffset)
+{
+  assert(cycle < MAX_CYCLES);
+  Entry& entry = m_entries[cycle];
+  if(!entry.buffer.buffer)
+  {
+    // created on first use and kept mapped
+    entry.buffer  = createResBuffer(*m_allocator, m_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    entry.mapping = m_allocator->map(entry.buffer);
+  }
+
+  VkBufferCopy cpy = {srcOffset, 0, m_size};
+  vkCmdCopyBuffer(cmd, src, entry.buffer.buffer, 1, &cpy);
+
+  VkMemoryBarrier memBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  memBarrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memBarrier.dstAccessMask   = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memBarrier, 0, nullptr, 0, nullptr);
+
+  entry.frame   = frame;
+  entry.pending = true;
+}
+
+const void* ReadbackRing::acquire(uint32_t cycle, uint32_t& frame)
+{
+  assert(cycle < MAX_CYCLES);
+  Entry& entry = m_entries[cycle];
+  if(!entry.pending)
+  {
+    return nullptr;
+  }
+
+  entry.pending = false;
+  frame         = entry.frame;
+  return entry.mapping;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MappedBuffer::init(nvvk::ResourceAllocator* allocator, VkBufferUsageFlags usage, VkMemoryPropertyFlags memFlags)
+{
+  assert(memFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  m_allocator = allocator;
+  m_usage     = usage;
+  m_memFlags  = memFlags;
+}
+
+void MappedBuffer::deinit()
+{
+  destroy(m_current);
+  for(Storage& spare : m_spares)
+  {
+    destroy(spare);
+  }
+  m_spares.clear();
+  m_allocator = nullptr;
+}
+
+void MappedBuffer::destroy(Storage& storage)
+{
+  if(storage.buffer.buffer)
+  {
+    m_allocator->unmap(storage.buffer);
+    destroyResBuffer(*m_allocator, storage.buffer);
+  }
+  storage = Storage();
+}
+
+void* MappedBuffer::map(VkDeviceSize size, uint32_t frame)
+{
+  assert(m_allocator);
+
+  VkDeviceSize capacity = 0;
+  if(m_current.buffer.buffer)
+  {
+    capacity            = m_current.capacity;
+    m_current.lastFrame = frame;
+    m_spares.push_back(m_current);
+    m_current = Storage();
+  }
+
+  // RingFences::setCycleAndWait(frame) guarantees completion of all frames up to frame - DEFAULT_RING_SIZE.
+  // Idle spares are reused if big enough, too small ones are released as the size only grows.
+  for(size_t i = 0; i < m_spares.size();)
+  {
+    Storage& spare = m_spares[i];
+    if(spare.lastFrame + nvvk::DEFAULT_RING_SIZE > frame)
+    {
+      i++;
+    }
+    else if(spare.capacity >= size && !m_current.buffer.buffer)
+    {
+      m_current = spare;
+      m_spares.erase(m_spares.begin() + i);
+    }
+    else if(spare.capacity < size)
+    {
+      destroy(spare);
+      m_spares.erase(m_spares.begin() + i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  if(!m_current.buffer.buffer)
+  {
+    // grow by half to avoid reallocating for every small increase
+    capacity           = capacity >= size ? capacity : std::max(size, capacity + capacity / 2);
+    capacity           = std::max(capacity, VkDeviceSize(4096));
+    m_current.buffer   = createResBuffer(*m_allocator, capacity, m_usage, m_memFlags);
+    m_current.mapping  = m_allocator->map(m_current.buffer);
+    m_current.capacity = capacity;
+  }
+
+  return m_current.mapping;
 }
 
 void ResourcesVK::synchronize()
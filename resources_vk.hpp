@@ -45,6 +45,74 @@
 
 namespace idraster {
 
+// ReadbackRing copies device data into host-visible buffers, one per frame ring cycle.
+// A copy recorded within a cycle can be read after RingFences::setCycleAndWait
+// waited for that cycle again, so the readback never stalls the GPU.
+class ReadbackRing
+{
+public:
+  static const uint32_t MAX_CYCLES = 8;
+
+  void init(nvvk::ResourceAllocator* allocator, VkDeviceSize size);
+  void deinit();
+
+  void cmdCopy(VkCommandBuffer cmd, uint32_t cycle, uint32_t frame, VkBuffer src, VkDeviceSize srcOffset);
+  // must only be called after the cycle's fence was waited on,
+  // returns nullptr if nothing was copied within that cycle
+  const void* acquire(uint32_t cycle, uint32_t& frame);
+
+  VkDeviceSize getSize() const { return m_size; }
+
+private:
+  struct Entry
+  {
+    ResBuffer buffer;
+    void*     mapping = nullptr;
+    uint32_t  frame   = 0;
+    bool      pending = false;
+  };
+
+  nvvk::ResourceAllocator* m_allocator = nullptr;
+  VkDeviceSize             m_size      = 0;
+  Entry                    m_entries[MAX_CYCLES];
+};
+
+// MappedBuffer is a grow-only, persistently mapped buffer for data the host rewrites
+// when command buffers are re-recorded. Storage that frames in flight may still read is
+// never overwritten, but swapped for a spare that RingFences guarantees to be idle,
+// so updates neither stage nor wait on the queue.
+class MappedBuffer
+{
+public:
+  // memFlags must include VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  void init(nvvk::ResourceAllocator* allocator, VkBufferUsageFlags usage, VkMemoryPropertyFlags memFlags);
+  void deinit();
+
+  // returns host memory for at least size bytes, written contents are visible to the next submit.
+  // The previous contents are considered in use by all frames up to frame,
+  // so the returned storage and getBuffer() change with every call.
+  void* map(VkDeviceSize size, uint32_t frame);
+
+  const ResBuffer& getBuffer() const { return m_current.buffer; }
+
+private:
+  struct Storage
+  {
+    ResBuffer    buffer;
+    void*        mapping   = nullptr;
+    VkDeviceSize capacity  = 0;
+    uint32_t     lastFrame = 0;
+  };
+
+  void destroy(Storage& storage);
+
+  nvvk::ResourceAllocator* m_allocator = nullptr;
+  VkBufferUsageFlags       m_usage     = 0;
+  VkMemoryPropertyFlags    m_memFlags  = 0;
+  Storage                  m_current;
+  std::vector<Storage>     m_spares;
+};
+
 class ResourcesVK : public Resources
 {
 public:
@@ -103,6 +171,65 @@ public:
     ResBuffer anim;
   };
 
+  // one bit per unique part index (CadScene::m_numObjectParts)
+  struct Selection
+  {
+    ResBuffer    bits;  // written while a selection is performed
+    ResBuffer    set;   // last selection result, used for highlighting
+    ResBuffer    mask;  // lasso mask, see SceneData::selectMaskShift
+    ReadbackRing readback;
+    uint32_t     numWords = 0;
+
+    std::vector<uint32_t> result;
+    uint32_t              resultLatency = 0;
+    bool                  resultNew     = false;
+  };
+
+  // host copy of the PartOverride table, the dirty ranges are uploaded per frame
+  struct PartOverrides
+  {
+    ResBuffer                 buffer;
+    std::vector<PartOverride> table;
+    std::vector<uint32_t>     dirty;  // part indices edited since the last upload, unsorted
+
+    // renderers skip fully hidden draws and switch to late depth tests only while needed
+    uint32_t numHidden      = 0;  // entries with PART_OVERRIDE_HIDDEN
+    uint32_t numCutouts     = 0;  // entries with PART_OVERRIDE_HIDDEN or PART_OVERRIDE_GHOST
+    size_t   hiddenChangeID = 0;  // incremented whenever a part is hidden or shown
+  };
+
+  // visible pixels per unique part index, see PART_COVERAGE_PASS
+  struct Coverage
+  {
+    ResBuffer    counters;
+    ReadbackRing readback;
+    uint32_t     numParts = 0;
+
+    std::vector<uint32_t> result;
+    uint32_t              resultLatency = 0;
+    bool                  resultNew     = false;
+  };
+
+  // hierarchical depth pyramid of the scene's depth buffer, storing the farthest depth,
+  // level 0 is the largest power of two not exceeding the framebuffer size
+  struct HiZ
+  {
+    VkImage     image                      = VK_NULL_HANDLE;
+    VkImageView viewAll                    = VK_NULL_HANDLE;  // all levels, for sampling
+    VkImageView viewLevels[HIZ_MAX_LEVELS] = {};              // individual levels, for storage
+    VkImageView viewDepth                  = VK_NULL_HANDLE;  // depth aspect of the depth buffer
+    VkSampler   sampler                    = VK_NULL_HANDLE;
+    uint32_t    width                      = 0;
+    uint32_t    height                     = 0;
+    uint32_t    levels                     = 0;
+
+    nvvk::ShaderModuleID         shaderModuleID;
+    nvvk::ShaderModuleID         shaderModuleMsaaID;
+    VkPipeline                   pipeline     = VK_NULL_HANDLE;
+    VkPipeline                   pipelineMsaa = VK_NULL_HANDLE;
+    nvvk::DescriptorSetContainer container;  // one set per level
+  };
+
   struct
   {
     nvvk::ShaderModuleID shaderModuleID;
@@ -110,11 +237,24 @@ public:
     VkPipeline           pipeline;
   } m_animShading;
 
+  // fills CadSceneVK::Geometry::trianglePartIds from the part triangle counts and offsets
+  struct ExpandIds
+  {
+    nvvk::ShaderModuleID shaderModuleID;
+    VkPipelineLayout     pipeLayout = VK_NULL_HANDLE;  // push constants only
+    VkPipeline           pipeline   = VK_NULL_HANDLE;
+  };
+
   bool                      m_withinFrame = false;
   nvvk::ShaderModuleManager m_shaderManager;
 
-  FrameBuffer m_framebuffer;
-  Common      m_common;
+  FrameBuffer   m_framebuffer;
+  Common        m_common;
+  Selection     m_selection;
+  PartOverrides m_partOverrides;
+  Coverage      m_coverage;
+  HiZ           m_hiz;
+  ExpandIds     m_expandIds;
 
   nvvk::SwapChain* m_swapChain;
   nvvk::Context*   m_context;
@@ -145,6 +285,8 @@ public:
 
   size_t m_pipeChangeID;
   size_t m_fboChangeID;
+  size_t m_geometryChangeID;  // more geometries became drawable, see CadSceneVK::isGeometryReady
+  size_t m_geometryBudget = 0;  // for the next initScene, 0 keeps all geometry resident
 
   bool init(nvvk::Context* context, nvvk::SwapChain* swapChain, nvh::Profiler* profiler) override;
   void deinit() override;
@@ -162,9 +304,24 @@ public:
   bool initFramebuffer(int width, int height, int msaa, bool vsync) override;
   void deinitFramebuffer();
 
+  void initHiZ();
+  void deinitHiZ();
+  // builds m_hiz from the current depth buffer, must be outside a render pass.
+  // The result is ready for compute shader reads.
+  void cmdBuildHiZ(VkCommandBuffer cmd) const;
+
   bool initScene(const CadScene&) override;
   void deinitScene() override;
 
+  // expands the per-triangle part ids of the given geometries that are ready but not expanded
+  // yet, must be outside a render pass. Returns true if anything was recorded, the ids are then
+  // ready for shader reads.
+  bool cmdExpandTrianglePartIds(VkCommandBuffer cmd, const std::vector<uint32_t>& geometryIndices);
+
+  void setGeometryBudget(size_t bytes) override { m_geometryBudget = bytes; }
+  bool getResidencyStats(ResidencyStats& stats) override;
+  bool needsHostGeometry() override { return m_scene.isUploading() || m_scene.m_residency.budget != 0; }
+
   void synchronize() override;
 
   void beginFrame() override;
@@ -174,8 +331,27 @@ public:
   void animation(const Global& global) override;
   void animationReset() override;
 
+  bool getSelection(std::vector<uint32_t>& partIndices, uint32_t& latency) override;
+  // prepare and finish the selection buffers around the scene's render pass,
+  // no-ops if global.sceneUbo.selectMode is SELECTION_MODE_NONE
+  void cmdSelectionBegin(VkCommandBuffer cmd, const Global& global) const;
+  void cmdSelectionEnd(VkCommandBuffer cmd, const Global& global);
+
+  void setPartOverride(uint32_t partIndex, const PartOverride& value) override;
+  void resetPartOverrides() override;
+  // uploads the dirty range of the override table, must be outside a render pass
+  void cmdPartOverridesUpdate(VkCommandBuffer cmd);
+
+  bool getPartCoverage(uint32_t topN, std::vector<PartCoverage>& topParts, uint32_t& numVisible, uint32_t& latency) override;
+  // reset the counters before and read them back after the coverage pass
+  void cmdCoverageBegin(VkCommandBuffer cmd) const;
+  void cmdCoverageEnd(VkCommandBuffer cmd);
+
   //////////////////////////////////////////////////////////////////////////
 
+  // host-visible coherent, plus device-local if such a memory type exists
+  VkMemoryPropertyFlags getMappedMemFlags() const;
+
   ResBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags flags, VkMemoryPropertyFlags memFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
   {
     return createResBuffer(m_allocator, size, flags, memFlags);